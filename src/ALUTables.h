@@ -0,0 +1,42 @@
+#ifndef _ALUTABLES_H_
+#define _ALUTABLES_H_
+
+#include "types.h"
+
+/*
+Results and flags of the 8 bit ALU operations, for every operand.
+
+The tables are generated at build time by tools/genALUTables.c. Entries
+that hold a result are laid out like AF, with the result in the high
+byte and the flags in the low byte. Flags follow the same rules as the
+helpers in CPU_instructions.c used to work out one bit at a time.
+*/
+
+/* The CB prefixed shifts and rotates, first index of aluShift */
+typedef enum aluShiftOperation {
+   ALU_RLC,
+   ALU_RRC,
+   ALU_RL,
+   ALU_RR,
+   ALU_SLA,
+   ALU_SRA,
+   ALU_SRL,
+   ALU_SWAP
+} aluShiftOperation;
+
+/* ADD/ADC and SUB/SBC/CP, indexed by [carry in][a][b] */
+extern const word aluADD[2][0x100][0x100];
+extern const word aluSUB[2][0x100][0x100];
+
+/* Flags left by INC and DEC (Z, N and H only), indexed by the value
+   before the operation */
+extern const byte aluINC[0x100];
+extern const byte aluDEC[0x100];
+
+/* DAA, indexed by [N, H and C as bits 2, 1 and 0][a] */
+extern const word aluDAA[8][0x100];
+
+/* Shifts and rotates, indexed by [operation][carry in][value] */
+extern const word aluShift[8][2][0x100];
+
+#endif
@@ -4,24 +4,48 @@
 
 #include "GB.h"
 #include "CPU.h"
+#include "CPU_state.h"
 #include "CPU_instructions.h"
 #include "MMU.h"
+#ifdef CPU_JIT
+#include "JIT.h"
+#endif
+#ifdef CPU_IDIOMS
+#include "CPU_idioms.h"
+#endif
 
 #include "bitOperations.h"
 
-struct CPU {
-   GB gb;
-
-   bool IME;
-   reg registers[NUM_REGISTERS];
-};
-
 /* Arrays of pointers to the functions that will execute the CPU instructions */
 int (*instructionMap[0x100])(CPU) = {NULL};
 int (*instructionMapCB[0x100])(CPU) = {NULL};
 
+/* Instruction lengths in bytes, indexed by opcode */
+static const byte instructionLengths[0x100] = {
+   1, 3, 1, 1, 1, 1, 2, 1, 3, 1, 1, 1, 1, 1, 2, 1,
+   1, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+   2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+   2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+   1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+   1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+   1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+   1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+   1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+   1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+   1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+   1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+   1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 2, 3, 3, 2, 1,
+   1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1,
+   2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1,
+   2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1
+};
+
 void CPU_initInstructionMap (void);
 
+/* Runs the next instruction through the instruction maps, opcode is
+   set to its first byte */
+int CPU_interpret (CPU cpu, byte *opcode);
+
 CPU CPU_init (GB gb) {
    CPU newCPU = (CPU)malloc(sizeof(struct CPU));
    assert (newCPU != NULL);
@@ -30,6 +54,19 @@ CPU CPU_init (GB gb) {
 
    /* Not sure about this one */
    newCPU->IME = FALSE;
+   newCPU->isIMEPending = FALSE;
+   newCPU->isExitRequested = FALSE;
+   newCPU->runCycles = 0;
+#ifdef CPU_ACCURATE
+   newCPU->accessCycles = 0;
+#endif
+
+#ifdef CPU_DECODE_CACHE
+   newCPU->decoded = NULL;
+#endif
+#ifdef CPU_LAZY_FLAGS
+   newCPU->flagOp = FLAGS_NONE;
+#endif
 
    /* Set up an array of function pointers with opcodes as indices */
    CPU_initInstructionMap ();
@@ -42,12 +79,16 @@ void CPU_free (CPU cpu) {
 }
 
 word CPU_get16bitRegisterValue (CPU cpu, register16 r) {
-   assert (r < NUM_REGISTERS);
+#ifdef CPU_LAZY_FLAGS
+   if (r == AF) CPU_updateFlags (cpu);
+#endif
    return cpu->registers[r].value;
 }
 
 void CPU_set16bitRegisterValue (CPU cpu, register16 r, word value) {
-   assert (r < NUM_REGISTERS);
+#ifdef CPU_LAZY_FLAGS
+   if (r == AF) cpu->flagOp = FLAGS_NONE;
+#endif
    cpu->registers[r].value = value;
 }
 
@@ -56,28 +97,31 @@ byte CPU_get8bitRegisterValue (CPU cpu, register8 r) {
 
    switch (r) {
       case A:
-         value = cpu->registers[AF].bytes.high;
+         value = cpu->af.bytes.high;
          break;
       case F:
-         value = cpu->registers[AF].bytes.low;
+#ifdef CPU_LAZY_FLAGS
+         CPU_updateFlags (cpu);
+#endif
+         value = cpu->af.bytes.low;
          break;
       case B:
-         value = cpu->registers[BC].bytes.high;
+         value = cpu->bc.bytes.high;
          break;
       case C:
-         value = cpu->registers[BC].bytes.low;
+         value = cpu->bc.bytes.low;
          break;
       case D:
-         value = cpu->registers[DE].bytes.high;
+         value = cpu->de.bytes.high;
          break;
       case E:
-         value = cpu->registers[DE].bytes.low;
+         value = cpu->de.bytes.low;
          break;
       case H:
-         value = cpu->registers[HL].bytes.high;
+         value = cpu->hl.bytes.high;
          break;
       case L:
-         value = cpu->registers[HL].bytes.low;
+         value = cpu->hl.bytes.low;
          break;
       default:
          break;
@@ -89,80 +133,259 @@ byte CPU_get8bitRegisterValue (CPU cpu, register8 r) {
 void CPU_set8bitRegisterValue (CPU cpu, register8 r, byte value) {
    switch (r) {
       case A:
-         cpu->registers[AF].bytes.high = value;
+         cpu->af.bytes.high = value;
          break;
       case F:
-         cpu->registers[AF].bytes.low = value;
+#ifdef CPU_LAZY_FLAGS
+         cpu->flagOp = FLAGS_NONE;
+#endif
+         cpu->af.bytes.low = value;
          break;
       case B:
-         cpu->registers[BC].bytes.high = value;
+         cpu->bc.bytes.high = value;
          break;
       case C:
-         cpu->registers[BC].bytes.low = value;
+         cpu->bc.bytes.low = value;
          break;
       case D:
-         cpu->registers[DE].bytes.high = value;
+         cpu->de.bytes.high = value;
          break;
       case E:
-         cpu->registers[DE].bytes.low = value;
+         cpu->de.bytes.low = value;
          break;
       case H:
-         cpu->registers[HL].bytes.high = value;
+         cpu->hl.bytes.high = value;
          break;
       case L:
-         cpu->registers[HL].bytes.low = value;
+         cpu->hl.bytes.low = value;
          break;
       default:
          break;
    }
 }
 
+CPU_instruction CPU_getInstruction (byte opcode, bool prefixCB) {
+   return prefixCB ? instructionMapCB[opcode] : instructionMap[opcode];
+}
+
+int CPU_getInstructionLength (byte opcode) {
+   return instructionLengths[opcode];
+}
+
+#ifndef CPU_SWITCH_CORE
 int CPU_step (CPU cpu) {
-   int numCycles = 0;
    byte opcode;
+#if defined(CPU_JIT) || defined(CPU_ACCURATE)
+   int numCycles;
+#endif
+
+   if (cpu->isIMEPending) {
+      /* EI takes effect after this instruction */
+      cpu->isIMEPending = FALSE;
+      cpu->IME = TRUE;
+   }
+
+#ifdef CPU_JIT
+
+   /* Run the translated block at PC if there is one */
+   numCycles = JIT_run (GB_getJIT (cpu->gb), cpu, cpu->registers, 1);
+   if (numCycles > 0) {
+      return numCycles;
+   }
+#endif
+
+#ifdef CPU_ACCURATE
+   numCycles = CPU_interpret (cpu, &opcode);
+   cpu->accessCycles = 0;
+
+   return numCycles;
+#else
+   return CPU_interpret (cpu, &opcode);
+#endif
+}
+
+int CPU_interpret (CPU cpu, byte *opcode) {
+   int numCycles = 0;
+   byte opcodeCB;
    MMU mmu;
+#ifdef CPU_DECODE_CACHE
+   decodedInstruction *decoded;
+
+   /* Use the pre-decoded instruction if there is one */
+   decoded = DecodeCache_lookup (GB_getDecodeCache (cpu->gb),
+                                 cpu->pc.value);
+   if (decoded != NULL) {
+      *opcode = decoded->opcode;
+      cpu->decoded = decoded;
+      numCycles = decoded->execute (cpu);
+      cpu->decoded = NULL;
+
+      return numCycles;
+   }
+#endif
 
    mmu = GB_getMMU (cpu->gb);
    
    /* Fetch the opcode for the next instruction to execute */
-   opcode = MMU_readByte (mmu, cpu->registers[PC].value);
+#ifdef CPU_ACCURATE
+   cpu->accessCycles = 0;
+   *opcode = CPU_readByte (cpu, mmu, cpu->pc.value);
+#else
+   *opcode = MMU_readByte (mmu, cpu->pc.value);
+#endif
 
-   // printf ("%x %x\n", cpu->registers[PC].value, opcode);
+   // printf ("%x %x\n", cpu->pc.value, opcode);
 
    /*
-   printf ("PC = %x\n", cpu->registers[PC].value);
+   printf ("PC = %x\n", cpu->pc.value);
    printf ("opcode = %x\n", opcode);
-   printf ("AF = %x\n", cpu->registers[AF].value);
-   printf ("BC = %x\n", cpu->registers[BC].value);
-   printf ("DE = %x\n", cpu->registers[DE].value);
-   printf ("HL = %x\n", cpu->registers[HL].value);
-   printf ("SP = %x\n", cpu->registers[SP].value);
-   printf ("top of stack = %x\n\n", MMU_readWord (mmu, cpu->registers[SP].value));
+   printf ("AF = %x\n", cpu->af.value);
+   printf ("BC = %x\n", cpu->bc.value);
+   printf ("DE = %x\n", cpu->de.value);
+   printf ("HL = %x\n", cpu->hl.value);
+   printf ("SP = %x\n", cpu->sp.value);
+   printf ("top of stack = %x\n\n", MMU_readWord (mmu, cpu->sp.value));
    */
 
    /* Execute the instruction */
-   if (opcode == 0xCB) {
+   if (*opcode == 0xCB) {
       /* 0xCB prefixed instruction */
-      opcode = MMU_readByte (mmu, cpu->registers[PC].value + 1);
-      if (instructionMap[opcode] != NULL) 
-         numCycles = instructionMapCB[opcode] (cpu);
-   } else if (instructionMap[opcode] != NULL) {
-      numCycles = instructionMap[opcode] (cpu);
+#ifdef CPU_ACCURATE
+      opcodeCB = CPU_readByte (cpu, mmu, cpu->pc.value + 1);
+#else
+      opcodeCB = MMU_readByte (mmu, cpu->pc.value + 1);
+#endif
+      if (instructionMapCB[opcodeCB] != NULL)
+         numCycles = instructionMapCB[opcodeCB] (cpu);
+   } else if (instructionMap[*opcode] != NULL) {
+      numCycles = instructionMap[*opcode] (cpu);
    } else {
-      fprintf (stderr, "ERROR: Opcode %x is not implemented\n", opcode);
+      fprintf (stderr, "ERROR: Opcode %x is not implemented\n", *opcode);
    }
 
    return numCycles;
 }
 
+int CPU_run (CPU cpu, int budget) {
+   int cycles = 0;
+   int numCycles;
+   byte opcode;
+#ifdef CPU_IDIOMS
+   word pc;
+#endif
+
+   if (cpu->isIMEPending) {
+      /* EI takes effect after the next instruction, which has to hand
+         control back so that interrupts can be checked */
+      cpu->isIMEPending = FALSE;
+      cpu->IME = TRUE;
+      budget = 1;
+   }
+
+   /* Until an interrupt that can be taken comes up part way through */
+   cpu->isExitRequested = FALSE;
+
+   while (cycles < budget && !cpu->isExitRequested) {
+      cpu->runCycles = cycles;
+
+#ifdef CPU_JIT
+      numCycles = JIT_run (GB_getJIT (cpu->gb), cpu, cpu->registers,
+                           budget - cycles);
+      if (numCycles > 0) {
+         cycles += numCycles;
+         continue;
+      }
+#endif
+
+#ifdef CPU_IDIOMS
+      pc = cpu->pc.value;
+#endif
+      numCycles = CPU_interpret (cpu, &opcode);
+
+      if (numCycles == 0) {
+         /* Opcode not implemented */
+         break;
+      }
+
+      cycles += numCycles;
+
+      if (opcode == 0x10 || opcode == 0x76 || opcode == 0xD9 || opcode == 0xFB) {
+         /* STOP, HALT, RETI and EI hand control back to the GB */
+         break;
+      }
+
+#ifdef CPU_IDIOMS
+      if (opcode == 0x20 && cpu->pc.value < pc && !cpu->isExitRequested) {
+         /* JR NZ back, possibly to the start of a copy or fill loop */
+         cpu->runCycles = cycles;
+         cycles += CPU_runIdiom (cpu, GB_getMMU (cpu->gb), budget - cycles);
+      }
+#endif
+   }
+
+   cpu->runCycles = 0;
+#ifdef CPU_ACCURATE
+   cpu->accessCycles = 0;
+#endif
+
+   return cycles;
+}
+#endif
+
+int CPU_getRunCycles (CPU cpu) {
+#ifdef CPU_ACCURATE
+   return cpu->runCycles + cpu->accessCycles;
+#else
+   return cpu->runCycles;
+#endif
+}
+
+#ifdef CPU_ACCURATE
+byte CPU_readByte (CPU cpu, MMU mmu, int location) {
+   byte value = MMU_readByte (mmu, location);
+   cpu->accessCycles += 4;
+
+   return value;
+}
+
+void CPU_writeByte (CPU cpu, MMU mmu, int location, byte value) {
+   MMU_writeByte (mmu, location, value);
+   cpu->accessCycles += 4;
+}
+
+word CPU_readWord (CPU cpu, MMU mmu, int location) {
+   word value = CPU_readByte (cpu, mmu, location);
+
+   return value | (CPU_readByte (cpu, mmu, location + 1) << 8);
+}
+
+void CPU_writeWord (CPU cpu, MMU mmu, int location, word value) {
+   CPU_writeByte (cpu, mmu, location, value & 0xFF);
+   CPU_writeByte (cpu, mmu, location + 1, value >> 8);
+}
+#endif
+
 void CPU_setIME (CPU cpu, bool enabled) {
    cpu->IME = enabled;
+   cpu->isIMEPending = FALSE;
+}
+
+void CPU_requestExit (CPU cpu) {
+   cpu->isExitRequested = TRUE;
+#ifdef CPU_JIT
+   /* Translated code checks for it after each interpreter function */
+   JIT_requestExit (GB_getJIT (cpu->gb));
+#endif
 }
 
 bool CPU_getIME (CPU cpu) {
    return (cpu->IME);
 }
 
+bool CPU_isIMEPending (CPU cpu) {
+   return (cpu->isIMEPending);
+}
+
 int CPU_executeInterrupt (CPU cpu, interrupt type) {
    MMU mmu;
    int cycles = 0;
@@ -177,31 +400,31 @@ int CPU_executeInterrupt (CPU cpu, interrupt type) {
             (e.g. CPU_jmp) once they're implemented */
 
    /* Push the current program counter onto the stack */
-   cpu->registers[SP].value -= 2;   
-   MMU_writeWord (mmu, cpu->registers[SP].value, cpu->registers[PC].value);
+   cpu->sp.value -= 2;   
+   MMU_writeWord (mmu, cpu->sp.value, cpu->pc.value);
 
    IFRegister = MMU_readByte (mmu, 0xFF0F);
 
    /* Jump to starting address of interrupt */
    switch (type) {
       case INT_VBLANK:
-         cpu->registers[PC].value = 0x40;
+         cpu->pc.value = 0x40;
          clearBit (&IFRegister, 0);
          break;
       case INT_LCDSTAT:
-         cpu->registers[PC].value = 0x48;
+         cpu->pc.value = 0x48;
          clearBit (&IFRegister, 1);
          break;
       case INT_TIMER:
-         cpu->registers[PC].value = 0x50;
+         cpu->pc.value = 0x50;
          clearBit (&IFRegister, 2);
          break;
       case INT_SERIAL:
-         cpu->registers[PC].value = 0x58;
+         cpu->pc.value = 0x58;
          clearBit (&IFRegister, 3);
          break;
       case INT_JOYPAD:
-         cpu->registers[PC].value = 0x60;
+         cpu->pc.value = 0x60;
          clearBit (&IFRegister, 4);
          break;
    }
@@ -215,63 +438,195 @@ int CPU_executeInterrupt (CPU cpu, interrupt type) {
 }
 
 void CPU_setCarry (CPU cpu) {
-   (cpu->registers[AF].bytes.low) |= (1 << FLAG_CARRY_BIT);
+#ifdef CPU_LAZY_FLAGS
+   CPU_updateFlags (cpu);
+#endif
+   (cpu->af.bytes.low) |= (1 << FLAG_CARRY_BIT);
 }
 
 void CPU_setZero (CPU cpu) {
-   (cpu->registers[AF].bytes.low) |= (1 << FLAG_ZERO_BIT);
+#ifdef CPU_LAZY_FLAGS
+   CPU_updateFlags (cpu);
+#endif
+   (cpu->af.bytes.low) |= (1 << FLAG_ZERO_BIT);
 }
 
 void CPU_setHalfCarry (CPU cpu) {
-   (cpu->registers[AF].bytes.low) |= (1 << FLAG_HALFCARRY_BIT);
+#ifdef CPU_LAZY_FLAGS
+   CPU_updateFlags (cpu);
+#endif
+   (cpu->af.bytes.low) |= (1 << FLAG_HALFCARRY_BIT);
 }
 
 void CPU_setSub (CPU cpu) {
-   (cpu->registers[AF].bytes.low) |= (1 << FLAG_SUB_BIT);
+#ifdef CPU_LAZY_FLAGS
+   CPU_updateFlags (cpu);
+#endif
+   (cpu->af.bytes.low) |= (1 << FLAG_SUB_BIT);
 }
 
 void CPU_clearCarry (CPU cpu) {
-   if (((cpu->registers[AF].bytes.low) & (1<<FLAG_CARRY_BIT))) {
-      (cpu->registers[AF].bytes.low) ^= (1<<FLAG_CARRY_BIT);
+#ifdef CPU_LAZY_FLAGS
+   CPU_updateFlags (cpu);
+#endif
+   if (((cpu->af.bytes.low) & (1<<FLAG_CARRY_BIT))) {
+      (cpu->af.bytes.low) ^= (1<<FLAG_CARRY_BIT);
    }
 }
 
 void CPU_clearZero (CPU cpu) {
-   if (((cpu->registers[AF].bytes.low) & (1<<FLAG_ZERO_BIT))) {
-      (cpu->registers[AF].bytes.low) ^= (1<<FLAG_ZERO_BIT);
+#ifdef CPU_LAZY_FLAGS
+   CPU_updateFlags (cpu);
+#endif
+   if (((cpu->af.bytes.low) & (1<<FLAG_ZERO_BIT))) {
+      (cpu->af.bytes.low) ^= (1<<FLAG_ZERO_BIT);
    }
 }
 
 void CPU_clearHalfCarry (CPU cpu) {
-   if (((cpu->registers[AF].bytes.low) & (1<<FLAG_HALFCARRY_BIT))) {
-      (cpu->registers[AF].bytes.low) ^= (1<<FLAG_HALFCARRY_BIT);
+#ifdef CPU_LAZY_FLAGS
+   CPU_updateFlags (cpu);
+#endif
+   if (((cpu->af.bytes.low) & (1<<FLAG_HALFCARRY_BIT))) {
+      (cpu->af.bytes.low) ^= (1<<FLAG_HALFCARRY_BIT);
    }
 }
 
 void CPU_clearSub (CPU cpu) {
-   if (((cpu->registers[AF].bytes.low) & (1<<FLAG_SUB_BIT))) {
-      (cpu->registers[AF].bytes.low) ^= (1<<FLAG_SUB_BIT);
+#ifdef CPU_LAZY_FLAGS
+   CPU_updateFlags (cpu);
+#endif
+   if (((cpu->af.bytes.low) & (1<<FLAG_SUB_BIT))) {
+      (cpu->af.bytes.low) ^= (1<<FLAG_SUB_BIT);
    }
 }
 
 void CPU_clearFlags (CPU cpu) {
-   cpu->registers[AF].bytes.low = 0;
+#ifdef CPU_LAZY_FLAGS
+   cpu->flagOp = FLAGS_NONE;
+#endif
+   cpu->af.bytes.low = 0;
 }
 
 bool CPU_isCarrySet (CPU cpu) {
-   return (cpu->registers[AF].bytes.low & (1<<FLAG_CARRY_BIT));
+#ifdef CPU_LAZY_FLAGS
+   /* Conditional jumps and ADC/SBC only need the one flag, which can
+      be read straight off the pending operation */
+   switch (cpu->flagOp) {
+      case FLAGS_ADD:
+         return (cpu->flagResult > 0xFF) ? (1<<FLAG_CARRY_BIT) : 0;
+      case FLAGS_SUB:
+         return (cpu->flagResult < 0) ? (1<<FLAG_CARRY_BIT) : 0;
+      case FLAGS_AND:
+      case FLAGS_OR:
+         return 0;
+      case FLAGS_ADD16:
+         return (cpu->flagResult > 0xFFFF) ? (1<<FLAG_CARRY_BIT) : 0;
+      case FLAGS_INC:
+      case FLAGS_DEC:
+         /* The carry they left alone is kept above the operand */
+         return (cpu->flagOperand & 0x100) ? (1<<FLAG_CARRY_BIT) : 0;
+      default:
+         break;
+   }
+#endif
+   return (cpu->af.bytes.low & (1<<FLAG_CARRY_BIT));
 }
 
 bool CPU_isZeroSet (CPU cpu) {
-   return (cpu->registers[AF].bytes.low & (1<<FLAG_ZERO_BIT));
+#ifdef CPU_LAZY_FLAGS
+   switch (cpu->flagOp) {
+      case FLAGS_ADD:
+      case FLAGS_INC:
+         return ((cpu->flagResult & 0xFF) == 0) ? (1<<FLAG_ZERO_BIT) : 0;
+      case FLAGS_SUB:
+      case FLAGS_AND:
+      case FLAGS_OR:
+      case FLAGS_DEC:
+         return (cpu->flagResult == 0) ? (1<<FLAG_ZERO_BIT) : 0;
+      default:
+         /* 16 bit ADD leaves the zero flag alone */
+         break;
+   }
+#endif
+   return (cpu->af.bytes.low & (1<<FLAG_ZERO_BIT));
 }
 
 bool CPU_isHalfCarrySet (CPU cpu) {
-   return (cpu->registers[AF].bytes.low & (1<<FLAG_HALFCARRY_BIT));
+#ifdef CPU_LAZY_FLAGS
+   CPU_updateFlags (cpu);
+#endif
+   return (cpu->af.bytes.low & (1<<FLAG_HALFCARRY_BIT));
 }
 
 bool  CPU_isSubSet (CPU cpu) {
-   return (cpu->registers[AF].bytes.low & (1<<FLAG_SUB_BIT));
+#ifdef CPU_LAZY_FLAGS
+   CPU_updateFlags (cpu);
+#endif
+   return (cpu->af.bytes.low & (1<<FLAG_SUB_BIT));
+}
+
+void CPU_updateFlags (CPU cpu) {
+#ifdef CPU_LAZY_FLAGS
+   byte flags = cpu->af.bytes.low;
+   int operand = cpu->flagOperand;
+   int result = cpu->flagResult;
+
+   switch (cpu->flagOp) {
+      case FLAGS_NONE:
+         return;
+      case FLAGS_ADD:
+         /* ADD and ADC, result includes the carry in */
+         flags = 0;
+         if ((result & 0xFF) == 0) flags |= (1 << FLAG_ZERO_BIT);
+         if (result > 0xFF) flags |= (1 << FLAG_CARRY_BIT);
+         if ((result & 0xF) < (operand & 0xF)) flags |= (1 << FLAG_HALFCARRY_BIT);
+         break;
+      case FLAGS_SUB:
+         /* SUB, SBC and CP */
+         flags = (1 << FLAG_SUB_BIT);
+         if (result == 0) flags |= (1 << FLAG_ZERO_BIT);
+         if (result < 0) flags |= (1 << FLAG_CARRY_BIT);
+         if ((result & 0xF) > (operand & 0xF)) flags |= (1 << FLAG_HALFCARRY_BIT);
+         break;
+      case FLAGS_AND:
+         flags = (1 << FLAG_HALFCARRY_BIT);
+         if (result == 0) flags |= (1 << FLAG_ZERO_BIT);
+         break;
+      case FLAGS_OR:
+         /* OR and XOR */
+         flags = 0;
+         if (result == 0) flags |= (1 << FLAG_ZERO_BIT);
+         break;
+      case FLAGS_INC:
+         /* Carry is the one from before, kept in bit 8 of the operand */
+         flags &= ~((1 << FLAG_ZERO_BIT) | (1 << FLAG_SUB_BIT) |
+                    (1 << FLAG_HALFCARRY_BIT) | (1 << FLAG_CARRY_BIT));
+         if (operand & 0x100) flags |= (1 << FLAG_CARRY_BIT);
+         if ((result & 0xFF) == 0) flags |= (1 << FLAG_ZERO_BIT);
+         if ((result & 0xF) < (operand & 0xF)) flags |= (1 << FLAG_HALFCARRY_BIT);
+         break;
+      case FLAGS_DEC:
+         /* Carry is the one from before, kept in bit 8 of the operand */
+         flags &= ~((1 << FLAG_ZERO_BIT) | (1 << FLAG_HALFCARRY_BIT) |
+                    (1 << FLAG_CARRY_BIT));
+         flags |= (1 << FLAG_SUB_BIT);
+         if (operand & 0x100) flags |= (1 << FLAG_CARRY_BIT);
+         if (result == 0) flags |= (1 << FLAG_ZERO_BIT);
+         if ((result & 0xF) > (operand & 0xF)) flags |= (1 << FLAG_HALFCARRY_BIT);
+         break;
+      case FLAGS_ADD16:
+         /* Zero is left alone */
+         flags &= ~((1 << FLAG_SUB_BIT) | (1 << FLAG_HALFCARRY_BIT) |
+                    (1 << FLAG_CARRY_BIT));
+         if (result > 0xFFFF) flags |= (1 << FLAG_CARRY_BIT);
+         if ((result & 0xF00) < (operand & 0xF00)) flags |= (1 << FLAG_HALFCARRY_BIT);
+         break;
+   }
+
+   cpu->af.bytes.low = flags;
+   cpu->flagOp = FLAGS_NONE;
+#endif
 }
 
 void CPU_initInstructionMap () {
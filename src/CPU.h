@@ -52,6 +52,21 @@ typedef enum interrupt {
    INT_JOYPAD 
 } interrupt; 
 
+/* ALU operations whose flags can be left to be worked out later */
+typedef enum flagOperation {
+   FLAGS_NONE,
+   FLAGS_ADD,
+   FLAGS_SUB,
+   FLAGS_AND,
+   FLAGS_OR,
+   FLAGS_INC,
+   FLAGS_DEC,
+   FLAGS_ADD16
+} flagOperation;
+
+/* Function that executes an instruction, returns the number of cycles used */
+typedef int (*CPU_instruction)(CPU cpu);
+
 /* Constructor and Destructor */
 CPU CPU_init (GB gb);
 void CPU_free (CPU cpu);
@@ -59,6 +74,29 @@ void CPU_free (CPU cpu);
 /* Runs the next instruction, returns the number of cycles used */
 int CPU_step (CPU cpu);
 
+/* Runs instructions until at least budget cycles have been used, or
+   until an instruction needs the GB to take over (HALT, STOP, EI, RETI).
+   Returns the number of cycles used */
+int CPU_run (CPU cpu, int budget);
+
+/* Makes the CPU_run in progress return after the instruction it is
+   on, so that an interrupt can be taken straight away */
+void CPU_requestExit (CPU cpu);
+
+/* Gets the number of cycles the CPU_run in progress has used before
+   the instruction it is running, so that anything the instruction
+   does to memory can tell the time. 0 if CPU_run isn't running.
+   Built with ACCURATE=1 it also counts an M-cycle for each memory
+   access the instruction has made so far */
+int CPU_getRunCycles (CPU cpu);
+
+/* Gets the function that executes an opcode, NULL if it is not
+   implemented */
+CPU_instruction CPU_getInstruction (byte opcode, bool prefixCB);
+
+/* Gets the length in bytes of the instruction starting with opcode */
+int CPU_getInstructionLength (byte opcode);
+
 /* Gets and sets CPU register values */ 
 word CPU_get16bitRegisterValue (CPU cpu, register16 r);
 void CPU_set16bitRegisterValue (CPU cpu, register16 r, word value);
@@ -71,6 +109,10 @@ void CPU_setIME (CPU cpu, bool enabled);
 /* Gets the IME flag */
 bool CPU_getIME (CPU cpu);
 
+/* Whether EI has run and the IME is set once the next instruction
+   starts */
+bool CPU_isIMEPending (CPU cpu);
+
 /* Executes the interrupt, returning the number of cycles it took 
    to start the interrupt */
 int CPU_executeInterrupt (CPU cpu, interrupt type);
@@ -92,4 +134,8 @@ bool CPU_isZeroSet (CPU cpu);
 bool CPU_isHalfCarrySet (CPU cpu);
 bool CPU_isSubSet (CPU cpu);
 
+/* Works out the flags left by the last ALU operation if they haven't
+   been yet (only with CPU_LAZY_FLAGS, otherwise does nothing) */
+void CPU_updateFlags (CPU cpu);
+
 #endif
@@ -0,0 +1,668 @@
+#include <stdio.h>
+
+#include "GB.h"
+#include "MMU.h"
+#include "CPU.h"
+#include "CPU_state.h"
+#include "ALUTables.h"
+
+/*
+Switch/computed goto interpreter core
+
+Replaces the instructionMap/instructionMapCB function pointer tables
+when built with CORE=switch. The whole instruction set lives in one
+function so the registers can be kept in locals for the duration of a
+call, and CPU_run executes instructions until the cycle budget it was
+given has been used up.
+
+Under GCC and Clang every opcode ends with its own indirect jump to the
+next handler (computed goto), other compilers get a plain switch.
+*/
+
+#if defined(__GNUC__) && !defined(CPU_NO_COMPUTED_GOTO)
+#define CPU_COMPUTED_GOTO
+
+/* Labels as values are a GNU extension */
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+/* Registers, these are locals inside CPU_run */
+#define REG_PC (pc)
+#define REG_SP (sp)
+#define REG_AF (af.value)
+#define REG_BC (bc.value)
+#define REG_DE (de.value)
+#define REG_HL (hl.value)
+#define REG_A  (af.bytes.high)
+#define REG_F  (af.bytes.low)
+#define REG_B  (bc.bytes.high)
+#define REG_C  (bc.bytes.low)
+#define REG_D  (de.bytes.high)
+#define REG_E  (de.bytes.low)
+#define REG_H  (hl.bytes.high)
+#define REG_L  (hl.bytes.low)
+
+#define FLAG_Z (1 << FLAG_ZERO_BIT)
+#define FLAG_N (1 << FLAG_SUB_BIT)
+#define FLAG_H (1 << FLAG_HALFCARRY_BIT)
+#define FLAG_C (1 << FLAG_CARRY_BIT)
+
+#define COND_NZ (!(REG_F & FLAG_Z))
+#define COND_Z  (REG_F & FLAG_Z)
+#define COND_NC (!(REG_F & FLAG_C))
+#define COND_C  (REG_F & FLAG_C)
+
+/* Memory access */
+#define READ8(address)          MMU_readByte (mmu, (word)(address))
+#define READ16(address)         MMU_readWord (mmu, (word)(address))
+#define WRITE8(address, value)  MMU_writeByte (mmu, (word)(address), (value))
+#define WRITE16(address, value) MMU_writeWord (mmu, (word)(address), (value))
+
+#define IMM8  READ8 (REG_PC + 1)
+#define IMM16 READ16 (REG_PC + 1)
+
+/* Finishes an instruction of the given length and cycle count */
+#define DONE(length, numCycles) \
+   REG_PC += (length);          \
+   cycles += (numCycles);       \
+   NEXT
+
+/* Stops running after the current instruction, used when the
+   GB needs to look at the CPU before it continues (HALT, EI, ...) */
+#define DONE_AND_EXIT(length, numCycles) \
+   REG_PC += (length);                   \
+   cycles += (numCycles);                \
+   goto exit
+
+#ifdef CPU_COMPUTED_GOTO
+#define OPCODE(n) op_##n:
+#define NEXT                                \
+   if (cycles >= budget) goto exit;         \
+   if (cpu->isExitRequested) goto exit;     \
+   cpu->runCycles = cycles;                 \
+   opcode = READ8 (REG_PC);                 \
+   goto *dispatchTable[opcode]
+#else
+#define OPCODE(n) case 0x##n:
+#define NEXT break
+#endif
+
+/*
+ALU operations, the flag results match the helpers in
+CPU_instructions.c so both cores behave identically
+*/
+
+#define ALU_ADD(value) do {                               \
+   int operand_ = (value);                                \
+   int result_ = REG_A + operand_;                        \
+   REG_F = 0;                                             \
+   if ((result_ & 0xFF) == 0) REG_F |= FLAG_Z;            \
+   if (result_ > 0xFF) REG_F |= FLAG_C;                   \
+   if ((result_ & 0xF) < (REG_A & 0xF)) REG_F |= FLAG_H;  \
+   REG_A = result_;                                       \
+} while (0)
+
+#define ALU_ADC(value) do {                               \
+   int operand_ = (value);                                \
+   int carry_ = (REG_F & FLAG_C) ? 1 : 0;                 \
+   int result_ = REG_A + operand_ + carry_;               \
+   REG_F = 0;                                             \
+   if ((result_ & 0xFF) == 0) REG_F |= FLAG_Z;            \
+   if (result_ > 0xFF) REG_F |= FLAG_C;                   \
+   if ((result_ & 0xF) < (REG_A & 0xF)) REG_F |= FLAG_H;  \
+   REG_A = result_;                                       \
+} while (0)
+
+#define ALU_SUB(value) do {                               \
+   int operand_ = (value);                                \
+   int result_ = REG_A - operand_;                        \
+   REG_F = FLAG_N;                                        \
+   if (result_ == 0) REG_F |= FLAG_Z;                     \
+   if (result_ < 0) REG_F |= FLAG_C;                      \
+   if ((result_ & 0xF) > (REG_A & 0xF)) REG_F |= FLAG_H;  \
+   REG_A = result_;                                       \
+} while (0)
+
+#define ALU_SBC(value) do {                               \
+   int operand_ = (value);                                \
+   int carry_ = (REG_F & FLAG_C) ? 1 : 0;                 \
+   int result_ = REG_A - operand_ - carry_;               \
+   REG_F = FLAG_N;                                        \
+   if (result_ == 0) REG_F |= FLAG_Z;                     \
+   if (result_ < 0) REG_F |= FLAG_C;                      \
+   if ((result_ & 0xF) > (REG_A & 0xF)) REG_F |= FLAG_H;  \
+   REG_A = result_;                                       \
+} while (0)
+
+#define ALU_AND(value) do {                               \
+   REG_A &= (value);                                      \
+   REG_F = FLAG_H;                                        \
+   if (REG_A == 0) REG_F |= FLAG_Z;                       \
+} while (0)
+
+#define ALU_XOR(value) do {                               \
+   REG_A ^= (value);                                      \
+   REG_F = 0;                                             \
+   if (REG_A == 0) REG_F |= FLAG_Z;                       \
+} while (0)
+
+#define ALU_OR(value) do {                                \
+   REG_A |= (value);                                      \
+   REG_F = 0;                                             \
+   if (REG_A == 0) REG_F |= FLAG_Z;                       \
+} while (0)
+
+#define ALU_CP(value) do {                                \
+   int operand_ = (value);                                \
+   int result_ = REG_A - operand_;                        \
+   REG_F = FLAG_N;                                        \
+   if (result_ == 0) REG_F |= FLAG_Z;                     \
+   if (result_ < 0) REG_F |= FLAG_C;                      \
+   if ((result_ & 0xF) > (REG_A & 0xF)) REG_F |= FLAG_H;  \
+} while (0)
+
+#define ALU_INC(target) do {                              \
+   int old_ = (target);                                   \
+   int result_ = old_ + 1;                                \
+   REG_F &= ~(FLAG_Z | FLAG_N | FLAG_H);                  \
+   if ((result_ & 0xFF) == 0) REG_F |= FLAG_Z;            \
+   if ((result_ & 0xF) < (old_ & 0xF)) REG_F |= FLAG_H;   \
+   (target) = result_;                                    \
+} while (0)
+
+#define ALU_DEC(target) do {                              \
+   int old_ = (target);                                   \
+   int result_ = old_ - 1;                                \
+   REG_F &= ~(FLAG_Z | FLAG_N | FLAG_H);                  \
+   REG_F |= FLAG_N;                                       \
+   if (result_ == 0) REG_F |= FLAG_Z;                     \
+   if ((result_ & 0xF) > (old_ & 0xF)) REG_F |= FLAG_H;   \
+   (target) = result_;                                    \
+} while (0)
+
+#define ALU_ADD16(value) do {                                      \
+   int operand_ = (value);                                         \
+   int result_ = REG_HL + operand_;                                \
+   REG_F &= ~(FLAG_N | FLAG_C | FLAG_H);                           \
+   if (result_ > 0xFFFF) REG_F |= FLAG_C;                          \
+   if (((result_ & 0xF00) >> 8) < ((REG_HL & 0xF00) >> 8))         \
+      REG_F |= FLAG_H;                                             \
+   REG_HL = result_;                                               \
+} while (0)
+
+/* SP plus a signed immediate, shared by LDHL SP,n and ADD SP,n */
+#define ALU_SP_OFFSET(target) do {                                 \
+   signed_byte offset_ = (signed_byte)IMM8;                        \
+   int result_ = REG_SP + offset_;                                 \
+   REG_F = 0;                                                      \
+   if (result_ < 0 || result_ > 0xFFFF) REG_F |= FLAG_C;           \
+   if (offset_ >= 0) {                                             \
+      if (((result_ & 0xF00) >> 8) < ((REG_SP & 0xF00) >> 8))      \
+         REG_F |= FLAG_H;                                          \
+   } else {                                                        \
+      if (((result_ & 0xF00) >> 8) > ((REG_SP & 0xF00) >> 8))      \
+         REG_F |= FLAG_H;                                          \
+   }                                                               \
+   (target) = result_;                                             \
+} while (0)
+
+/* Shifts and rotates, shared by the 0xCB page and RLCA/RLA/RRCA/RRA */
+#define CB_RLC(target) do {                               \
+   REG_F = 0;                                             \
+   if ((target) & 0x80) REG_F |= FLAG_C;                  \
+   (target) <<= 1;                                        \
+   if (REG_F & FLAG_C) (target) |= 0x01;                  \
+   if ((target) == 0) REG_F |= FLAG_Z;                    \
+} while (0)
+
+#define CB_RL(target) do {                                \
+   byte carry_ = REG_F & FLAG_C;                          \
+   REG_F = 0;                                             \
+   if ((target) & 0x80) REG_F |= FLAG_C;                  \
+   (target) <<= 1;                                        \
+   if (carry_) (target) |= 0x01;                          \
+   if ((target) == 0) REG_F |= FLAG_Z;                    \
+} while (0)
+
+#define CB_RRC(target) do {                               \
+   REG_F = 0;                                             \
+   if ((target) & 0x01) REG_F |= FLAG_C;                  \
+   (target) >>= 1;                                        \
+   if (REG_F & FLAG_C) (target) |= 0x80;                  \
+   if ((target) == 0) REG_F |= FLAG_Z;                    \
+} while (0)
+
+#define CB_RR(target) do {                                \
+   byte carry_ = REG_F & FLAG_C;                          \
+   REG_F = 0;                                             \
+   if ((target) & 0x01) REG_F |= FLAG_C;                  \
+   (target) >>= 1;                                        \
+   if (carry_) (target) |= 0x80;                          \
+   if ((target) == 0) REG_F |= FLAG_Z;                    \
+} while (0)
+
+#define CB_SLA(target) do {                               \
+   REG_F = 0;                                             \
+   if ((target) & 0x80) REG_F |= FLAG_C;                  \
+   (target) <<= 1;                                        \
+   if ((target) == 0) REG_F |= FLAG_Z;                    \
+} while (0)
+
+#define CB_SRA(target) do {                               \
+   byte msb_ = (target) & 0x80;                           \
+   REG_F = 0;                                             \
+   if ((target) & 0x01) REG_F |= FLAG_C;                  \
+   (target) = ((target) >> 1) | msb_;                     \
+   if ((target) == 0) REG_F |= FLAG_Z;                    \
+} while (0)
+
+#define CB_SRL(target) do {                               \
+   REG_F = 0;                                             \
+   if ((target) & 0x01) REG_F |= FLAG_C;                  \
+   (target) >>= 1;                                        \
+   if ((target) == 0) REG_F |= FLAG_Z;                    \
+} while (0)
+
+#define CB_SWAP(target) do {                              \
+   (target) = ((target) << 4) | ((target) >> 4);         \
+   REG_F = 0;                                             \
+   if ((target) == 0) REG_F |= FLAG_Z;                    \
+} while (0)
+
+/* Stack operations */
+#define PUSH(value) do {                                  \
+   REG_SP -= 2;                                           \
+   WRITE16 (REG_SP, (value));                             \
+} while (0)
+
+#define POP(target) do {                                  \
+   (target) = READ16 (REG_SP);                            \
+   REG_SP += 2;                                           \
+} while (0)
+
+/* Loads between registers */
+#define LD_R_R(n, dest, src) OPCODE(n) (dest) = (src); DONE (1, 4);
+#define LD_R_HL(n, dest)     OPCODE(n) (dest) = READ8 (REG_HL); DONE (1, 8);
+#define LD_HL_R(n, src)      OPCODE(n) WRITE8 (REG_HL, (src)); DONE (1, 8);
+
+/* 8 bit arithmetic on A with a register or (HL) operand */
+#define ALU_R(n, op, src)    OPCODE(n) op (src); DONE (1, 4);
+#define ALU_HL(n, op)        OPCODE(n) op (READ8 (REG_HL)); DONE (1, 8);
+
+/* RST n */
+#define RST(n, address)      OPCODE(n) PUSH (REG_PC + 1); \
+                             REG_PC = (address); cycles += 32; NEXT;
+
+int CPU_run (CPU cpu, int budget) {
+   MMU mmu;
+   byte opcode;
+   int cycles = 0;
+   word pc, sp;
+   reg af, bc, de, hl;
+
+#ifdef CPU_COMPUTED_GOTO
+   static void *const dispatchTable[0x100] = {
+      &&op_00, &&op_01, &&op_02, &&op_03, &&op_04, &&op_05, &&op_06, &&op_07,
+      &&op_08, &&op_09, &&op_0A, &&op_0B, &&op_0C, &&op_0D, &&op_0E, &&op_0F,
+      &&op_10, &&op_11, &&op_12, &&op_13, &&op_14, &&op_15, &&op_16, &&op_17,
+      &&op_18, &&op_19, &&op_1A, &&op_1B, &&op_1C, &&op_1D, &&op_1E, &&op_1F,
+      &&op_20, &&op_21, &&op_22, &&op_23, &&op_24, &&op_25, &&op_26, &&op_27,
+      &&op_28, &&op_29, &&op_2A, &&op_2B, &&op_2C, &&op_2D, &&op_2E, &&op_2F,
+      &&op_30, &&op_31, &&op_32, &&op_33, &&op_34, &&op_35, &&op_36, &&op_37,
+      &&op_38, &&op_39, &&op_3A, &&op_3B, &&op_3C, &&op_3D, &&op_3E, &&op_3F,
+      &&op_40, &&op_41, &&op_42, &&op_43, &&op_44, &&op_45, &&op_46, &&op_47,
+      &&op_48, &&op_49, &&op_4A, &&op_4B, &&op_4C, &&op_4D, &&op_4E, &&op_4F,
+      &&op_50, &&op_51, &&op_52, &&op_53, &&op_54, &&op_55, &&op_56, &&op_57,
+      &&op_58, &&op_59, &&op_5A, &&op_5B, &&op_5C, &&op_5D, &&op_5E, &&op_5F,
+      &&op_60, &&op_61, &&op_62, &&op_63, &&op_64, &&op_65, &&op_66, &&op_67,
+      &&op_68, &&op_69, &&op_6A, &&op_6B, &&op_6C, &&op_6D, &&op_6E, &&op_6F,
+      &&op_70, &&op_71, &&op_72, &&op_73, &&op_74, &&op_75, &&op_76, &&op_77,
+      &&op_78, &&op_79, &&op_7A, &&op_7B, &&op_7C, &&op_7D, &&op_7E, &&op_7F,
+      &&op_80, &&op_81, &&op_82, &&op_83, &&op_84, &&op_85, &&op_86, &&op_87,
+      &&op_88, &&op_89, &&op_8A, &&op_8B, &&op_8C, &&op_8D, &&op_8E, &&op_8F,
+      &&op_90, &&op_91, &&op_92, &&op_93, &&op_94, &&op_95, &&op_96, &&op_97,
+      &&op_98, &&op_99, &&op_9A, &&op_9B, &&op_9C, &&op_9D, &&op_9E, &&op_9F,
+      &&op_A0, &&op_A1, &&op_A2, &&op_A3, &&op_A4, &&op_A5, &&op_A6, &&op_A7,
+      &&op_A8, &&op_A9, &&op_AA, &&op_AB, &&op_AC, &&op_AD, &&op_AE, &&op_AF,
+      &&op_B0, &&op_B1, &&op_B2, &&op_B3, &&op_B4, &&op_B5, &&op_B6, &&op_B7,
+      &&op_B8, &&op_B9, &&op_BA, &&op_BB, &&op_BC, &&op_BD, &&op_BE, &&op_BF,
+      &&op_C0, &&op_C1, &&op_C2, &&op_C3, &&op_C4, &&op_C5, &&op_C6, &&op_C7,
+      &&op_C8, &&op_C9, &&op_CA, &&op_CB, &&op_CC, &&op_CD, &&op_CE, &&op_CF,
+      &&op_D0, &&op_D1, &&op_D2, &&undefined, &&op_D4, &&op_D5, &&op_D6, &&op_D7,
+      &&op_D8, &&op_D9, &&op_DA, &&undefined, &&op_DC, &&undefined, &&op_DE, &&op_DF,
+      &&op_E0, &&op_E1, &&op_E2, &&undefined, &&undefined, &&op_E5, &&op_E6, &&op_E7,
+      &&op_E8, &&op_E9, &&op_EA, &&undefined, &&undefined, &&undefined, &&op_EE, &&op_EF,
+      &&op_F0, &&op_F1, &&op_F2, &&op_F3, &&undefined, &&op_F5, &&op_F6, &&op_F7,
+      &&op_F8, &&op_F9, &&op_FA, &&op_FB, &&undefined, &&undefined, &&op_FE, &&op_FF
+   };
+#endif
+
+   if (budget <= 0) return 0;
+
+   if (cpu->isIMEPending) {
+      /* EI takes effect after the next instruction, which has to hand
+         control back so that interrupts can be checked */
+      cpu->isIMEPending = FALSE;
+      cpu->IME = TRUE;
+      budget = 1;
+   }
+
+   /* Until an interrupt that can be taken comes up part way through */
+   cpu->isExitRequested = FALSE;
+
+   mmu = GB_getMMU (cpu->gb);
+
+   /* Load the register file into locals */
+   pc = cpu->pc.value;
+   sp = cpu->sp.value;
+   af = cpu->af;
+   bc = cpu->bc;
+   de = cpu->de;
+   hl = cpu->hl;
+
+   for (;;) {
+      cpu->runCycles = cycles;
+      opcode = READ8 (REG_PC);
+
+#ifdef CPU_COMPUTED_GOTO
+      goto *dispatchTable[opcode];
+#else
+      switch (opcode) {
+#endif
+
+      /* Misc/control */
+      OPCODE(00) DONE (1, 4);
+      OPCODE(10)
+         fprintf (stderr, "Warning: STOP instruction not implemented\n");
+         DONE_AND_EXIT (1, 4);
+      OPCODE(76) GB_halt (cpu->gb); DONE_AND_EXIT (1, 4);
+      OPCODE(F3) cpu->IME = FALSE; DONE (1, 4);
+      OPCODE(FB) cpu->isIMEPending = TRUE; DONE_AND_EXIT (1, 4);
+      OPCODE(27)
+         REG_AF = aluDAA[(REG_F >> FLAG_CARRY_BIT) & 0x7][REG_A];
+         DONE (1, 4);
+      OPCODE(2F) REG_F |= FLAG_N | FLAG_H; REG_A = ~REG_A; DONE (1, 4);
+      OPCODE(3F) REG_F &= ~(FLAG_N | FLAG_H); REG_F ^= FLAG_C; DONE (1, 4);
+      OPCODE(37) REG_F &= ~(FLAG_N | FLAG_H); REG_F |= FLAG_C; DONE (1, 4);
+
+      /* 8 bit loads */
+      OPCODE(06) REG_B = IMM8; DONE (2, 8);
+      OPCODE(0E) REG_C = IMM8; DONE (2, 8);
+      OPCODE(16) REG_D = IMM8; DONE (2, 8);
+      OPCODE(1E) REG_E = IMM8; DONE (2, 8);
+      OPCODE(26) REG_H = IMM8; DONE (2, 8);
+      OPCODE(2E) REG_L = IMM8; DONE (2, 8);
+      OPCODE(3E) REG_A = IMM8; DONE (2, 8);
+      OPCODE(36) WRITE8 (REG_HL, IMM8); DONE (2, 12);
+
+      LD_R_R(40, REG_B, REG_B) LD_R_R(41, REG_B, REG_C) LD_R_R(42, REG_B, REG_D)
+      LD_R_R(43, REG_B, REG_E) LD_R_R(44, REG_B, REG_H) LD_R_R(45, REG_B, REG_L)
+      LD_R_HL(46, REG_B)       LD_R_R(47, REG_B, REG_A)
+      LD_R_R(48, REG_C, REG_B) LD_R_R(49, REG_C, REG_C) LD_R_R(4A, REG_C, REG_D)
+      LD_R_R(4B, REG_C, REG_E) LD_R_R(4C, REG_C, REG_H) LD_R_R(4D, REG_C, REG_L)
+      LD_R_HL(4E, REG_C)       LD_R_R(4F, REG_C, REG_A)
+      LD_R_R(50, REG_D, REG_B) LD_R_R(51, REG_D, REG_C) LD_R_R(52, REG_D, REG_D)
+      LD_R_R(53, REG_D, REG_E) LD_R_R(54, REG_D, REG_H) LD_R_R(55, REG_D, REG_L)
+      LD_R_HL(56, REG_D)       LD_R_R(57, REG_D, REG_A)
+      LD_R_R(58, REG_E, REG_B) LD_R_R(59, REG_E, REG_C) LD_R_R(5A, REG_E, REG_D)
+      LD_R_R(5B, REG_E, REG_E) LD_R_R(5C, REG_E, REG_H) LD_R_R(5D, REG_E, REG_L)
+      LD_R_HL(5E, REG_E)       LD_R_R(5F, REG_E, REG_A)
+      LD_R_R(60, REG_H, REG_B) LD_R_R(61, REG_H, REG_C) LD_R_R(62, REG_H, REG_D)
+      LD_R_R(63, REG_H, REG_E) LD_R_R(64, REG_H, REG_H) LD_R_R(65, REG_H, REG_L)
+      LD_R_HL(66, REG_H)       LD_R_R(67, REG_H, REG_A)
+      LD_R_R(68, REG_L, REG_B) LD_R_R(69, REG_L, REG_C) LD_R_R(6A, REG_L, REG_D)
+      LD_R_R(6B, REG_L, REG_E) LD_R_R(6C, REG_L, REG_H) LD_R_R(6D, REG_L, REG_L)
+      LD_R_HL(6E, REG_L)       LD_R_R(6F, REG_L, REG_A)
+      LD_HL_R(70, REG_B)       LD_HL_R(71, REG_C)       LD_HL_R(72, REG_D)
+      LD_HL_R(73, REG_E)       LD_HL_R(74, REG_H)       LD_HL_R(75, REG_L)
+      LD_HL_R(77, REG_A)
+      LD_R_R(78, REG_A, REG_B) LD_R_R(79, REG_A, REG_C) LD_R_R(7A, REG_A, REG_D)
+      LD_R_R(7B, REG_A, REG_E) LD_R_R(7C, REG_A, REG_H) LD_R_R(7D, REG_A, REG_L)
+      LD_R_HL(7E, REG_A)       LD_R_R(7F, REG_A, REG_A)
+
+      OPCODE(0A) REG_A = READ8 (REG_BC); DONE (1, 8);
+      OPCODE(1A) REG_A = READ8 (REG_DE); DONE (1, 8);
+      OPCODE(FA) REG_A = READ8 (IMM16); DONE (3, 16);
+      OPCODE(02) WRITE8 (REG_BC, REG_A); DONE (1, 8);
+      OPCODE(12) WRITE8 (REG_DE, REG_A); DONE (1, 8);
+      OPCODE(EA) WRITE8 (IMM16, REG_A); DONE (3, 16);
+      OPCODE(F2) REG_A = READ8 (0xFF00 + REG_C); DONE (1, 8);
+      OPCODE(E2) WRITE8 (0xFF00 + REG_C, REG_A); DONE (1, 8);
+      OPCODE(3A) REG_A = READ8 (REG_HL); REG_HL--; DONE (1, 8);
+      OPCODE(32) WRITE8 (REG_HL, REG_A); REG_HL--; DONE (1, 8);
+      OPCODE(2A) REG_A = READ8 (REG_HL); REG_HL++; DONE (1, 8);
+      OPCODE(22) WRITE8 (REG_HL, REG_A); REG_HL++; DONE (1, 8);
+      OPCODE(E0) WRITE8 (0xFF00 + IMM8, REG_A); DONE (2, 12);
+      OPCODE(F0) REG_A = READ8 (0xFF00 + IMM8); DONE (2, 12);
+
+      /* 16 bit loads */
+      OPCODE(01) REG_BC = IMM16; DONE (3, 12);
+      OPCODE(11) REG_DE = IMM16; DONE (3, 12);
+      OPCODE(21) REG_HL = IMM16; DONE (3, 12);
+      OPCODE(31) REG_SP = IMM16; DONE (3, 12);
+      OPCODE(F9) REG_SP = REG_HL; DONE (1, 8);
+      OPCODE(F8) ALU_SP_OFFSET (REG_HL); DONE (2, 12);
+      OPCODE(08) WRITE16 (IMM16, REG_SP); DONE (3, 20);
+
+      OPCODE(F5) PUSH (REG_AF); DONE (1, 16);
+      OPCODE(C5) PUSH (REG_BC); DONE (1, 16);
+      OPCODE(D5) PUSH (REG_DE); DONE (1, 16);
+      OPCODE(E5) PUSH (REG_HL); DONE (1, 16);
+      OPCODE(F1) POP (REG_AF); DONE (1, 12);
+      OPCODE(C1) POP (REG_BC); DONE (1, 12);
+      OPCODE(D1) POP (REG_DE); DONE (1, 12);
+      OPCODE(E1) POP (REG_HL); DONE (1, 12);
+
+      /* 8 bit ALU */
+      ALU_R(80, ALU_ADD, REG_B) ALU_R(81, ALU_ADD, REG_C) ALU_R(82, ALU_ADD, REG_D)
+      ALU_R(83, ALU_ADD, REG_E) ALU_R(84, ALU_ADD, REG_H) ALU_R(85, ALU_ADD, REG_L)
+      ALU_HL(86, ALU_ADD)       ALU_R(87, ALU_ADD, REG_A)
+      ALU_R(88, ALU_ADC, REG_B) ALU_R(89, ALU_ADC, REG_C) ALU_R(8A, ALU_ADC, REG_D)
+      ALU_R(8B, ALU_ADC, REG_E) ALU_R(8C, ALU_ADC, REG_H) ALU_R(8D, ALU_ADC, REG_L)
+      ALU_HL(8E, ALU_ADC)       ALU_R(8F, ALU_ADC, REG_A)
+      ALU_R(90, ALU_SUB, REG_B) ALU_R(91, ALU_SUB, REG_C) ALU_R(92, ALU_SUB, REG_D)
+      ALU_R(93, ALU_SUB, REG_E) ALU_R(94, ALU_SUB, REG_H) ALU_R(95, ALU_SUB, REG_L)
+      ALU_HL(96, ALU_SUB)       ALU_R(97, ALU_SUB, REG_A)
+      ALU_R(98, ALU_SBC, REG_B) ALU_R(99, ALU_SBC, REG_C) ALU_R(9A, ALU_SBC, REG_D)
+      ALU_R(9B, ALU_SBC, REG_E) ALU_R(9C, ALU_SBC, REG_H) ALU_R(9D, ALU_SBC, REG_L)
+      ALU_HL(9E, ALU_SBC)       ALU_R(9F, ALU_SBC, REG_A)
+      ALU_R(A0, ALU_AND, REG_B) ALU_R(A1, ALU_AND, REG_C) ALU_R(A2, ALU_AND, REG_D)
+      ALU_R(A3, ALU_AND, REG_E) ALU_R(A4, ALU_AND, REG_H) ALU_R(A5, ALU_AND, REG_L)
+      ALU_HL(A6, ALU_AND)       ALU_R(A7, ALU_AND, REG_A)
+      ALU_R(A8, ALU_XOR, REG_B) ALU_R(A9, ALU_XOR, REG_C) ALU_R(AA, ALU_XOR, REG_D)
+      ALU_R(AB, ALU_XOR, REG_E) ALU_R(AC, ALU_XOR, REG_H) ALU_R(AD, ALU_XOR, REG_L)
+      ALU_HL(AE, ALU_XOR)       ALU_R(AF, ALU_XOR, REG_A)
+      ALU_R(B0, ALU_OR, REG_B)  ALU_R(B1, ALU_OR, REG_C)  ALU_R(B2, ALU_OR, REG_D)
+      ALU_R(B3, ALU_OR, REG_E)  ALU_R(B4, ALU_OR, REG_H)  ALU_R(B5, ALU_OR, REG_L)
+      ALU_HL(B6, ALU_OR)        ALU_R(B7, ALU_OR, REG_A)
+      ALU_R(B8, ALU_CP, REG_B)  ALU_R(B9, ALU_CP, REG_C)  ALU_R(BA, ALU_CP, REG_D)
+      ALU_R(BB, ALU_CP, REG_E)  ALU_R(BC, ALU_CP, REG_H)  ALU_R(BD, ALU_CP, REG_L)
+      ALU_HL(BE, ALU_CP)        ALU_R(BF, ALU_CP, REG_A)
+
+      OPCODE(C6) ALU_ADD (IMM8); DONE (2, 8);
+      OPCODE(CE) ALU_ADC (IMM8); DONE (2, 8);
+      OPCODE(D6) ALU_SUB (IMM8); DONE (2, 8);
+      OPCODE(DE) ALU_SBC (IMM8); DONE (2, 8);
+      OPCODE(E6) ALU_AND (IMM8); DONE (2, 8);
+      OPCODE(EE) ALU_XOR (IMM8); DONE (2, 8);
+      OPCODE(F6) ALU_OR (IMM8); DONE (2, 8);
+      OPCODE(FE) ALU_CP (IMM8); DONE (2, 8);
+
+      OPCODE(04) ALU_INC (REG_B); DONE (1, 4);
+      OPCODE(0C) ALU_INC (REG_C); DONE (1, 4);
+      OPCODE(14) ALU_INC (REG_D); DONE (1, 4);
+      OPCODE(1C) ALU_INC (REG_E); DONE (1, 4);
+      OPCODE(24) ALU_INC (REG_H); DONE (1, 4);
+      OPCODE(2C) ALU_INC (REG_L); DONE (1, 4);
+      OPCODE(3C) ALU_INC (REG_A); DONE (1, 4);
+      OPCODE(34) {
+         byte value = READ8 (REG_HL);
+         ALU_INC (value);
+         WRITE8 (REG_HL, value);
+      }
+      DONE (1, 12);
+
+      OPCODE(05) ALU_DEC (REG_B); DONE (1, 4);
+      OPCODE(0D) ALU_DEC (REG_C); DONE (1, 4);
+      OPCODE(15) ALU_DEC (REG_D); DONE (1, 4);
+      OPCODE(1D) ALU_DEC (REG_E); DONE (1, 4);
+      OPCODE(25) ALU_DEC (REG_H); DONE (1, 4);
+      OPCODE(2D) ALU_DEC (REG_L); DONE (1, 4);
+      OPCODE(3D) ALU_DEC (REG_A); DONE (1, 4);
+      OPCODE(35) {
+         byte value = READ8 (REG_HL);
+         ALU_DEC (value);
+         WRITE8 (REG_HL, value);
+      }
+      DONE (1, 12);
+
+      /* 16 bit arithmetic */
+      OPCODE(09) ALU_ADD16 (REG_BC); DONE (1, 8);
+      OPCODE(19) ALU_ADD16 (REG_DE); DONE (1, 8);
+      OPCODE(29) ALU_ADD16 (REG_HL); DONE (1, 8);
+      OPCODE(39) ALU_ADD16 (REG_SP); DONE (1, 8);
+      OPCODE(E8) ALU_SP_OFFSET (REG_SP); DONE (2, 16);
+
+      OPCODE(03) REG_BC++; DONE (1, 8);
+      OPCODE(13) REG_DE++; DONE (1, 8);
+      OPCODE(23) REG_HL++; DONE (1, 8);
+      OPCODE(33) REG_SP++; DONE (1, 8);
+      OPCODE(0B) REG_BC--; DONE (1, 8);
+      OPCODE(1B) REG_DE--; DONE (1, 8);
+      OPCODE(2B) REG_HL--; DONE (1, 8);
+      OPCODE(3B) REG_SP--; DONE (1, 8);
+
+      /* Rotates on A */
+      OPCODE(07) CB_RLC (REG_A); DONE (1, 4);
+      OPCODE(17) CB_RL (REG_A); DONE (1, 4);
+      OPCODE(0F) CB_RRC (REG_A); DONE (1, 4);
+      OPCODE(1F) CB_RR (REG_A); DONE (1, 4);
+
+      /* 0xCB prefixed instructions, decoded from the opcode fields
+         rather than given a handler each */
+      OPCODE(CB) {
+         byte cbOpcode = IMM8;
+         byte operand = cbOpcode & 7;
+         byte bit = (cbOpcode >> 3) & 7;
+         byte value;
+
+         switch (operand) {
+            case 0: value = REG_B; break;
+            case 1: value = REG_C; break;
+            case 2: value = REG_D; break;
+            case 3: value = REG_E; break;
+            case 4: value = REG_H; break;
+            case 5: value = REG_L; break;
+            case 6: value = READ8 (REG_HL); break;
+            default: value = REG_A; break;
+         }
+
+         switch (cbOpcode >> 6) {
+            case 0:
+               switch (bit) {
+                  case 0: CB_RLC (value); break;
+                  case 1: CB_RRC (value); break;
+                  case 2: CB_RL (value); break;
+                  case 3: CB_RR (value); break;
+                  case 4: CB_SLA (value); break;
+                  case 5: CB_SRA (value); break;
+                  case 6: CB_SWAP (value); break;
+                  default: CB_SRL (value); break;
+               }
+               break;
+            case 1:
+               REG_F &= ~(FLAG_Z | FLAG_N);
+               REG_F |= FLAG_H;
+               if (!(value & (1 << bit))) REG_F |= FLAG_Z;
+               break;
+            case 2:
+               value &= ~(1 << bit);
+               break;
+            default:
+               value |= (1 << bit);
+               break;
+         }
+
+         /* BIT only tests the value, everything else writes it back */
+         if ((cbOpcode >> 6) != 1) {
+            switch (operand) {
+               case 0: REG_B = value; break;
+               case 1: REG_C = value; break;
+               case 2: REG_D = value; break;
+               case 3: REG_E = value; break;
+               case 4: REG_H = value; break;
+               case 5: REG_L = value; break;
+               case 6: WRITE8 (REG_HL, value); break;
+               default: REG_A = value; break;
+            }
+         }
+
+         REG_PC += 2;
+         cycles += (operand == 6) ? 16 : 8;
+      }
+      NEXT;
+
+      /* Jumps */
+      OPCODE(C3) REG_PC = IMM16; cycles += 12; NEXT;
+      OPCODE(C2) if (COND_NZ) { REG_PC = IMM16; } else { REG_PC += 3; } cycles += 12; NEXT;
+      OPCODE(CA) if (COND_Z)  { REG_PC = IMM16; } else { REG_PC += 3; } cycles += 12; NEXT;
+      OPCODE(D2) if (COND_NC) { REG_PC = IMM16; } else { REG_PC += 3; } cycles += 12; NEXT;
+      OPCODE(DA) if (COND_C)  { REG_PC = IMM16; } else { REG_PC += 3; } cycles += 12; NEXT;
+      OPCODE(E9) REG_PC = REG_HL; cycles += 4; NEXT;
+
+      OPCODE(18) REG_PC += 2 + (signed_byte)IMM8; cycles += 8; NEXT;
+      OPCODE(20) if (COND_NZ) { REG_PC += 2 + (signed_byte)IMM8; } else { REG_PC += 2; } cycles += 8; NEXT;
+      OPCODE(28) if (COND_Z)  { REG_PC += 2 + (signed_byte)IMM8; } else { REG_PC += 2; } cycles += 8; NEXT;
+      OPCODE(30) if (COND_NC) { REG_PC += 2 + (signed_byte)IMM8; } else { REG_PC += 2; } cycles += 8; NEXT;
+      OPCODE(38) if (COND_C)  { REG_PC += 2 + (signed_byte)IMM8; } else { REG_PC += 2; } cycles += 8; NEXT;
+
+      /* Calls */
+      OPCODE(CD) { word target = IMM16; PUSH (REG_PC + 3); REG_PC = target; } cycles += 12; NEXT;
+      OPCODE(C4) if (COND_NZ) { word target = IMM16; PUSH (REG_PC + 3); REG_PC = target; } else { REG_PC += 3; } cycles += 12; NEXT;
+      OPCODE(CC) if (COND_Z)  { word target = IMM16; PUSH (REG_PC + 3); REG_PC = target; } else { REG_PC += 3; } cycles += 12; NEXT;
+      OPCODE(D4) if (COND_NC) { word target = IMM16; PUSH (REG_PC + 3); REG_PC = target; } else { REG_PC += 3; } cycles += 12; NEXT;
+      OPCODE(DC) if (COND_C)  { word target = IMM16; PUSH (REG_PC + 3); REG_PC = target; } else { REG_PC += 3; } cycles += 12; NEXT;
+
+      RST(C7, 0x00) RST(CF, 0x08) RST(D7, 0x10) RST(DF, 0x18)
+      RST(E7, 0x20) RST(EF, 0x28) RST(F7, 0x30) RST(FF, 0x38)
+
+      /* Returns */
+      OPCODE(C9) POP (REG_PC); cycles += 8; NEXT;
+      OPCODE(C0) if (COND_NZ) { POP (REG_PC); } else { REG_PC++; } cycles += 8; NEXT;
+      OPCODE(C8) if (COND_Z)  { POP (REG_PC); } else { REG_PC++; } cycles += 8; NEXT;
+      OPCODE(D0) if (COND_NC) { POP (REG_PC); } else { REG_PC++; } cycles += 8; NEXT;
+      OPCODE(D8) if (COND_C)  { POP (REG_PC); } else { REG_PC++; } cycles += 8; NEXT;
+      OPCODE(D9) POP (REG_PC); cpu->IME = TRUE; cycles += 8; goto exit;
+
+#ifndef CPU_COMPUTED_GOTO
+      default:
+         goto undefined;
+      }
+
+      if (cycles >= budget || cpu->isExitRequested) break;
+#endif
+   }
+
+   goto exit;
+
+undefined:
+   fprintf (stderr, "ERROR: Opcode %x is not implemented\n", opcode);
+
+exit:
+   cpu->runCycles = 0;
+
+   /* Write the register file back */
+   cpu->pc.value = pc;
+   cpu->sp.value = sp;
+   cpu->af = af;
+   cpu->bc = bc;
+   cpu->de = de;
+   cpu->hl = hl;
+
+   return cycles;
+}
+
+int CPU_step (CPU cpu) {
+   /* A budget of one cycle runs exactly one instruction */
+   return CPU_run (cpu, 1);
+}
@@ -0,0 +1,270 @@
+#include <stdio.h>
+
+#include "CPU.h"
+#include "CPU_state.h"
+#include "MMU.h"
+#include "CPU_idioms.h"
+#include "ALUTables.h"
+
+#include "types.h"
+
+/*
+Idiom recognition
+
+Games move most of their data with a handful of loop shapes, which
+CPU_runIdiom recognises at PC and runs one pass after another without
+going through the instruction handlers:
+
+   fill:    LD (HL+),A / LD (HL-),A
+            DEC r8
+            JR NZ,loop
+
+   copy:    LD A,(HL+) / LD A,(HL-)      or   LD A,(DE)
+            LD (DE),A                         LD (HL+),A / LD (HL-),A
+            INC DE                            INC DE
+            DEC r8                            DEC r8
+            JR NZ,loop                        JR NZ,loop
+
+where the copy loops can also count with BC:
+
+            DEC BC
+            LD A,B / LD A,C
+            OR C   / OR B
+            JR NZ,loop
+
+Every byte still goes through MMU_readByte and MMU_writeByte in the
+order the loop would access it, and at the cycle the instruction
+making the access would start, so I/O registers, banked memory, the
+GPU and source and destination ranges that overlap behave exactly as
+they do one instruction at a time. The registers, flags and cycles at the end
+are what the instruction handlers would have left. Only whole passes
+are run. A pass that would write to the loop's own code, or to the MBC
+while the loop runs from switchable ROM, is left to the interpreter.
+*/
+
+/* Longest loop recognised, the BC counted copy */
+#define IDIOM_MAX_LENGTH 8
+
+#define FLAG_Z (1 << FLAG_ZERO_BIT)
+#define FLAG_N (1 << FLAG_SUB_BIT)
+#define FLAG_H (1 << FLAG_HALFCARRY_BIT)
+
+typedef struct idiom {
+   /* Bytes of code and cycles used by one pass of the loop */
+   int length;
+   int cycles;
+
+   /* Copies rather than fills */
+   bool isCopy;
+
+   /* Pointer registers and how much each moves on per pass */
+   register16 source;
+   register16 destination;
+   int sourceStep;
+   int destinationStep;
+
+   /* Counts with BC (then A ends up as B | C) or with an 8 bit
+      register */
+   bool isCounter16;
+   register8 counter;
+} idiom;
+
+bool CPU_recogniseIdiom (MMU mmu, word pc, idiom *loop);
+bool CPU_isIdiomHazard (word pc, int length, int address);
+int CPU_normaliseAddress (int address);
+
+int CPU_runIdiom (CPU cpu, MMU mmu, int budget) {
+   idiom loop;
+   word pc;
+   word source, destination;
+   int remaining;
+   int passes;
+   int counter;
+   int start;
+   byte value = 0;
+   byte flags;
+
+   pc = CPU_get16bitRegisterValue (cpu, PC);
+
+   if (!CPU_recogniseIdiom (mmu, pc, &loop)) {
+      return 0;
+   }
+
+   /* Passes left before the counter gets to zero */
+   if (loop.isCounter16) {
+      remaining = CPU_get16bitRegisterValue (cpu, BC);
+      if (remaining == 0) remaining = 0x10000;
+   } else {
+      remaining = CPU_get8bitRegisterValue (cpu, loop.counter);
+      if (remaining == 0) remaining = 0x100;
+   }
+   if (remaining > budget / loop.cycles) {
+      remaining = budget / loop.cycles;
+   }
+
+   source = CPU_get16bitRegisterValue (cpu, loop.source);
+   destination = CPU_get16bitRegisterValue (cpu, loop.destination);
+   if (!loop.isCopy) {
+      value = CPU_get8bitRegisterValue (cpu, A);
+   }
+
+   start = cpu->runCycles;
+
+   for (passes = 0; passes < remaining; passes++) {
+      if (CPU_isIdiomHazard (pc, loop.length, destination)) {
+         break;
+      }
+      if (cpu->isExitRequested) {
+         /* An interrupt came up in the last pass */
+         break;
+      }
+
+      /* Each access is timed from the start of its instruction, the
+         store in a copy being the second */
+      cpu->runCycles = start + passes * loop.cycles;
+      if (loop.isCopy) {
+         value = MMU_readByte (mmu, source);
+         source += loop.sourceStep;
+         cpu->runCycles += 8;
+      }
+      MMU_writeByte (mmu, destination, value);
+      destination += loop.destinationStep;
+   }
+
+   cpu->runCycles = start;
+
+   if (passes == 0) {
+      return 0;
+   }
+
+   /* The pointers are the same register when filling */
+   CPU_set16bitRegisterValue (cpu, loop.source, source);
+   CPU_set16bitRegisterValue (cpu, loop.destination, destination);
+
+   if (loop.isCounter16) {
+      counter = (CPU_get16bitRegisterValue (cpu, BC) - passes) & 0xFFFF;
+      CPU_set16bitRegisterValue (cpu, BC, counter);
+
+      /* LD A,B / OR C */
+      value = (counter >> 8) | (counter & 0xFF);
+      CPU_set8bitRegisterValue (cpu, A, value);
+      CPU_set8bitRegisterValue (cpu, F, (value == 0) ? FLAG_Z : 0);
+   } else {
+      counter = CPU_get8bitRegisterValue (cpu, loop.counter);
+
+      /* Flags from the DEC in the last pass */
+      flags = CPU_get8bitRegisterValue (cpu, F) & ~(FLAG_Z | FLAG_N | FLAG_H);
+      flags |= aluDEC[(counter - passes + 1) & 0xFF];
+
+      CPU_set8bitRegisterValue (cpu, loop.counter, counter - passes);
+      CPU_set8bitRegisterValue (cpu, A, value);
+      CPU_set8bitRegisterValue (cpu, F, flags);
+
+      counter = (counter - passes) & 0xFF;
+   }
+
+   if (counter == 0) {
+      /* Fell out of the loop */
+      CPU_set16bitRegisterValue (cpu, PC, pc + loop.length);
+   }
+
+   return passes * loop.cycles;
+}
+
+bool CPU_recogniseIdiom (MMU mmu, word pc, idiom *loop) {
+   byte code[IDIOM_MAX_LENGTH];
+   int i;
+
+   for (i = 0; i < IDIOM_MAX_LENGTH; i++) {
+      code[i] = MMU_readByte (mmu, (pc + i) & 0xFFFF);
+   }
+
+   i = 0;
+   if (code[0] == 0x22 || code[0] == 0x32) {
+      /* LD (HL+),A / LD (HL-),A */
+      loop->isCopy = FALSE;
+      loop->source = HL;
+      loop->destination = HL;
+      loop->sourceStep = 0;
+      loop->destinationStep = (code[0] == 0x22) ? 1 : -1;
+      i = 1;
+   } else if ((code[0] == 0x2A || code[0] == 0x3A) &&
+              code[1] == 0x12 && code[2] == 0x13) {
+      /* LD A,(HL+) / LD A,(HL-), LD (DE),A, INC DE */
+      loop->isCopy = TRUE;
+      loop->source = HL;
+      loop->destination = DE;
+      loop->sourceStep = (code[0] == 0x2A) ? 1 : -1;
+      loop->destinationStep = 1;
+      i = 3;
+   } else if (code[0] == 0x1A && (code[1] == 0x22 || code[1] == 0x32) &&
+              code[2] == 0x13) {
+      /* LD A,(DE), LD (HL+),A / LD (HL-),A, INC DE */
+      loop->isCopy = TRUE;
+      loop->source = DE;
+      loop->destination = HL;
+      loop->sourceStep = 1;
+      loop->destinationStep = (code[1] == 0x22) ? 1 : -1;
+      i = 3;
+   } else {
+      return FALSE;
+   }
+   loop->cycles = loop->isCopy ? 8+8+8 : 8;
+
+   if (code[i] == 0x05 || code[i] == 0x0D) {
+      /* DEC B / DEC C */
+      loop->isCounter16 = FALSE;
+      loop->counter = (code[i] == 0x05) ? B : C;
+      loop->cycles += 4;
+      i++;
+   } else if ((code[i] == 0x15 || code[i] == 0x1D) && !loop->isCopy) {
+      /* DEC D / DEC E, which copies use as a pointer */
+      loop->isCounter16 = FALSE;
+      loop->counter = (code[i] == 0x15) ? D : E;
+      loop->cycles += 4;
+      i++;
+   } else if (code[i] == 0x0B && loop->isCopy &&
+              ((code[i+1] == 0x78 && code[i+2] == 0xB1) ||
+               (code[i+1] == 0x79 && code[i+2] == 0xB0))) {
+      /* DEC BC, LD A,B / LD A,C, OR C / OR B (filling with A would
+         write the counter) */
+      loop->isCounter16 = TRUE;
+      loop->cycles += 8+4+4;
+      i += 3;
+   } else {
+      return FALSE;
+   }
+
+   /* JR NZ back to the start */
+   if (code[i] != 0x20 || (signed_byte)code[i+1] != -(i+2)) {
+      return FALSE;
+   }
+   loop->cycles += 8;
+   loop->length = i + 2;
+
+   return TRUE;
+}
+
+bool CPU_isIdiomHazard (word pc, int length, int address) {
+   int start = CPU_normaliseAddress (pc);
+   int location = CPU_normaliseAddress (address);
+
+   if (location >= start && location < start + length) {
+      /* Would change the loop itself */
+      return TRUE;
+   } else if (address < 0x8000 && pc >= 0x4000 && pc < 0x8000) {
+      /* Could switch the ROM bank the loop is running from */
+      return TRUE;
+   }
+
+   return FALSE;
+}
+
+int CPU_normaliseAddress (int address) {
+   /* Echo of internal RAM */
+   if (address >= 0xE000 && address < 0xFE00) {
+      address -= 0x2000;
+   }
+
+   return address;
+}
@@ -0,0 +1,13 @@
+#ifndef _CPU_IDIOMS_H_
+#define _CPU_IDIOMS_H_
+
+#include "CPU_type.h"
+#include "MMU_type.h"
+
+/* Runs the copy or fill loop starting at PC as one bulk memory
+   operation, for as many whole passes as fit in budget cycles.
+   Returns the number of cycles used, or 0 if the code at PC isn't a
+   loop that is recognised or not even one pass fits */
+int CPU_runIdiom (CPU cpu, MMU mmu, int budget);
+
+#endif
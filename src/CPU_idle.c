@@ -0,0 +1,215 @@
+#include <stdio.h>
+
+#include "CPU.h"
+#include "MMU.h"
+#include "CPU_idle.h"
+
+#include "types.h"
+
+/*
+Idle loop detection
+
+While a game waits for V-Blank or for its interrupt handler to set a
+flag it usually goes round a loop like
+
+   loop:    LDH A,(0x44)         or    loop:   LD A,(flag)
+            CP 0x90                            AND A
+            JR NZ,loop                         JR Z,loop
+
+that does the same thing every pass until what it reads changes.
+CPU_findIdleLoop recognises these so the GB can skip the passes up to
+the next thing that could change the values read. The loop has to be
+straight line code ending in a jump back to its start, made only of
+loads into registers, compares and tests, and each register or flag
+it uses has to be either left alone by the loop or set by it before
+it is used. Anything read from memory has to come from an address
+that is fixed for the whole loop and only changes when an instruction
+writes to it or when the GB updates the GPU, timers or interrupts.
+*/
+
+/* One bit per 8 bit register, plus the flags a jump can test */
+#define USES_REGISTER(r) (1 << (r))
+#define USES_ZERO        (1 << 8)
+#define USES_CARRY       (1 << 9)
+
+/* No memory read */
+#define NO_ADDRESS       -1
+
+typedef struct idleInstruction {
+   int length;
+
+   /* Registers and flags read and written */
+   int reads;
+   int writes;
+
+   /* Memory read, and the registers holding its address */
+   int address;
+   int pointer;
+} idleInstruction;
+
+/* Registers in the order they are encoded in opcodes, (HL) is 6 */
+static const register8 operandRegisters[] = { B, C, D, E, H, L, F, A };
+
+bool CPU_decodeIdleInstruction (CPU cpu, MMU mmu, word pc,
+                                idleInstruction *instruction);
+void CPU_decodeIdleOperand (CPU cpu, int operand,
+                            idleInstruction *instruction);
+bool CPU_isPolledAddress (int address);
+
+int CPU_findIdleLoop (CPU cpu, MMU mmu, word head) {
+   idleInstruction instruction;
+   int reads = 0;
+   int writes = 0;
+   int pc = head;
+   int target;
+   byte opcode;
+   bool isIdle = TRUE;
+
+   /* Everything up to the jump back has to be something the loop can
+      do over and over */
+   while (pc - head < IDLE_MAX_LENGTH &&
+          CPU_decodeIdleInstruction (cpu, mmu, pc, &instruction)) {
+      if (instruction.address != NO_ADDRESS) {
+         /* The address mustn't move from one pass to the next */
+         isIdle = isIdle && (instruction.pointer & writes) == 0 &&
+                  CPU_isPolledAddress (instruction.address);
+      }
+
+      /* Only what the loop hasn't set yet this pass is carried over
+         from the last one */
+      reads |= instruction.reads & ~writes;
+      writes |= instruction.writes;
+      pc += instruction.length;
+   }
+
+   opcode = MMU_readByte (mmu, pc);
+   if (opcode == 0x18 || (opcode & 0xE7) == 0x20) {
+      /* JR n, JR cc,n */
+      target = pc + 2 + (signed_byte)MMU_readByte (mmu, pc + 1);
+   } else if (opcode == 0xC3 || (opcode & 0xE7) == 0xC2) {
+      /* JP nn, JP cc,nn */
+      target = MMU_readWord (mmu, pc + 1);
+   } else {
+      target = NO_IDLE_LOOP;
+   }
+
+   if (opcode == 0x20 || opcode == 0x28 || opcode == 0xC2 || opcode == 0xCA) {
+      reads |= USES_ZERO & ~writes;
+   } else if (opcode == 0x30 || opcode == 0x38 || opcode == 0xD2 || opcode == 0xDA) {
+      reads |= USES_CARRY & ~writes;
+   }
+
+   if (!isIdle || (target & 0xFFFF) != head || (reads & writes) != 0) {
+      pc = NO_IDLE_LOOP;
+   }
+
+   return pc;
+}
+
+bool CPU_decodeIdleInstruction (CPU cpu, MMU mmu, word pc,
+                                idleInstruction *instruction) {
+   byte opcode;
+   byte opcodeCB;
+   bool isIdle = TRUE;
+
+   opcode = MMU_readByte (mmu, pc);
+
+   instruction->length = CPU_getInstructionLength (opcode);
+   instruction->reads = 0;
+   instruction->writes = 0;
+   instruction->address = NO_ADDRESS;
+   instruction->pointer = 0;
+
+   if (opcode == 0x00) {
+      /* NOP */
+   } else if (opcode == 0x0A || opcode == 0x1A) {
+      /* LD A,(BC), LD A,(DE) */
+      if (opcode == 0x0A) {
+         instruction->address = CPU_get16bitRegisterValue (cpu, BC);
+         instruction->pointer = USES_REGISTER(B) | USES_REGISTER(C);
+      } else {
+         instruction->address = CPU_get16bitRegisterValue (cpu, DE);
+         instruction->pointer = USES_REGISTER(D) | USES_REGISTER(E);
+      }
+      instruction->reads = instruction->pointer;
+      instruction->writes = USES_REGISTER(A);
+   } else if (opcode == 0xF0) {
+      /* LDH A,(n) */
+      instruction->address = 0xFF00 + MMU_readByte (mmu, pc + 1);
+      instruction->writes = USES_REGISTER(A);
+   } else if (opcode == 0xF2) {
+      /* LD A,(C) */
+      instruction->address = 0xFF00 + CPU_get8bitRegisterValue (cpu, C);
+      instruction->pointer = USES_REGISTER(C);
+      instruction->reads = instruction->pointer;
+      instruction->writes = USES_REGISTER(A);
+   } else if (opcode == 0xFA) {
+      /* LD A,(nn) */
+      instruction->address = MMU_readWord (mmu, pc + 1);
+      instruction->writes = USES_REGISTER(A);
+   } else if (opcode >= 0x40 && opcode < 0x80 && (opcode & 0xF8) != 0x70) {
+      /* LD r,r' and LD r,(HL) */
+      CPU_decodeIdleOperand (cpu, opcode & 7, instruction);
+      instruction->writes = USES_REGISTER(operandRegisters[(opcode >> 3) & 7]);
+   } else if (opcode >= 0xA0 && opcode < 0xC0) {
+      /* AND, XOR, OR and CP with r or (HL) */
+      CPU_decodeIdleOperand (cpu, opcode & 7, instruction);
+      instruction->reads |= USES_REGISTER(A);
+      instruction->writes = USES_ZERO | USES_CARRY;
+      if (opcode < 0xB8) {
+         instruction->writes |= USES_REGISTER(A);
+      }
+   } else if (opcode == 0xE6 || opcode == 0xEE || opcode == 0xF6 || opcode == 0xFE) {
+      /* AND n, XOR n, OR n, CP n */
+      instruction->reads = USES_REGISTER(A);
+      instruction->writes = USES_ZERO | USES_CARRY;
+      if (opcode != 0xFE) {
+         instruction->writes |= USES_REGISTER(A);
+      }
+   } else if (opcode == 0xCB) {
+      opcodeCB = MMU_readByte (mmu, pc + 1);
+      if (opcodeCB >= 0x40 && opcodeCB < 0x80) {
+         /* BIT b,r and BIT b,(HL) */
+         CPU_decodeIdleOperand (cpu, opcodeCB & 7, instruction);
+         instruction->writes = USES_ZERO;
+      } else {
+         isIdle = FALSE;
+      }
+   } else {
+      isIdle = FALSE;
+   }
+
+   return isIdle;
+}
+
+void CPU_decodeIdleOperand (CPU cpu, int operand,
+                            idleInstruction *instruction) {
+   if (operand == 6) {
+      /* (HL) */
+      instruction->address = CPU_get16bitRegisterValue (cpu, HL);
+      instruction->pointer = USES_REGISTER(H) | USES_REGISTER(L);
+      instruction->reads = instruction->pointer;
+   } else {
+      instruction->reads = USES_REGISTER(operandRegisters[operand]);
+   }
+}
+
+bool CPU_isPolledAddress (int address) {
+   bool isPolled = FALSE;
+
+   if (address < 0xA000 || (address >= 0xC000 && address < 0xFEA0)) {
+      /* ROM, video RAM, internal RAM and OAM */
+      isPolled = TRUE;
+   } else if (address == 0xFF00 || address == 0xFF0F) {
+      /* Joypad and interrupt flags */
+      isPolled = TRUE;
+   } else if (address >= 0xFF40 && address <= 0xFF4B) {
+      /* LCD registers */
+      isPolled = TRUE;
+   } else if (address >= 0xFF80) {
+      /* High RAM and interrupt enable */
+      isPolled = TRUE;
+   }
+
+   return isPolled;
+}
@@ -0,0 +1,23 @@
+#ifndef _CPU_IDLE_H_
+#define _CPU_IDLE_H_
+
+#include "CPU_type.h"
+#include "MMU_type.h"
+
+#include "types.h"
+
+/* Longest polling loop recognised, in bytes */
+#define IDLE_MAX_LENGTH 16
+
+/* Returned by CPU_findIdleLoop when there is no idle loop at head */
+#define NO_IDLE_LOOP -1
+
+/* Checks whether the code starting at head is a loop that only polls
+   memory: every pass reads the same addresses, leaves the same
+   registers and flags behind and writes nothing, so it can't do
+   anything until one of the values it reads changes. Returns the
+   address of the jump back to head that closes the loop, or
+   NO_IDLE_LOOP */
+int CPU_findIdleLoop (CPU cpu, MMU mmu, word head);
+
+#endif
@@ -3,281 +3,305 @@
 #include "GB.h"
 #include "MMU.h"
 #include "CPU.h"
+#include "CPU_state.h"
 #include "CPU_instructions.h"
+#include "ALUTables.h"
 #include "bitOperations.h"
 
-#define REG_PC (cpu->registers[PC].value)
-#define REG_SP (cpu->registers[SP].value)
-#define REG_AF (cpu->registers[AF].value)
-#define REG_BC (cpu->registers[BC].value)
-#define REG_DE (cpu->registers[DE].value)
-#define REG_HL (cpu->registers[HL].value)
-#define REG_A  (cpu->registers[AF].bytes.high)
-#define REG_F  (cpu->registers[AF].bytes.low)
-#define REG_B  (cpu->registers[BC].bytes.high)
-#define REG_C  (cpu->registers[BC].bytes.low)
-#define REG_D  (cpu->registers[DE].bytes.high)
-#define REG_E  (cpu->registers[DE].bytes.low)
-#define REG_H  (cpu->registers[HL].bytes.high)
-#define REG_L  (cpu->registers[HL].bytes.low)
+#ifdef CPU_ACCURATE
+/* Time every memory access (see CPU_state.h) */
+#define MMU_readByte(mmu, location)  CPU_readByte (cpu, mmu, location)
+#define MMU_writeByte(mmu, location, value) \
+   CPU_writeByte (cpu, mmu, location, value)
+#define MMU_readWord(mmu, location)  CPU_readWord (cpu, mmu, location)
+#define MMU_writeWord(mmu, location, value) \
+   CPU_writeWord (cpu, mmu, location, value)
+#endif
+
+#define REG_PC (cpu->pc.value)
+#define REG_SP (cpu->sp.value)
+#define REG_AF (cpu->af.value)
+#define REG_BC (cpu->bc.value)
+#define REG_DE (cpu->de.value)
+#define REG_HL (cpu->hl.value)
+#define REG_A  (cpu->af.bytes.high)
+#define REG_F  (cpu->af.bytes.low)
+#define REG_B  (cpu->bc.bytes.high)
+#define REG_C  (cpu->bc.bytes.low)
+#define REG_D  (cpu->de.bytes.high)
+#define REG_E  (cpu->de.bytes.low)
+#define REG_H  (cpu->hl.bytes.high)
+#define REG_L  (cpu->hl.bytes.low)
 
 #define ADD 0
 #define SUB 1
 
-struct CPU {
-   GB gb;
+#define FLAG_Z (1 << FLAG_ZERO_BIT)
+#define FLAG_N (1 << FLAG_SUB_BIT)
+#define FLAG_H (1 << FLAG_HALFCARRY_BIT)
+#define FLAG_C (1 << FLAG_CARRY_BIT)
+
+#ifdef CPU_LAZY_FLAGS
+/* Leaves the flags of an ALU operation to be worked out by
+   CPU_updateFlags when something needs them */
+#define DEFER_FLAGS(op, operand, result) \
+   (cpu->flagOp = (op), \
+    cpu->flagOperand = (operand), \
+    cpu->flagResult = (result))
+
+/* Same for INC and DEC, which keep the carry of whatever came before
+   in bit 8 of the operand. The unused low bits of F are kept in F, so
+   are cleared here if what came before was going to clear them */
+#define DEFER_FLAGS_KEEPING_CARRY(op, operand, result) \
+   (cpu->flagOperand = (operand) | (CPU_isCarrySet (cpu) ? 0x100 : 0), \
+    REG_F = (cpu->flagOp == FLAGS_ADD || cpu->flagOp == FLAGS_SUB || \
+             cpu->flagOp == FLAGS_AND || cpu->flagOp == FLAGS_OR) ? \
+            0 : REG_F, \
+    cpu->flagOp = (op), \
+    cpu->flagResult = (result))
+
+/* Replaces all of F, along with any flags still to be worked out */
+#define SET_FLAGS(flags) (cpu->flagOp = FLAGS_NONE, REG_F = (flags))
+#else
+#define SET_FLAGS(flags) (REG_F = (flags))
+#endif
+
+/* Reads the operand following the opcode */
+byte CPU_readImmediateByte (CPU cpu) {
+#ifdef CPU_DECODE_CACHE
+   if (cpu->decoded != NULL) {
+      return (cpu->decoded->immediate & 0xFF);
+   }
+#endif
+   return MMU_readByte (GB_getMMU (cpu->gb), REG_PC + 1);
+}
 
-   bool IME;
-   reg registers[NUM_REGISTERS];
-};
+word CPU_readImmediateWord (CPU cpu) {
+#ifdef CPU_DECODE_CACHE
+   if (cpu->decoded != NULL) {
+      return cpu->decoded->immediate;
+   }
+#endif
+   return MMU_readWord (GB_getMMU (cpu->gb), REG_PC + 1);
+}
 
 void CPU_8bitUpdateHalfCarry (CPU cpu, int oldValue, int newValue, int type) {
-   int oldNibble = oldValue & 0xF;
-   int newNibble = newValue & 0xF;
+   word entry;
 
+   /* oldValue plus/minus the difference has the same low nibble as
+      newValue, so the table's half carry is the one wanted */
    if (type == ADD) {
-      if (newNibble < oldNibble) CPU_setHalfCarry (cpu);   
+      entry = aluADD[0][oldValue & 0xFF][(newValue - oldValue) & 0xFF];
    } else {
-      if (newNibble > oldNibble) CPU_setHalfCarry (cpu);
+      entry = aluSUB[0][oldValue & 0xFF][(oldValue - newValue) & 0xFF];
    }
+
+   if (entry & FLAG_H) CPU_setHalfCarry (cpu);
 }
 
 void CPU_16bitUpdateHalfCarry (CPU cpu, int oldValue, int newValue, int type) {
-   int oldNibble = (oldValue & 0xF00) >> 8;
-   int newNibble = (newValue & 0xF00) >> 8;
-
-   if (type == ADD) {
-      if (newNibble < oldNibble) CPU_setHalfCarry (cpu);   
-   } else {
-      if (newNibble > oldNibble) CPU_setHalfCarry (cpu);
-   }
+   /* Same as the 8 bit version on bits 8-11 */
+   CPU_8bitUpdateHalfCarry (cpu, oldValue >> 8, newValue >> 8, type);
 }
 
 void CPU_8bitADD (CPU cpu, byte *dest, byte *toAdd) {
+#ifdef CPU_LAZY_FLAGS
    int result;
    result = (int)*dest + (int)*toAdd;
 
-   CPU_clearFlags (cpu);
-   if ((result & 0xFF) == 0) CPU_setZero (cpu);
-   if (result < 0 || result > 0xFF) CPU_setCarry (cpu);
-   CPU_8bitUpdateHalfCarry (cpu, *dest, result, ADD);
+   DEFER_FLAGS (FLAGS_ADD, *dest, result);
+   *dest = result;
+#else
+   word entry = aluADD[0][*dest][*toAdd];
 
-   *dest += *toAdd;
+   *dest = entry >> 8;
+   REG_F = entry & 0xFF;
+#endif
 }
 
 void CPU_8bitADC (CPU cpu, byte *dest, byte *toAdd) {
+   int C = 0;
+#ifdef CPU_LAZY_FLAGS
    int result;
-   byte C = 0;
-   
+#else
+   word entry;
+#endif
+
    if (CPU_isCarrySet (cpu)) C = 1;
 
+#ifdef CPU_LAZY_FLAGS
    result = (int)*dest + (int)*toAdd + C;
 
-   CPU_clearFlags (cpu);
-   if ((result & 0xFF) == 0) CPU_setZero (cpu);
-   if (result < 0 || result > 0xFF) CPU_setCarry (cpu);
-   CPU_8bitUpdateHalfCarry (cpu, *dest, result, ADD);
+   DEFER_FLAGS (FLAGS_ADD, *dest, result);
+   *dest = result;
+#else
+   entry = aluADD[C][*dest][*toAdd];
 
-   *dest += *toAdd + C;
+   *dest = entry >> 8;
+   REG_F = entry & 0xFF;
+#endif
 }
 
 void CPU_8bitSUB (CPU cpu, byte *dest, byte *toSub) {
+#ifdef CPU_LAZY_FLAGS
    int result; 
-
-   CPU_clearFlags (cpu);
-   CPU_setSub (cpu);
-
    result = (int)*dest - (int)*toSub;
 
-   if (result == 0) CPU_setZero (cpu);
-   if (result < 0 || result > 0xFF) CPU_setCarry (cpu);
-   CPU_8bitUpdateHalfCarry (cpu, *dest, result, SUB);
+   DEFER_FLAGS (FLAGS_SUB, *dest, result);
+   *dest = result;
+#else
+   word entry = aluSUB[0][*dest][*toSub];
 
-   *dest -= *toSub;
+   *dest = entry >> 8;
+   REG_F = entry & 0xFF;
+#endif
 }
 
 void CPU_8bitSBC (CPU cpu, byte *dest, byte *toSub) {
-   int result; 
    int C = 0;
+#ifdef CPU_LAZY_FLAGS
+   int result;
+#else
+   word entry;
+#endif
 
-   if (!CPU_isCarrySet (cpu)) C = 1;
-
-   CPU_clearFlags (cpu);
-   CPU_setSub (cpu);
+   if (CPU_isCarrySet (cpu)) C = 1;
 
+#ifdef CPU_LAZY_FLAGS
    result = (int)*dest - (int)*toSub - C;
 
-   if (result == 0) CPU_setZero (cpu);
-   if (result < 0 || result > 0xFF) CPU_setCarry (cpu);
-   CPU_8bitUpdateHalfCarry (cpu, *dest, result, SUB);
+   DEFER_FLAGS (FLAGS_SUB, *dest, result);
+   *dest = result;
+#else
+   entry = aluSUB[C][*dest][*toSub];
 
-   *dest -= *toSub + C;
+   *dest = entry >> 8;
+   REG_F = entry & 0xFF;
+#endif
 }
 
 void CPU_8bitAND (CPU cpu, byte *dest, byte *toAnd) {
-   CPU_clearFlags (cpu);
-   CPU_setHalfCarry (cpu);
-
+#ifdef CPU_LAZY_FLAGS
    *dest &= *toAnd;
-
-   if (*dest == 0) CPU_setZero (cpu);
+   DEFER_FLAGS (FLAGS_AND, 0, *dest);
+#else
+   *dest &= *toAnd;
+   REG_F = (*dest == 0) ? (FLAG_Z | FLAG_H) : FLAG_H;
+#endif
 }
 
 void CPU_8bitOR (CPU cpu, byte *dest, byte *toOr) {
-   CPU_clearFlags (cpu);
-
+#ifdef CPU_LAZY_FLAGS
    *dest |= *toOr;
-
-   if (*dest == 0) CPU_setZero (cpu);
+   DEFER_FLAGS (FLAGS_OR, 0, *dest);
+#else
+   *dest |= *toOr;
+   REG_F = (*dest == 0) ? FLAG_Z : 0;
+#endif
 }
 
 void CPU_8bitXOR (CPU cpu, byte *dest, byte *toXor) {
-   CPU_clearFlags (cpu);
-
+#ifdef CPU_LAZY_FLAGS
    *dest ^= *toXor;
-
-   if (*dest == 0) CPU_setZero (cpu);
+   DEFER_FLAGS (FLAGS_OR, 0, *dest);
+#else
+   *dest ^= *toXor;
+   REG_F = (*dest == 0) ? FLAG_Z : 0;
+#endif
 }
 
 void CPU_8bitCP (CPU cpu, byte *dest, byte *toCp) {
+#ifdef CPU_LAZY_FLAGS
    int result; 
-
-   CPU_clearFlags (cpu);
-   CPU_setSub (cpu);
-
    result = (int)*dest - (int)*toCp;
 
-   if (result == 0) CPU_setZero (cpu);
-   if (result < 0 || result > 0xFF) CPU_setCarry (cpu);
-   CPU_8bitUpdateHalfCarry (cpu, *dest, result, SUB);
+   DEFER_FLAGS (FLAGS_SUB, *dest, result);
+#else
+   REG_F = aluSUB[0][*dest][*toCp] & 0xFF;
+#endif
 }
 
 void CPU_8bitINC (CPU cpu, byte *dest) {
-   int result;
-   
-   CPU_clearZero (cpu); 
-   CPU_clearSub (cpu); 
-   CPU_clearHalfCarry (cpu);
-   result = (int)*dest + 1;
-
-   if ((result & 0xFF) == 0) CPU_setZero (cpu);
-   CPU_8bitUpdateHalfCarry (cpu, *dest, result, ADD);
+#ifdef CPU_LAZY_FLAGS
+   DEFER_FLAGS_KEEPING_CARRY (FLAGS_INC, *dest, (int)*dest + 1);
+#else
+   REG_F = (REG_F & ~(FLAG_Z | FLAG_N | FLAG_H)) | aluINC[*dest];
+#endif
 
    (*dest)++;
 }
 
 void CPU_8bitDEC (CPU cpu, byte *dest) {
-   int result;
-   
-   CPU_clearZero (cpu); 
-   CPU_clearSub (cpu); 
-   CPU_clearHalfCarry (cpu);
-   CPU_setSub (cpu);
-
-   result = (int)*dest - 1;
-
-   if (result == 0) CPU_setZero (cpu);
-   CPU_8bitUpdateHalfCarry (cpu, *dest, result, SUB);
+#ifdef CPU_LAZY_FLAGS
+   DEFER_FLAGS_KEEPING_CARRY (FLAGS_DEC, *dest, (int)*dest - 1);
+#else
+   REG_F = (REG_F & ~(FLAG_Z | FLAG_N | FLAG_H)) | aluDEC[*dest];
+#endif
 
    (*dest)--;
 }
 
 void CPU_16bitADD (CPU cpu, word *dest, word *toAdd) {
-   int result;
-
-   CPU_clearSub (cpu);
-   CPU_clearCarry (cpu);
-   CPU_clearHalfCarry (cpu);
-
-   result = (int)*dest + (int)*toAdd;
-   if (result < 0 || result > 0xFFFF) CPU_setCarry (cpu);
-   CPU_16bitUpdateHalfCarry (cpu, *dest, result, ADD);
+#ifdef CPU_LAZY_FLAGS
+   /* Keeps the zero flag of whatever came before */
+   CPU_updateFlags (cpu);
+   DEFER_FLAGS (FLAGS_ADD16, *dest, (int)*dest + (int)*toAdd);
+#else
+   word entry;
+   int C;
+
+   /* H and C come from adding the high bytes with the carry out of
+      the low bytes */
+   C = ((*dest & 0xFF) + (*toAdd & 0xFF)) >> 8;
+   entry = aluADD[C][*dest >> 8][*toAdd >> 8];
+
+   REG_F = (REG_F & ~(FLAG_N | FLAG_H | FLAG_C)) | (entry & (FLAG_H | FLAG_C));
+#endif
 
    *dest += *toAdd; 
 }
 
-void CPU_8bitSWAP (CPU cpu, byte *dest) {
-   byte upperNibble;
-   byte lowerNibble;
-
-   CPU_clearFlags (cpu);
+void CPU_8bitShift (CPU cpu, byte *dest, aluShiftOperation operation) {
+   word entry;
+   int C = 0;
 
-   upperNibble = (*dest & 0xF0) >> 4;
-   lowerNibble = *dest & 0x0F;
+   if (CPU_isCarrySet (cpu)) C = 1;
 
-   *dest = (lowerNibble << 4) | upperNibble; 
+   entry = aluShift[operation][C][*dest];
+   *dest = entry >> 8;
+   SET_FLAGS (entry & 0xFF);
+}
 
-   if (*dest == 0) CPU_setZero (cpu);
+void CPU_8bitSWAP (CPU cpu, byte *dest) {
+   CPU_8bitShift (cpu, dest, ALU_SWAP);
 }
 
 void CPU_8bitRLC (CPU cpu, byte *dest) {
-   CPU_clearFlags (cpu);
-   if (testBit(*dest, 7)) CPU_setCarry (cpu);
-
-   *dest <<= 1;
-   if (CPU_isCarrySet(cpu)) setBit (dest, 0);
-   if (*dest == 0) CPU_setZero (cpu);
+   CPU_8bitShift (cpu, dest, ALU_RLC);
 }
 
 void CPU_8bitRL (CPU cpu, byte *dest) {
-   bool isCarryOriginallySet = FALSE;
-
-   isCarryOriginallySet = CPU_isCarrySet (cpu);
-   CPU_clearFlags (cpu);
-
-   if (testBit(*dest, 7)) CPU_setCarry (cpu);
-
-   *dest <<= 1;
-   if (isCarryOriginallySet) setBit (dest, 0);
-   if (*dest == 0) CPU_setZero (cpu);
+   CPU_8bitShift (cpu, dest, ALU_RL);
 }
 
 void CPU_8bitRRC (CPU cpu, byte *dest) {
-   CPU_clearFlags (cpu);
-   if (testBit(*dest, 0)) CPU_setCarry (cpu);
-
-   *dest >>= 1;
-   if (CPU_isCarrySet(cpu)) setBit (dest, 7);
-   if (*dest == 0) CPU_setZero (cpu);
+   CPU_8bitShift (cpu, dest, ALU_RRC);
 }
 
 void CPU_8bitRR (CPU cpu, byte *dest) {
-   bool isCarryOriginallySet = FALSE;
-
-   isCarryOriginallySet = CPU_isCarrySet (cpu);
-   CPU_clearFlags (cpu);
-
-   if (testBit(*dest, 0)) CPU_setCarry (cpu);
-
-   *dest >>= 1;
-   if (isCarryOriginallySet) setBit (dest, 7);
-   if (*dest == 0) CPU_setZero (cpu);
+   CPU_8bitShift (cpu, dest, ALU_RR);
 }
 
 void CPU_8bitSLA (CPU cpu, byte *dest) {
-   CPU_clearFlags (cpu); 
-   if (testBit(*dest, 7)) CPU_setCarry (cpu);
-
-   *dest <<= 1;
-   if (*dest == 0) CPU_setZero (cpu);
+   CPU_8bitShift (cpu, dest, ALU_SLA);
 }
 
 void CPU_8bitSRA (CPU cpu, byte *dest) {
-   bool isMsbOriginallySet = testBit (*dest, 7);
-   CPU_clearFlags (cpu);
-   if (testBit(*dest, 0)) CPU_setCarry (cpu);
-
-   *dest >>= 1;
-   if (isMsbOriginallySet) setBit (dest, 7);
-   if (*dest == 0) CPU_setZero (cpu);
+   CPU_8bitShift (cpu, dest, ALU_SRA);
 }
 
 void CPU_8bitSRL (CPU cpu, byte *dest) {
-   CPU_clearFlags (cpu); 
-   if (testBit(*dest, 0)) CPU_setCarry (cpu);
-
-   *dest >>= 1;
-   if (*dest == 0) CPU_setZero (cpu);
+   CPU_8bitShift (cpu, dest, ALU_SRL);
 }
 
 void CPU_8bitBIT (CPU cpu, byte *dest, int bit) {
@@ -313,43 +337,37 @@ int CPU_NOP (CPU cpu) {
 }
 
 int CPU_LD_B_n (CPU cpu) {
-   MMU mmu = GB_getMMU (cpu->gb);
-   REG_B = MMU_readByte (mmu, REG_PC + 1);
+   REG_B = CPU_readImmediateByte (cpu);
    REG_PC += 2;
    return 8;
 }
 
 int CPU_LD_C_n (CPU cpu) {
-   MMU mmu = GB_getMMU (cpu->gb);
-   REG_C = MMU_readByte (mmu, REG_PC + 1);
+   REG_C = CPU_readImmediateByte (cpu);
    REG_PC += 2;
    return 8;
 }
 
 int CPU_LD_D_n (CPU cpu) {
-   MMU mmu = GB_getMMU (cpu->gb);
-   REG_D = MMU_readByte (mmu, REG_PC + 1);
+   REG_D = CPU_readImmediateByte (cpu);
    REG_PC += 2;
    return 8;
 }
 
 int CPU_LD_E_n (CPU cpu) {
-   MMU mmu = GB_getMMU (cpu->gb);
-   REG_E = MMU_readByte (mmu, REG_PC + 1);
+   REG_E = CPU_readImmediateByte (cpu);
    REG_PC += 2;
    return 8;
 }
 
 int CPU_LD_H_n (CPU cpu) {
-   MMU mmu = GB_getMMU (cpu->gb);
-   REG_H = MMU_readByte (mmu, REG_PC + 1);
+   REG_H = CPU_readImmediateByte (cpu);
    REG_PC += 2;
    return 8;
 }
 
 int CPU_LD_L_n (CPU cpu) {
-   MMU mmu = GB_getMMU (cpu->gb);
-   REG_L = MMU_readByte (mmu, REG_PC + 1);
+   REG_L = CPU_readImmediateByte (cpu);
    REG_PC += 2;
    return 8;
 }
@@ -418,15 +436,14 @@ int CPU_LD_A_aDE (CPU cpu) {
 
 int CPU_LD_A_ann (CPU cpu) {
    MMU mmu = GB_getMMU (cpu->gb);
-   word immediateWord = MMU_readWord (mmu, REG_PC + 1);
+   word immediateWord = CPU_readImmediateWord (cpu);
    REG_A = MMU_readByte (mmu, immediateWord);
    REG_PC += 3;
    return 16;
 }
 
 int CPU_LD_A_n (CPU cpu) {
-   MMU mmu = GB_getMMU (cpu->gb);
-   REG_A = MMU_readByte (mmu, REG_PC+1);
+   REG_A = CPU_readImmediateByte (cpu);
    REG_PC += 2;
    return 8;
 }
@@ -774,7 +791,7 @@ int CPU_LD_aHL_n (CPU cpu) {
    byte byteToWrite;
    MMU mmu = GB_getMMU (cpu->gb);
 
-   byteToWrite = MMU_readByte (mmu, REG_PC + 1);
+   byteToWrite = CPU_readImmediateByte (cpu);
    MMU_writeByte (mmu, REG_HL, byteToWrite);
 
    REG_PC += 2;
@@ -799,7 +816,7 @@ int CPU_LD_ann_A (CPU cpu) {
    word location;
    MMU mmu = GB_getMMU (cpu->gb);
 
-   location = MMU_readWord (mmu, REG_PC + 1);
+   location = CPU_readImmediateWord (cpu);
    MMU_writeByte (mmu, location, REG_A);
    REG_PC += 3;
    return 16;
@@ -856,7 +873,7 @@ int CPU_LDH_an_A (CPU cpu) {
    byte immediate;
    MMU mmu = GB_getMMU (cpu->gb);
 
-   immediate = MMU_readByte (mmu, REG_PC+1);
+   immediate = CPU_readImmediateByte (cpu);
    MMU_writeByte (mmu, 0xFF00+immediate, REG_A);
 
    REG_PC += 2;
@@ -867,7 +884,7 @@ int CPU_LDH_A_an (CPU cpu) {
    byte immediate;
    MMU mmu = GB_getMMU (cpu->gb);
 
-   immediate = MMU_readByte (mmu, REG_PC+1);
+   immediate = CPU_readImmediateByte (cpu);
    REG_A = MMU_readByte (mmu, 0xFF00+immediate);
 
    REG_PC += 2;
@@ -875,29 +892,25 @@ int CPU_LDH_A_an (CPU cpu) {
 }
 
 int CPU_LD_BC_nn (CPU cpu) {
-   MMU mmu = GB_getMMU (cpu->gb);
-   REG_BC = MMU_readWord (mmu, REG_PC + 1);
+   REG_BC = CPU_readImmediateWord (cpu);
    REG_PC += 3;
    return 12;
 }
 
 int CPU_LD_DE_nn (CPU cpu) {
-   MMU mmu = GB_getMMU (cpu->gb);
-   REG_DE = MMU_readWord (mmu, REG_PC + 1);
+   REG_DE = CPU_readImmediateWord (cpu);
    REG_PC += 3;
    return 12;
 }
 
 int CPU_LD_HL_nn (CPU cpu) {
-   MMU mmu = GB_getMMU (cpu->gb);
-   REG_HL = MMU_readWord (mmu, REG_PC + 1);
+   REG_HL = CPU_readImmediateWord (cpu);
    REG_PC += 3;
    return 12;
 }
 
 int CPU_LD_SP_nn (CPU cpu) {
-   MMU mmu = GB_getMMU (cpu->gb);
-   REG_SP = MMU_readWord (mmu, REG_PC + 1);
+   REG_SP = CPU_readImmediateWord (cpu);
    REG_PC += 3;
    return 12;
 }
@@ -911,9 +924,8 @@ int CPU_LD_SP_HL (CPU cpu) {
 int CPU_LDHL_SP_n (CPU cpu) {
    int result;
    signed_byte immediate;
-   MMU mmu = GB_getMMU (cpu->gb);
 
-   immediate = (signed_byte)MMU_readByte (mmu, REG_PC+1);
+   immediate = (signed_byte)CPU_readImmediateByte (cpu);
    result = (int)REG_SP + (int)immediate;
    
    CPU_clearFlags (cpu);
@@ -931,7 +943,7 @@ int CPU_LDHL_SP_n (CPU cpu) {
 
 int CPU_LD_ann_SP (CPU cpu) {
    MMU mmu = GB_getMMU (cpu->gb);
-   word address = MMU_readWord (mmu, REG_PC + 1);
+   word address = CPU_readImmediateWord (cpu);
    MMU_writeWord (mmu, address, REG_SP);
 
    REG_PC += 3;
@@ -942,6 +954,7 @@ int CPU_LD_ann_SP (CPU cpu) {
 int CPU_PUSH_AF (CPU cpu) {
    MMU mmu = GB_getMMU (cpu->gb);
    REG_SP -= 2;
+   CPU_updateFlags (cpu);
    MMU_writeWord (mmu, REG_SP, REG_AF);
    REG_PC++;
    return 16;
@@ -973,6 +986,7 @@ int CPU_PUSH_HL (CPU cpu) {
 
 int CPU_POP_AF (CPU cpu) {
    MMU mmu = GB_getMMU (cpu->gb);
+   CPU_updateFlags (cpu);
    REG_AF = MMU_readWord (mmu, REG_SP);
    REG_SP += 2;
    REG_PC++;
@@ -1058,9 +1072,8 @@ int CPU_ADD_A_aHL (CPU cpu) {
 
 int CPU_ADD_A_n (CPU cpu) {
    byte byteToAdd;
-   MMU mmu = GB_getMMU (cpu->gb);
 
-   byteToAdd = MMU_readByte (mmu, REG_PC+1);
+   byteToAdd = CPU_readImmediateByte (cpu);
    CPU_8bitADD (cpu, &REG_A, &byteToAdd);
    REG_PC += 2;
    return 8;
@@ -1121,9 +1134,8 @@ int CPU_ADC_A_aHL (CPU cpu) {
 
 int CPU_ADC_A_n (CPU cpu) {
    byte byteToAdd;
-   MMU mmu = GB_getMMU (cpu->gb);
 
-   byteToAdd = MMU_readByte (mmu, REG_PC+1);
+   byteToAdd = CPU_readImmediateByte (cpu);
    CPU_8bitADC (cpu, &REG_A, &byteToAdd);
    REG_PC += 2;
    return 8;
@@ -1184,9 +1196,8 @@ int CPU_SUB_A_aHL (CPU cpu) {
 
 int CPU_SUB_A_n (CPU cpu) {
    byte byteToSub;
-   MMU mmu = GB_getMMU (cpu->gb);
    
-   byteToSub = MMU_readByte (mmu, REG_PC+1);
+   byteToSub = CPU_readImmediateByte (cpu);
    CPU_8bitSUB (cpu, &REG_A, &byteToSub);
 
    REG_PC += 2;
@@ -1248,9 +1259,8 @@ int CPU_SBC_A_aHL (CPU cpu) {
 
 int CPU_SBC_A_n (CPU cpu) {
    byte byteToSub;
-   MMU mmu = GB_getMMU (cpu->gb);
    
-   byteToSub = MMU_readByte (mmu, REG_PC+1);
+   byteToSub = CPU_readImmediateByte (cpu);
    CPU_8bitSBC (cpu, &REG_A, &byteToSub);
    
    REG_PC += 2;
@@ -1312,9 +1322,8 @@ int CPU_AND_A_aHL (CPU cpu) {
 
 int CPU_AND_A_n (CPU cpu) {
    byte byteToAnd;
-   MMU mmu = GB_getMMU (cpu->gb);
    
-   byteToAnd = MMU_readByte (mmu, REG_PC+1);
+   byteToAnd = CPU_readImmediateByte (cpu);
    CPU_8bitAND (cpu, &REG_A, &byteToAnd);
 
    REG_PC += 2;
@@ -1376,9 +1385,8 @@ int CPU_OR_A_aHL (CPU cpu) {
 
 int CPU_OR_A_n (CPU cpu) {
    byte byteToOr;
-   MMU mmu = GB_getMMU (cpu->gb);
    
-   byteToOr = MMU_readByte (mmu, REG_PC+1);
+   byteToOr = CPU_readImmediateByte (cpu);
    CPU_8bitOR (cpu, &REG_A, &byteToOr);
 
    REG_PC += 2;
@@ -1440,9 +1448,8 @@ int CPU_XOR_A_aHL (CPU cpu) {
 
 int CPU_XOR_A_n (CPU cpu) {
    byte byteToXor;
-   MMU mmu = GB_getMMU (cpu->gb);
    
-   byteToXor = MMU_readByte (mmu, REG_PC+1);
+   byteToXor = CPU_readImmediateByte (cpu);
    CPU_8bitXOR (cpu, &REG_A, &byteToXor);
 
    REG_PC += 2;
@@ -1504,9 +1511,8 @@ int CPU_CP_A_aHL (CPU cpu) {
 
 int CPU_CP_A_n (CPU cpu) {
    byte byteToCp;
-   MMU mmu = GB_getMMU (cpu->gb);
    
-   byteToCp = MMU_readByte (mmu, REG_PC+1);
+   byteToCp = CPU_readImmediateByte (cpu);
    CPU_8bitCP (cpu, &REG_A, &byteToCp);
    
    REG_PC += 2;
@@ -1647,11 +1653,10 @@ int CPU_ADD_HL_SP (CPU cpu) {
 int CPU_ADD_SP_n (CPU cpu) {
    int result;
    signed_byte immediate;
-   MMU mmu = GB_getMMU (cpu->gb);
 
    CPU_clearFlags (cpu);
 
-   immediate = (signed_byte)MMU_readByte (mmu, REG_PC + 1); 
+   immediate = (signed_byte)CPU_readImmediateByte (cpu); 
    
    result = (int)REG_SP + (int)immediate;
    if (result < 0 || result > 0xFFFF) CPU_setCarry (cpu);
@@ -1662,6 +1667,7 @@ int CPU_ADD_SP_n (CPU cpu) {
       CPU_16bitUpdateHalfCarry (cpu, REG_SP, result, SUB);
    }
 
+   REG_SP = result;
    REG_PC += 2;
    return 16;
 }
@@ -1715,11 +1721,9 @@ int CPU_DEC_SP (CPU cpu) {
 }
 
 int CPU_DAA (CPU cpu) {
-   /* TODO */
-   CPU_clearZero (cpu);
-   CPU_clearHalfCarry (cpu);
-
-   if (REG_A == 0) CPU_setZero (cpu);
+   /* Indexed by N, H and C, which sit next to each other in F */
+   CPU_updateFlags (cpu);
+   REG_AF = aluDAA[(REG_F >> FLAG_CARRY_BIT) & 0x7][REG_A];
 
    REG_PC++;
    return 4;
@@ -1777,7 +1781,8 @@ int CPU_DI (CPU cpu) {
 }
 
 int CPU_EI (CPU cpu) {
-   CPU_setIME (cpu, TRUE);
+   /* Not until after the next instruction */
+   cpu->isIMEPending = TRUE;
    REG_PC++;
    return 4;
 }
@@ -1807,8 +1812,7 @@ int CPU_RRA (CPU cpu) {
 }
 
 int CPU_JP_nn (CPU cpu) {
-   MMU mmu = GB_getMMU (cpu->gb);
-   REG_PC = MMU_readWord (mmu, REG_PC+1);
+   REG_PC = CPU_readImmediateWord (cpu);
    return 12;
 }
 
@@ -1859,9 +1863,8 @@ int CPU_JP_HL (CPU cpu) {
 
 int CPU_JR_n (CPU cpu) {
    signed_byte immediate;
-   MMU mmu = GB_getMMU (cpu->gb);
 
-   immediate = (signed_byte)MMU_readByte (mmu, REG_PC + 1);
+   immediate = (signed_byte)CPU_readImmediateByte (cpu);
    REG_PC += 2;
 
    REG_PC += immediate;
@@ -1908,7 +1911,7 @@ int CPU_CALL_nn (CPU cpu) {
    word jumpTo;
    MMU mmu = GB_getMMU (cpu->gb);
    
-   jumpTo = MMU_readWord (mmu, REG_PC+1);
+   jumpTo = CPU_readImmediateWord (cpu);
 
    /* Push return address */
    REG_SP -= 2;
@@ -0,0 +1,83 @@
+#ifndef _CPU_STATE_H_
+#define _CPU_STATE_H_
+
+/*
+The CPU's state, shared by the files that make up the CPU (CPU.c,
+CPU_instructions.c and CPU_core.c). Everything else goes through the
+functions in CPU.h.
+*/
+
+#include "GB_type.h"
+#include "CPU_type.h"
+#include "MMU_type.h"
+
+#include "CPU.h"
+#ifdef CPU_DECODE_CACHE
+#include "DecodeCache.h"
+#endif
+
+#include "types.h"
+
+struct CPU {
+   GB gb;
+
+   bool IME;
+
+   /* Set by EI, the IME is set once the instruction after it starts */
+   bool isIMEPending;
+
+   /* Set by CPU_requestExit, the current CPU_run stops after the
+      instruction it is on */
+   bool isExitRequested;
+
+   /* Cycles the current CPU_run has used before the instruction it is
+      on, 0 outside CPU_run */
+   int runCycles;
+
+#ifdef CPU_ACCURATE
+   /* Cycles into the current instruction of its next memory access */
+   int accessCycles;
+#endif
+
+   /* The registers by name, or indexed by register16 through
+      registers (which is also how the JIT finds them) */
+   union {
+      reg registers[NUM_REGISTERS];
+
+      struct {
+         reg pc;
+         reg sp;
+         reg af;
+         reg bc;
+         reg de;
+         reg hl;
+      };
+   };
+
+#ifdef CPU_DECODE_CACHE
+   /* The instruction being executed, if it came from the decode cache */
+   decodedInstruction *decoded;
+#endif
+
+#ifdef CPU_LAZY_FLAGS
+   /* Last ALU operation whose flags haven't been worked out yet, the
+      value it started from and the value it produced. INC and DEC
+      keep the carry from before them in bit 8 of the operand */
+   flagOperation flagOp;
+   int flagOperand;
+   int flagResult;
+#endif
+};
+
+#ifdef CPU_ACCURATE
+/* Memory accesses made by instructions, each one taking the next
+   M-cycle (4 cycles) of the instruction so that the timers and GPU
+   see it when it happens rather than at the start of the instruction.
+   CPU_instructions.c uses these in place of the MMU functions */
+byte CPU_readByte (CPU cpu, MMU mmu, int location);
+void CPU_writeByte (CPU cpu, MMU mmu, int location, byte value);
+word CPU_readWord (CPU cpu, MMU mmu, int location);
+void CPU_writeWord (CPU cpu, MMU mmu, int location, word value);
+#endif
+
+#endif
@@ -1,36 +1,229 @@
+/* For ftruncate, fstat, mmap and msync */
+#define _POSIX_C_SOURCE 200112L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "GB.h"
 #include "Cartridge.h"
+#include "MMU.h"
+#include "CPU.h"
 
 #include "types.h"
 
+/*
+Cartridge
+
+Holds the ROM and external RAM and plays the part of the cartridge's
+memory bank controller. Each kind of controller is a mapper: what it
+does with writes to its registers at 0x0000-0x7FFF, and with external
+RAM accesses that can't go straight to a bank (because the RAM is
+disabled, isn't really a bank, or is a clock register). The registers
+only decide which banks are mapped where, and the MMU's memory map is
+only changed when one of those actually moves, so reads of ROM and
+RAM never come here.
+
+ROM is padded to a power of two banks, so bank numbers are masked to
+the ROM's size the way the controller's unused address lines are,
+rather than checked.
+
+MBC3's real time clock counts emulated cycles, so it keeps time with
+the Game Boy whatever speed the emulator runs at and a run that
+doesn't look at the host's time always sees the same clock. It isn't
+ticked: it is the master cycle count plus an offset, and its
+registers are only worked out when they are latched or written. The
+clock is saved on the end of the save file, after the RAM, in the same
+layout as BGB and VBA-M, and can be moved on by the host time since it
+was saved when it is loaded again.
+
+A cartridge with a battery keeps its RAM in a save file next to the
+ROM, which is mapped into memory and used as the RAM itself. Writes
+to it are writes to the file's pages, so nothing has to be copied
+out to save the game and what was written survives the emulator
+crashing. Flushing only asks the host to write the pages back: it is
+done now and then while RAM has been enabled since the last one, and
+before the file is closed.
+*/
+
+/* What a memory bank controller does */
+typedef struct mapper {
+   /* Writes to the controller's registers, at 0x0000-0x7FFF */
+   void (*writeControl) (Cartridge cartridge, int location, byte value);
+
+   /* Accesses to 0xA000-0xBFFF while no RAM bank is mapped there */
+   byte (*readRAM) (Cartridge cartridge, int location);
+   void (*writeRAM) (Cartridge cartridge, int location, byte value);
+} mapper;
+
+/* Number of bits of RAM MBC2 has, in 4 bit units */
+#define MBC2_RAM_SIZE 512
+
+/* No bank mapped */
+#define NO_BANK -1
+
+/* The clock's registers, selected with RAM banks 0x08-0x0C */
+#define CLOCK_FIRST_REGISTER 0x08
+#define NUM_CLOCK_REGISTERS  5
+
+/* Cycles in a clock day, and the days it counts up to */
+#define CLOCK_DAY_CYCLES ((long long)CLOCK_SPEED * 60 * 60 * 24)
+#define CLOCK_DAYS 512
+
+/* Bytes in a saved clock: the registers as they are and as latched,
+   4 bytes each, and the host time it was saved at in 8 */
+#define CLOCK_FILE_SIZE 48
+
 struct Cartridge {
    GB gb;
    MBC mbcType;
+   const mapper *mapper;
 
    bool loaded;
    byte *data;
+   int numROMBanks;
+
+   /* External RAM, NULL if there isn't any. With a battery it is the
+      save file mapped into memory, and is dirty if it has been
+      enabled since it was last flushed */
+   byte *ram;
+   int numRAMBanks;
+   bool hasBattery;
+   bool isRAMFile;
+   bool isRAMDirty;
+
+   /* The controller's registers: whether RAM is enabled, the two bank
+      number registers and MBC1's banking mode */
+   bool isRAMEnabled;
+   int bankLow;
+   int bankHigh;
+   int mode;
+
+   /* The banks mapped at 0x0000, 0x4000 and 0xA000 */
+   int romBank0;
+   int romBank;
+   int ramBank;
+
+   /* MBC3's clock, in cycles since day 0: clockOffset plus the master
+      cycle count, or haltedCycles while it's halted. The day counter
+      going past 511 sets isDayCarry until it's written */
+   bool hasClock;
+   long long clockOffset;
+   long long haltedCycles;
+   bool isClockHalted;
+   bool isDayCarry;
+
+   /* The registers as last latched, and the last value written to the
+      latch (it latches on a write of 1 after 0) */
+   byte latchedClock[NUM_CLOCK_REGISTERS];
+   byte lastLatchWrite;
+
+   /* The save file the clock goes on the end of, and whether the time
+      between saving and loading it is added on */
+   char *savePath;
+   bool isOfflineTime;
+};
+
+/* Maps the given banks, masked to the ROM and RAM there is. RAM is
+   only mapped if it is enabled and ramBank isn't NO_BANK */
+void Cartridge_mapBanks (Cartridge cartridge,
+                         int romBank0, int romBank, int ramBank);
+
+/* RAM accesses with no bank mapped: disabled RAM reads as 0xFF and
+   ignores writes */
+byte Cartridge_readDisabledRAM (Cartridge cartridge, int location);
+void Cartridge_writeDisabledRAM (Cartridge cartridge, int location, byte value);
+
+/* Maps the save file at path into memory, the given number of bytes
+   of it, making it at least that big. NULL if it can't be */
+byte * Cartridge_mapSaveFile (const char *path, int size);
+
+/* Makes the path of a file next to the ROM, with the ROM's name and
+   the given extension. The caller frees it */
+char * Cartridge_makePath (const char *romPath, const char *extension);
+
+/* Gets and sets the clock, in cycles since day 0 */
+long long Cartridge_getClock (Cartridge cartridge);
+void Cartridge_setClock (Cartridge cartridge, long long cycles);
+
+/* Works the registers out from the clock, and the clock from them */
+void Cartridge_getClockRegisters (Cartridge cartridge, byte *registers);
+void Cartridge_setClockRegisters (Cartridge cartridge, const byte *registers);
+
+/* Reads and writes the clock at the end of the save file */
+void Cartridge_loadClock (Cartridge cartridge);
+void Cartridge_saveClock (Cartridge cartridge);
+
+/* The mappers */
+void Cartridge_writeNone (Cartridge cartridge, int location, byte value);
+void Cartridge_writeMBC1 (Cartridge cartridge, int location, byte value);
+void Cartridge_writeMBC2 (Cartridge cartridge, int location, byte value);
+byte Cartridge_readMBC2RAM (Cartridge cartridge, int location);
+void Cartridge_writeMBC2RAM (Cartridge cartridge, int location, byte value);
+void Cartridge_writeMBC3 (Cartridge cartridge, int location, byte value);
+byte Cartridge_readMBC3RAM (Cartridge cartridge, int location);
+void Cartridge_writeMBC3RAM (Cartridge cartridge, int location, byte value);
+void Cartridge_writeMBC5 (Cartridge cartridge, int location, byte value);
+
+static const mapper mappers[] = {
+   /* MBC_NONE */
+   { Cartridge_writeNone, Cartridge_readDisabledRAM, Cartridge_writeDisabledRAM },
+   /* MBC_1 */
+   { Cartridge_writeMBC1, Cartridge_readDisabledRAM, Cartridge_writeDisabledRAM },
+   /* MBC_2 */
+   { Cartridge_writeMBC2, Cartridge_readMBC2RAM, Cartridge_writeMBC2RAM },
+   /* MBC_3 */
+   { Cartridge_writeMBC3, Cartridge_readMBC3RAM, Cartridge_writeMBC3RAM },
+   /* MBC_5 */
+   { Cartridge_writeMBC5, Cartridge_readDisabledRAM, Cartridge_writeDisabledRAM }
 };
 
 Cartridge Cartridge_init (GB gb) {
-   Cartridge newCartridge = (Cartridge)malloc(sizeof(struct Cartridge));      
+   Cartridge newCartridge = (Cartridge)malloc(sizeof(struct Cartridge));
    assert (newCartridge != NULL);
 
    newCartridge->gb = gb;
+   newCartridge->mbcType = MBC_NONE;
+   newCartridge->mapper = &mappers[MBC_NONE];
    newCartridge->loaded = FALSE;
    newCartridge->data = NULL;
+   newCartridge->numROMBanks = 0;
+   newCartridge->ram = NULL;
+   newCartridge->numRAMBanks = 0;
+   newCartridge->hasBattery = FALSE;
+   newCartridge->isRAMFile = FALSE;
+   newCartridge->isRAMDirty = FALSE;
+   newCartridge->hasClock = FALSE;
+   newCartridge->savePath = NULL;
+   newCartridge->isOfflineTime = FALSE;
 
    return newCartridge;
 }
 
 void Cartridge_free (Cartridge cartridge) {
    assert (cartridge != NULL);
-   
+
    if (cartridge->loaded) {
+      if (cartridge->hasClock) {
+         Cartridge_saveClock (cartridge);
+      }
       free (cartridge->data);
+      if (cartridge->isRAMFile) {
+         /* Wait for the last of the game to be written back */
+         msync (cartridge->ram, cartridge->numRAMBanks * RAM_BANK_SIZE,
+                MS_SYNC);
+         munmap (cartridge->ram, cartridge->numRAMBanks * RAM_BANK_SIZE);
+      } else {
+         free (cartridge->ram);
+      }
+      free (cartridge->savePath);
    }
 
    free (cartridge);
@@ -40,22 +233,33 @@ void Cartridge_load (Cartridge cartridge, const char *location) {
    FILE *input;
    int cartridgeSize;
    byte cartridgeType;
+   int ramSize;
    int i;
 
+   /* External RAM sizes by header byte 0x149 */
+   int ramSizes[] = { 0, 0x800, 0x2000, 0x8000, 0x20000, 0x10000 };
+
    input = fopen (location, "rb");
 
    if (input != NULL) {
       /* Get size of ROM file */
-      fseek (input, 0, SEEK_END);  
+      fseek (input, 0, SEEK_END);
       cartridgeSize = ftell (input);
       fseek (input, 0, SEEK_SET);
 
-      /* Allocate memory for the data */
-      cartridge->data = (byte*)malloc(cartridgeSize);   
+      /* Allocate memory for the data, in a power of two banks and at
+         least the two the MMU maps at once. Anything past the end of
+         the file reads as 0 */
+      cartridge->numROMBanks = 2;
+      while (cartridge->numROMBanks * ROM_BANK_SIZE < cartridgeSize) {
+         cartridge->numROMBanks *= 2;
+      }
+      cartridge->data = (byte*)calloc(cartridge->numROMBanks, ROM_BANK_SIZE);
+      assert (cartridge->data != NULL);
 
       /* Load contents of file into buffer */
       for (i = 0; i < cartridgeSize; i++) {
-         cartridge->data[i] = (byte) fgetc (input);   
+         cartridge->data[i] = (byte) fgetc (input);
       }
 
       /* Determine MBC type */
@@ -63,7 +267,9 @@ void Cartridge_load (Cartridge cartridge, const char *location) {
 
       switch (cartridgeType) {
          case 0x00:
-            cartridge->mbcType = MBC_NONE; 
+         case 0x08:
+         case 0x09:
+            cartridge->mbcType = MBC_NONE;
             break;
          case 0x01:
          case 0x02:
@@ -74,23 +280,99 @@ void Cartridge_load (Cartridge cartridge, const char *location) {
          case 0x06:
             cartridge->mbcType = MBC_2;
             break;
+         case 0x0F:
          case 0x10:
          case 0x11:
          case 0x12:
          case 0x13:
             cartridge->mbcType = MBC_3;
             break;
+         case 0x19:
+         case 0x1A:
+         case 0x1B:
+         case 0x1C:
+         case 0x1D:
+         case 0x1E:
+            cartridge->mbcType = MBC_5;
+            break;
          default:
+            fprintf (stderr, "Warning: cartridge type %02X not implemented\n",
+                     cartridgeType);
+            cartridge->mbcType = MBC_NONE;
             break;
       }
+      cartridge->mapper = &mappers[cartridge->mbcType];
+      cartridge->hasClock = (cartridgeType == 0x0F || cartridgeType == 0x10);
+      cartridge->hasBattery = (cartridgeType == 0x03 ||
+                               cartridgeType == 0x06 ||
+                               cartridgeType == 0x09 ||
+                               cartridgeType == 0x0F ||
+                               cartridgeType == 0x10 ||
+                               cartridgeType == 0x13 ||
+                               cartridgeType == 0x1B ||
+                               cartridgeType == 0x1E);
+      if (cartridge->hasBattery) {
+         cartridge->savePath = Cartridge_makePath (location, ".sav");
+      }
 
-      if (cartridge->mbcType != MBC_NONE) {
-         fprintf (stderr, "Warning: MBC%d not implemented\n", cartridge->mbcType);
+      /* MBC2's RAM is built in, whatever the header says. Anything
+         smaller than a bank is given a whole one so it can be mapped
+         like the others */
+      if (cartridge->mbcType == MBC_2) {
+         ramSize = MBC2_RAM_SIZE;
+      } else if (cartridge->data[0x0149] < 6) {
+         ramSize = ramSizes[cartridge->data[0x0149]];
+      } else {
+         ramSize = 0;
       }
-   
+      if (ramSize > 0) {
+         cartridge->numRAMBanks = (ramSize + RAM_BANK_SIZE - 1) / RAM_BANK_SIZE;
+
+         /* Battery backed RAM is the save file, in whole banks. If it
+            can't be, the game still runs but isn't saved */
+         if (cartridge->hasBattery) {
+            cartridge->ram = Cartridge_mapSaveFile (cartridge->savePath,
+                                    cartridge->numRAMBanks * RAM_BANK_SIZE);
+            cartridge->isRAMFile = (cartridge->ram != NULL);
+            if (!cartridge->isRAMFile) {
+               fprintf (stderr, "Warning: unable to save to %s\n",
+                        cartridge->savePath);
+            }
+         }
+         if (cartridge->ram == NULL) {
+            cartridge->ram = (byte*)calloc(cartridge->numRAMBanks,
+                                           RAM_BANK_SIZE);
+            assert (cartridge->ram != NULL);
+         }
+      }
+
+      /* The registers as they are at power on. Without a controller
+         there is nothing to disable the RAM */
+      cartridge->isRAMEnabled = (cartridge->mbcType == MBC_NONE);
+      cartridge->bankLow = 1;
+      cartridge->bankHigh = 0;
+      cartridge->mode = 0;
+      cartridge->romBank0 = NO_BANK;
+      cartridge->romBank = NO_BANK;
+      cartridge->ramBank = NO_BANK;
+
+      /* The clock starts at day 0 unless it was saved */
+      cartridge->clockOffset = -GB_getCycles (cartridge->gb);
+      cartridge->haltedCycles = 0;
+      cartridge->isClockHalted = FALSE;
+      cartridge->isDayCarry = FALSE;
+      memset (cartridge->latchedClock, 0, NUM_CLOCK_REGISTERS);
+      cartridge->lastLatchWrite = 0xFF;
+      if (cartridge->hasClock) {
+         Cartridge_loadClock (cartridge);
+      }
+
       /* Cartridge has been loaded */
       cartridge->loaded = TRUE;
       fclose (input);
+
+      Cartridge_mapBanks (cartridge, 0, 1,
+                          (cartridge->mbcType == MBC_2) ? NO_BANK : 0);
    } else {
       fprintf (stderr, "Unable to open ROM: %s\n", location);
    }
@@ -100,10 +382,396 @@ byte * Cartridge_getData (Cartridge cartridge, int bankNumber) {
    /* Return a pointer to the data at the beginning of the specified
       bank */
    assert (cartridge->loaded);
-   return (cartridge->data + bankNumber * ROM_BANK_SIZE); 
+   return (cartridge->data + bankNumber * ROM_BANK_SIZE);
+}
+
+bool Cartridge_isLoaded (Cartridge cartridge) {
+   return cartridge->loaded;
+}
+
+void Cartridge_setOfflineTime (Cartridge cartridge, bool enabled) {
+   cartridge->isOfflineTime = enabled;
 }
 
 MBC Cartridge_getMBCType (Cartridge cartridge) {
    assert (cartridge->loaded);
    return cartridge->mbcType;
 }
+
+int Cartridge_getROMBank (Cartridge cartridge) {
+   return cartridge->loaded ? cartridge->romBank : 1;
+}
+
+int Cartridge_getROMBank0 (Cartridge cartridge) {
+   return cartridge->loaded ? cartridge->romBank0 : 0;
+}
+
+void Cartridge_writeControl (Cartridge cartridge, int location, byte value) {
+   assert (location >= 0x0000 && location <= 0x7FFF);
+
+   if (cartridge->loaded) {
+      cartridge->mapper->writeControl (cartridge, location, value);
+   }
+}
+
+byte Cartridge_readRAM (Cartridge cartridge, int location) {
+   assert (location >= 0xA000 && location <= 0xBFFF);
+   return cartridge->mapper->readRAM (cartridge, location);
+}
+
+void Cartridge_writeRAM (Cartridge cartridge, int location, byte value) {
+   assert (location >= 0xA000 && location <= 0xBFFF);
+   cartridge->mapper->writeRAM (cartridge, location, value);
+}
+
+void Cartridge_flushRAM (Cartridge cartridge) {
+   if (cartridge->isRAMFile && cartridge->isRAMDirty) {
+      msync (cartridge->ram, cartridge->numRAMBanks * RAM_BANK_SIZE,
+             MS_ASYNC);
+
+      /* Anything could be written to it while it's still enabled */
+      cartridge->isRAMDirty = cartridge->isRAMEnabled;
+   }
+}
+
+void Cartridge_mapBanks (Cartridge cartridge,
+                         int romBank0, int romBank, int ramBank) {
+   MMU mmu = GB_getMMU (cartridge->gb);
+
+   romBank0 &= cartridge->numROMBanks - 1;
+   romBank &= cartridge->numROMBanks - 1;
+   if (!cartridge->isRAMEnabled || cartridge->ram == NULL ||
+       ramBank == NO_BANK) {
+      ramBank = NO_BANK;
+   } else {
+      ramBank %= cartridge->numRAMBanks;
+   }
+
+   if (romBank0 != cartridge->romBank0 || romBank != cartridge->romBank) {
+      cartridge->romBank0 = romBank0;
+      cartridge->romBank = romBank;
+      MMU_mapROM (mmu, Cartridge_getData (cartridge, romBank0),
+                  Cartridge_getData (cartridge, romBank));
+   }
+
+   if (ramBank != NO_BANK) {
+      cartridge->isRAMDirty = TRUE;
+   }
+   if (ramBank != cartridge->ramBank) {
+      cartridge->ramBank = ramBank;
+      MMU_mapRAM (mmu, (ramBank == NO_BANK) ? NULL :
+                       cartridge->ram + ramBank * RAM_BANK_SIZE);
+   }
+}
+
+byte Cartridge_readDisabledRAM (Cartridge cartridge, int location) {
+   return 0xFF;
+}
+
+void Cartridge_writeDisabledRAM (Cartridge cartridge, int location, byte value) {
+}
+
+void Cartridge_writeNone (Cartridge cartridge, int location, byte value) {
+   /* Nothing to switch */
+}
+
+void Cartridge_writeMBC1 (Cartridge cartridge, int location, byte value) {
+   if (location <= 0x1FFF) {
+      /* External RAM enable */
+      cartridge->isRAMEnabled = ((value & 0x0F) == 0x0A);
+   } else if (location <= 0x3FFF) {
+      /* Low 5 bits of the ROM bank, where 0 means 1 */
+      cartridge->bankLow = value & 0x1F;
+      if (cartridge->bankLow == 0) {
+         cartridge->bankLow = 1;
+      }
+   } else if (location <= 0x5FFF) {
+      /* The RAM bank, or the top 2 bits of the ROM bank */
+      cartridge->bankHigh = value & 0x03;
+   } else {
+      /* Whether the top bits also switch ROM bank 0 and the RAM bank */
+      cartridge->mode = value & 0x01;
+   }
+
+   Cartridge_mapBanks (cartridge,
+                       cartridge->mode ? cartridge->bankHigh << 5 : 0,
+                       (cartridge->bankHigh << 5) | cartridge->bankLow,
+                       cartridge->mode ? cartridge->bankHigh : 0);
+}
+
+void Cartridge_writeMBC2 (Cartridge cartridge, int location, byte value) {
+   /* Bit 8 of the address picks the register, and there's nothing
+      above 0x3FFF */
+   if (location <= 0x3FFF) {
+      if ((location & 0x0100) == 0) {
+         cartridge->isRAMEnabled = ((value & 0x0F) == 0x0A);
+      } else {
+         cartridge->bankLow = value & 0x0F;
+         if (cartridge->bankLow == 0) {
+            cartridge->bankLow = 1;
+         }
+      }
+   }
+
+   Cartridge_mapBanks (cartridge, 0, cartridge->bankLow, NO_BANK);
+}
+
+byte Cartridge_readMBC2RAM (Cartridge cartridge, int location) {
+   /* 512 half bytes repeated through the whole area, the top half
+      reads as set */
+   if (cartridge->isRAMEnabled) {
+      return 0xF0 | cartridge->ram[(location - 0xA000) % MBC2_RAM_SIZE];
+   } else {
+      return 0xFF;
+   }
+}
+
+void Cartridge_writeMBC2RAM (Cartridge cartridge, int location, byte value) {
+   if (cartridge->isRAMEnabled) {
+      cartridge->ram[(location - 0xA000) % MBC2_RAM_SIZE] = value & 0x0F;
+      cartridge->isRAMDirty = TRUE;
+   }
+}
+
+void Cartridge_writeMBC3 (Cartridge cartridge, int location, byte value) {
+   if (location <= 0x1FFF) {
+      /* External RAM (and clock) enable */
+      cartridge->isRAMEnabled = ((value & 0x0F) == 0x0A);
+   } else if (location <= 0x3FFF) {
+      /* 7 bit ROM bank, where 0 means 1 */
+      cartridge->bankLow = value & 0x7F;
+      if (cartridge->bankLow == 0) {
+         cartridge->bankLow = 1;
+      }
+   } else if (location <= 0x5FFF) {
+      /* RAM bank, or 0x08-0x0C for a clock register */
+      cartridge->bankHigh = value & 0x0F;
+   } else if (cartridge->hasClock) {
+      /* Writing 0 then 1 copies the clock into its registers */
+      if (cartridge->lastLatchWrite == 0x00 && value == 0x01) {
+         Cartridge_getClockRegisters (cartridge, cartridge->latchedClock);
+      }
+      cartridge->lastLatchWrite = value;
+   }
+
+   Cartridge_mapBanks (cartridge, 0, cartridge->bankLow,
+                       (cartridge->bankHigh < 0x08) ? cartridge->bankHigh :
+                                                      NO_BANK);
+}
+
+byte Cartridge_readMBC3RAM (Cartridge cartridge, int location) {
+   int reg = cartridge->bankHigh - CLOCK_FIRST_REGISTER;
+
+   if (cartridge->isRAMEnabled && cartridge->hasClock &&
+       reg >= 0 && reg < NUM_CLOCK_REGISTERS) {
+      return cartridge->latchedClock[reg];
+   } else {
+      return 0xFF;
+   }
+}
+
+void Cartridge_writeMBC3RAM (Cartridge cartridge, int location, byte value) {
+   byte registers[NUM_CLOCK_REGISTERS];
+   int reg = cartridge->bankHigh - CLOCK_FIRST_REGISTER;
+
+   if (cartridge->isRAMEnabled && cartridge->hasClock &&
+       reg >= 0 && reg < NUM_CLOCK_REGISTERS) {
+      /* Sets the clock from now on, the latched copy stays as it was */
+      Cartridge_getClockRegisters (cartridge, registers);
+      registers[reg] = value;
+      Cartridge_setClockRegisters (cartridge, registers);
+   }
+}
+
+byte * Cartridge_mapSaveFile (const char *path, int size) {
+   struct stat status;
+   void *ram = MAP_FAILED;
+   int file;
+
+   file = open (path, O_RDWR | O_CREAT, 0644);
+
+   if (file >= 0) {
+      /* A new or short file is filled out with 0s. A longer one (with
+         the clock on the end, say) is left as it is */
+      if (fstat (file, &status) == 0 &&
+          (status.st_size >= size || ftruncate (file, size) == 0)) {
+         ram = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     file, 0);
+      }
+
+      /* The mapping keeps the file open */
+      close (file);
+   }
+
+   return (ram == MAP_FAILED) ? NULL : (byte*)ram;
+}
+
+char * Cartridge_makePath (const char *romPath, const char *extension) {
+   const char *dot = strrchr (romPath, '.');
+   const char *slash = strrchr (romPath, '/');
+   int length = strlen (romPath);
+   char *path;
+
+   /* Swap the ROM's extension for the new one, or add it if there
+      isn't one */
+   if (dot != NULL && (slash == NULL || dot > slash)) {
+      length = dot - romPath;
+   }
+
+   path = (char*)malloc(length + strlen (extension) + 1);
+   assert (path != NULL);
+   memcpy (path, romPath, length);
+   strcpy (path + length, extension);
+
+   return path;
+}
+
+long long Cartridge_getClock (Cartridge cartridge) {
+   long long cycles;
+
+   if (cartridge->isClockHalted) {
+      cycles = cartridge->haltedCycles;
+   } else {
+      cycles = GB_getCycles (cartridge->gb) + cartridge->clockOffset;
+   }
+
+   /* Past the last day it starts again from 0 and remembers it did */
+   if (cycles >= CLOCK_DAYS * CLOCK_DAY_CYCLES) {
+      cycles %= CLOCK_DAYS * CLOCK_DAY_CYCLES;
+      cartridge->isDayCarry = TRUE;
+      Cartridge_setClock (cartridge, cycles);
+   }
+
+   return cycles;
+}
+
+void Cartridge_setClock (Cartridge cartridge, long long cycles) {
+   if (cartridge->isClockHalted) {
+      cartridge->haltedCycles = cycles;
+   } else {
+      cartridge->clockOffset = cycles - GB_getCycles (cartridge->gb);
+   }
+}
+
+void Cartridge_getClockRegisters (Cartridge cartridge, byte *registers) {
+   long long cycles = Cartridge_getClock (cartridge);
+   long long seconds = cycles / CLOCK_SPEED;
+   int days = (int)(cycles / CLOCK_DAY_CYCLES);
+
+   registers[0] = seconds % 60;
+   registers[1] = seconds / 60 % 60;
+   registers[2] = seconds / (60 * 60) % 24;
+   registers[3] = days & 0xFF;
+   registers[4] = ((days >> 8) & 0x01) |
+                  (cartridge->isClockHalted ? 0x40 : 0) |
+                  (cartridge->isDayCarry ? 0x80 : 0);
+}
+
+void Cartridge_setClockRegisters (Cartridge cartridge, const byte *registers) {
+   long long cycles = Cartridge_getClock (cartridge);
+   long long seconds;
+
+   seconds = ((((registers[4] & 0x01) << 8 | registers[3]) * 24LL +
+               (registers[2] & 0x1F)) * 60 +
+              (registers[1] & 0x3F)) * 60 +
+             (registers[0] & 0x3F);
+
+   /* Keeps the part of a second it was into. Halting stops it where
+      it is set to */
+   cycles = seconds * CLOCK_SPEED + cycles % CLOCK_SPEED;
+   cartridge->isClockHalted = (registers[4] & 0x40) != 0;
+   cartridge->isDayCarry = (registers[4] & 0x80) != 0;
+   Cartridge_setClock (cartridge, cycles);
+}
+
+void Cartridge_loadClock (Cartridge cartridge) {
+   FILE *input;
+   byte file[CLOCK_FILE_SIZE];
+   byte registers[NUM_CLOCK_REGISTERS];
+   long long savedTime = 0;
+   long long offline;
+   int i;
+
+   input = fopen (cartridge->savePath, "rb");
+   if (input == NULL) {
+      /* Never saved */
+      return;
+   }
+
+   /* A save file with just the RAM never had the clock saved */
+   if (fseek (input, cartridge->numRAMBanks * RAM_BANK_SIZE, SEEK_SET) == 0 &&
+       fread (file, 1, CLOCK_FILE_SIZE, input) == CLOCK_FILE_SIZE) {
+      /* Little endian, the registers then the latched registers 4
+         bytes each, then the time */
+      for (i = 0; i < NUM_CLOCK_REGISTERS; i++) {
+         registers[i] = file[i * 4];
+         cartridge->latchedClock[i] = file[(NUM_CLOCK_REGISTERS + i) * 4];
+      }
+      for (i = 7; i >= 0; i--) {
+         savedTime = (savedTime << 8) | file[NUM_CLOCK_REGISTERS * 8 + i];
+      }
+      Cartridge_setClockRegisters (cartridge, registers);
+
+      /* Count the time the emulator wasn't running for, unless the
+         clock was stopped */
+      offline = (long long)time (NULL) - savedTime;
+      if (cartridge->isOfflineTime && !cartridge->isClockHalted &&
+          offline > 0) {
+         Cartridge_setClock (cartridge, Cartridge_getClock (cartridge) +
+                                        offline * CLOCK_SPEED);
+      }
+   }
+
+   fclose (input);
+}
+
+void Cartridge_saveClock (Cartridge cartridge) {
+   FILE *output;
+   byte file[CLOCK_FILE_SIZE];
+   byte registers[NUM_CLOCK_REGISTERS];
+   long long now = (long long)time (NULL);
+   int i;
+
+   memset (file, 0, CLOCK_FILE_SIZE);
+   Cartridge_getClockRegisters (cartridge, registers);
+   for (i = 0; i < NUM_CLOCK_REGISTERS; i++) {
+      file[i * 4] = registers[i];
+      file[(NUM_CLOCK_REGISTERS + i) * 4] = cartridge->latchedClock[i];
+   }
+   for (i = 0; i < 8; i++) {
+      file[NUM_CLOCK_REGISTERS * 8 + i] = (now >> (i * 8)) & 0xFF;
+   }
+
+   /* After the RAM, which is left as it is */
+   output = fopen (cartridge->savePath, "r+b");
+   if (output == NULL) {
+      output = fopen (cartridge->savePath, "wb");
+   }
+   if (output != NULL &&
+       fseek (output, cartridge->numRAMBanks * RAM_BANK_SIZE, SEEK_SET) == 0) {
+      fwrite (file, 1, CLOCK_FILE_SIZE, output);
+   } else {
+      fprintf (stderr, "Unable to save the clock to %s\n",
+               cartridge->savePath);
+   }
+   if (output != NULL) {
+      fclose (output);
+   }
+}
+
+void Cartridge_writeMBC5 (Cartridge cartridge, int location, byte value) {
+   if (location <= 0x1FFF) {
+      /* External RAM enable */
+      cartridge->isRAMEnabled = ((value & 0x0F) == 0x0A);
+   } else if (location <= 0x2FFF) {
+      /* Low 8 bits of the 9 bit ROM bank, 0 really is 0 */
+      cartridge->bankLow = (cartridge->bankLow & 0x100) | value;
+   } else if (location <= 0x3FFF) {
+      /* Top bit of the ROM bank */
+      cartridge->bankLow = (cartridge->bankLow & 0xFF) | ((value & 0x01) << 8);
+   } else if (location <= 0x5FFF) {
+      cartridge->bankHigh = value & 0x0F;
+   }
+
+   Cartridge_mapBanks (cartridge, 0, cartridge->bankLow, cartridge->bankHigh);
+}
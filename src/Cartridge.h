@@ -3,14 +3,17 @@
 
 #include "GB_type.h"
 #include "Cartridge_type.h"
+#include "types.h"
 
 #define ROM_BANK_SIZE 16384
+#define RAM_BANK_SIZE 8192
 
 typedef enum MBC {
    MBC_NONE,
    MBC_1,
    MBC_2,
-   MBC_3
+   MBC_3,
+   MBC_5
 } MBC;
 
 /* Constructor and Destructor */
@@ -23,7 +26,31 @@ void Cartridge_load (Cartridge cartridge, const char *location);
 /* Get cartridge data at a specified bank number */
 byte * Cartridge_getData (Cartridge cartridge, int bankNumber);
 
+/* Whether the time since a saved clock was saved is added to it when
+   it's loaded (see GB_setOfflineTime) */
+void Cartridge_setOfflineTime (Cartridge cartridge, bool enabled);
+
+/* Asks for battery backed RAM to be written back to its save file, if
+   it may have changed since it last was. Doesn't wait for it to be */
+void Cartridge_flushRAM (Cartridge cartridge);
+
+/* Whether a cartridge has been loaded */
+bool Cartridge_isLoaded (Cartridge cartridge);
+
 /* Get the memory bank controller type */
 MBC Cartridge_getMBCType (Cartridge cartridge);
 
+/* The ROM banks mapped at 0x4000-0x7FFF and at 0x0000-0x3FFF */
+int Cartridge_getROMBank (Cartridge cartridge);
+int Cartridge_getROMBank0 (Cartridge cartridge);
+
+/* Writes to the memory bank controller at 0x0000-0x7FFF, which maps
+   the banks it selects into the MMU */
+void Cartridge_writeControl (Cartridge cartridge, int location, byte value);
+
+/* Reads and writes external RAM at 0xA000-0xBFFF, for when the MMU
+   has no bank mapped there */
+byte Cartridge_readRAM (Cartridge cartridge, int location);
+void Cartridge_writeRAM (Cartridge cartridge, int location, byte value);
+
 #endif
@@ -0,0 +1,167 @@
+/* ucontext is only used where there is no hand written switch */
+#if !(defined(__x86_64__) && defined(__ELF__))
+#define _XOPEN_SOURCE 600
+#define COROUTINE_UCONTEXT
+#endif
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#ifdef COROUTINE_UCONTEXT
+#include <ucontext.h>
+#endif
+
+#include "Coroutine.h"
+
+#include "types.h"
+
+/*
+Coroutine
+
+Lets parts of the emulator each run on their own stack and hand the
+host CPU to one another at points they choose, so one can stop part
+way through its work and pick up where it left off without having to
+be written as a state machine. Only one runs at a time and nothing
+switches them but Coroutine_switch, so they share the emulator's
+state without any locking.
+
+On x86-64 the switch is a few instructions: push the registers a
+function call has to keep, swap stack pointers and pop the other
+coroutine's. Everywhere else it falls back on swapcontext, which also
+saves the signal mask and so costs a system call each time.
+*/
+
+struct Coroutine {
+   coroutineFunction function;
+   void *argument;
+
+   /* NULL for the thread's own stack */
+   void *stack;
+
+#ifdef COROUTINE_UCONTEXT
+   ucontext_t context;
+#else
+   /* Where the registers were pushed when it last switched away */
+   void *stackPointer;
+#endif
+};
+
+/* The coroutine last switched to, for Coroutine_start to find */
+static Coroutine running = NULL;
+
+/* Where new coroutines start, runs the running one's function */
+void Coroutine_start ();
+
+#ifndef COROUTINE_UCONTEXT
+
+/* Pushes the callee saved registers, stores the stack pointer in
+   *from, then loads to as the stack pointer and pops the registers
+   saved there. Returns into whatever called Coroutine_swapStacks on
+   that stack (or Coroutine_start for a new one) */
+void Coroutine_swapStacks (void **from, void *to);
+
+__asm__ (
+   ".text\n"
+   ".globl Coroutine_swapStacks\n"
+   ".type Coroutine_swapStacks, @function\n"
+   "Coroutine_swapStacks:\n"
+   "   pushq %rbp\n"
+   "   pushq %rbx\n"
+   "   pushq %r12\n"
+   "   pushq %r13\n"
+   "   pushq %r14\n"
+   "   pushq %r15\n"
+   "   movq %rsp, (%rdi)\n"
+   "   movq %rsi, %rsp\n"
+   "   popq %r15\n"
+   "   popq %r14\n"
+   "   popq %r13\n"
+   "   popq %r12\n"
+   "   popq %rbx\n"
+   "   popq %rbp\n"
+   "   ret\n"
+   ".size Coroutine_swapStacks, .-Coroutine_swapStacks\n"
+);
+
+/* Registers Coroutine_swapStacks pushes */
+#define NUM_SAVED_REGISTERS 6
+
+#endif
+
+Coroutine Coroutine_init (coroutineFunction function, void *argument,
+                          int stackSize) {
+   Coroutine newCoroutine = (Coroutine)malloc(sizeof(struct Coroutine));
+   assert (newCoroutine != NULL);
+   assert (function != NULL);
+   assert (stackSize >= 4096);
+
+   newCoroutine->function = function;
+   newCoroutine->argument = argument;
+   newCoroutine->stack = malloc (stackSize);
+   assert (newCoroutine->stack != NULL);
+
+#ifdef COROUTINE_UCONTEXT
+   getcontext (&newCoroutine->context);
+   newCoroutine->context.uc_stack.ss_sp = newCoroutine->stack;
+   newCoroutine->context.uc_stack.ss_size = stackSize;
+   newCoroutine->context.uc_link = NULL;
+   makecontext (&newCoroutine->context, Coroutine_start, 0);
+#else
+   {
+      void **top;
+
+      /* The first switch to it pops zeroed registers and returns into
+         Coroutine_start, which then sees the stack as if it had been
+         called: 16 byte aligned before the (never used) return
+         address */
+      top = (void **)(((uintptr_t)newCoroutine->stack + stackSize) &
+                      ~(uintptr_t)15);
+      top[-1] = NULL;
+      top[-2] = (void *)(uintptr_t)Coroutine_start;
+      newCoroutine->stackPointer = top - 2 - NUM_SAVED_REGISTERS;
+      memset (newCoroutine->stackPointer, 0,
+              NUM_SAVED_REGISTERS * sizeof(void *));
+   }
+#endif
+
+   return newCoroutine;
+}
+
+Coroutine Coroutine_initThread () {
+   Coroutine newCoroutine = (Coroutine)malloc(sizeof(struct Coroutine));
+   assert (newCoroutine != NULL);
+
+   newCoroutine->function = NULL;
+   newCoroutine->argument = NULL;
+   newCoroutine->stack = NULL;
+
+   return newCoroutine;
+}
+
+void Coroutine_free (Coroutine coroutine) {
+   assert (coroutine != NULL);
+
+   free (coroutine->stack);
+   free (coroutine);
+}
+
+void Coroutine_switch (Coroutine from, Coroutine to) {
+   assert (from != NULL && to != NULL);
+
+   running = to;
+#ifdef COROUTINE_UCONTEXT
+   swapcontext (&from->context, &to->context);
+#else
+   Coroutine_swapStacks (&from->stackPointer, to->stackPointer);
+#endif
+}
+
+void Coroutine_start () {
+   running->function (running->argument);
+
+   /* There is nothing to return to */
+   assert (!"Coroutine returned");
+   abort ();
+}
@@ -0,0 +1,28 @@
+#ifndef _COROUTINE_H_
+#define _COROUTINE_H_
+
+#include "Coroutine_type.h"
+
+#include "types.h"
+
+/* Stack size for coroutines that don't need a particular one */
+#define COROUTINE_STACK_SIZE (64 * 1024)
+
+/* What a coroutine runs. It must never return, only switch away */
+typedef void (*coroutineFunction) (void *argument);
+
+/* Constructor and Destructor. Coroutine_init makes one that starts
+   function (argument) on its own stack the first time it is switched
+   to. Coroutine_initThread makes one for the stack the caller is
+   already running on, to switch back to */
+Coroutine Coroutine_init (coroutineFunction function, void *argument,
+                          int stackSize);
+Coroutine Coroutine_initThread ();
+void Coroutine_free (Coroutine coroutine);
+
+/* Stops running from, which must be the running coroutine, and
+   carries on with to from where it last switched away (or from the
+   start). Returns when something switches back to from */
+void Coroutine_switch (Coroutine from, Coroutine to);
+
+#endif
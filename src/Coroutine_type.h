@@ -0,0 +1,6 @@
+#ifndef _COROUTINE_TYPE_H_
+#define _COROUTINE_TYPE_H_
+
+typedef struct Coroutine *Coroutine;
+
+#endif
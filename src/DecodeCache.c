@@ -0,0 +1,398 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "GB.h"
+#include "CPU.h"
+#include "MMU.h"
+#include "DecodeCache.h"
+
+#include "types.h"
+
+/*
+Decode cache
+
+Holds the instructions of basic blocks already decoded: the function
+that executes each one, its length and its immediate operand, so the
+interpreter doesn't have to fetch opcodes and operands through the MMU
+every time it runs them. Blocks end at jumps, calls, returns, HALT and
+STOP, and are decoded an instruction at a time as the CPU gets to them
+so nothing is read ahead of what actually runs.
+
+Blocks are looked up by PC and, for 0x4000-0x7FFF, by the ROM bank that
+was mapped when they were decoded, so a bank switch never runs
+instructions decoded from another bank. Only ROM and internal RAM are
+cached; blocks in 0x0000-0x3FFF are dropped when MBC1 maps another
+bank there, and blocks in internal RAM when the bytes they were decoded
+from are written to.
+*/
+
+#define CACHE_NUM_BUCKETS            0x1000
+#define CACHE_MAX_BLOCK_INSTRUCTIONS 32
+#define CACHE_MAX_BLOCK_BYTES        (CACHE_MAX_BLOCK_INSTRUCTIONS * 3)
+
+/* The whole cache is thrown away when it holds this many blocks */
+#define CACHE_MAX_BLOCKS             0x4000
+
+typedef enum region {
+   REGION_NONE,
+   REGION_ROM0,
+   REGION_ROMX,
+   REGION_WRAM,
+   REGION_HRAM
+} region;
+
+typedef struct decodedBlock *decodedBlock;
+
+struct decodedBlock {
+   word start;
+   word end;
+   int bank;
+
+   /* 0 if the first instruction can't be cached */
+   int numInstructions;
+   decodedInstruction instructions[CACHE_MAX_BLOCK_INSTRUCTIONS];
+
+   /* Set once the block can't be extended any further */
+   bool complete;
+
+   decodedBlock next;
+};
+
+struct DecodeCache {
+   GB gb;
+
+   decodedBlock blocks[CACHE_NUM_BUCKETS];
+   int numBlocks;
+
+   /* The block and instruction the CPU is running */
+   decodedBlock current;
+   int index;
+
+   /* Blocks dropped by a write, freed once the instruction that
+      made the write has finished */
+   decodedBlock dropped;
+
+   /* One bit per address in internal RAM that a block was decoded from */
+   byte codeMap[MAPPED_MEM_SIZE / 8];
+};
+
+region DecodeCache_getRegion (int address);
+int DecodeCache_hash (word pc, int bank);
+decodedBlock DecodeCache_findBlock (DecodeCache cache, word pc, int bank);
+decodedBlock DecodeCache_decode (DecodeCache cache, word start, int bank);
+bool DecodeCache_append (DecodeCache cache, decodedBlock block, word pc);
+bool DecodeCache_endsBlock (byte opcode);
+void DecodeCache_drop (DecodeCache cache, decodedBlock block);
+void DecodeCache_freeDropped (DecodeCache cache);
+void DecodeCache_flush (DecodeCache cache);
+
+DecodeCache DecodeCache_init (GB gb) {
+   DecodeCache newCache = (DecodeCache)malloc(sizeof(struct DecodeCache));
+   assert (newCache != NULL);
+
+   newCache->gb = gb;
+   newCache->numBlocks = 0;
+   newCache->current = NULL;
+   newCache->index = 0;
+   newCache->dropped = NULL;
+
+   memset (newCache->blocks, 0, sizeof(newCache->blocks));
+   memset (newCache->codeMap, 0, sizeof(newCache->codeMap));
+
+   return newCache;
+}
+
+void DecodeCache_free (DecodeCache cache) {
+   DecodeCache_flush (cache);
+   DecodeCache_freeDropped (cache);
+   free (cache);
+}
+
+decodedInstruction * DecodeCache_lookup (DecodeCache cache, word pc) {
+   decodedBlock block = cache->current;
+   region startRegion;
+   int bank = 0;
+
+   /* Most of the time PC has just moved on to the next instruction
+      of the current block */
+   if (block != NULL && cache->index + 1 < block->numInstructions &&
+       block->instructions[cache->index + 1].address == pc) {
+      cache->index++;
+      return &block->instructions[cache->index];
+   } else if (block != NULL && !block->complete &&
+              cache->index + 1 == block->numInstructions &&
+              block->end + 1 == pc) {
+      /* First time through this part of the block */
+      if (DecodeCache_append (cache, block, pc)) {
+         cache->index++;
+         return &block->instructions[cache->index];
+      }
+   }
+
+   DecodeCache_freeDropped (cache);
+
+   startRegion = DecodeCache_getRegion (pc);
+   if (startRegion == REGION_NONE) {
+      cache->current = NULL;
+      return NULL;
+   } else if (startRegion == REGION_ROMX) {
+      bank = MMU_getROMBank (GB_getMMU (cache->gb));
+   }
+
+   block = DecodeCache_findBlock (cache, pc, bank);
+   if (block == NULL) {
+      if (cache->numBlocks >= CACHE_MAX_BLOCKS) {
+         DecodeCache_flush (cache);
+      }
+      block = DecodeCache_decode (cache, pc, bank);
+   }
+
+   if (block->numInstructions == 0) {
+      cache->current = NULL;
+      return NULL;
+   }
+
+   cache->current = block;
+   cache->index = 0;
+
+   return &block->instructions[0];
+}
+
+void DecodeCache_notifyWrite (DecodeCache cache, int location) {
+   int start;
+   decodedBlock block;
+
+   if (location >= MAPPED_MEM_SIZE) {
+      return;
+   }
+
+   if (location < 0x8000) {
+      /* MBC register, the rest of the current block may no
+         longer be mapped */
+      cache->current = NULL;
+      return;
+   }
+
+   if (location >= 0xE000 && location < 0xFE00) {
+      /* Echo of internal RAM */
+      location -= 0x2000;
+   }
+
+   if ((cache->codeMap[location >> 3] & (1 << (location & 7))) == 0) {
+      return;
+   }
+
+   /* Blocks never span more than CACHE_MAX_BLOCK_BYTES */
+   for (start = location - CACHE_MAX_BLOCK_BYTES; start <= location; start++) {
+      if (start >= 0) {
+         block = DecodeCache_findBlock (cache, start, 0);
+         if (block != NULL && block->end >= location) {
+            DecodeCache_drop (cache, block);
+         }
+      }
+   }
+}
+
+void DecodeCache_notifyROMBank0 (DecodeCache cache) {
+   int i;
+   decodedBlock block, next;
+
+   for (i = 0; i < CACHE_NUM_BUCKETS; i++) {
+      block = cache->blocks[i];
+      while (block != NULL) {
+         next = block->next;
+         if (DecodeCache_getRegion (block->start) == REGION_ROM0) {
+            DecodeCache_drop (cache, block);
+         }
+         block = next;
+      }
+   }
+}
+
+region DecodeCache_getRegion (int address) {
+   region r = REGION_NONE;
+
+   if (address < 0x4000) {
+      r = REGION_ROM0;
+   } else if (address < 0x8000) {
+      r = REGION_ROMX;
+   } else if (address >= 0xC000 && address < 0xE000) {
+      r = REGION_WRAM;
+   } else if (address >= 0xFF80 && address < 0xFFFF) {
+      r = REGION_HRAM;
+   }
+
+   return r;
+}
+
+int DecodeCache_hash (word pc, int bank) {
+   return (pc ^ (bank << 7)) & (CACHE_NUM_BUCKETS - 1);
+}
+
+decodedBlock DecodeCache_findBlock (DecodeCache cache, word pc, int bank) {
+   decodedBlock block = cache->blocks[DecodeCache_hash (pc, bank)];
+
+   while (block != NULL && (block->start != pc || block->bank != bank)) {
+      block = block->next;
+   }
+
+   return block;
+}
+
+decodedBlock DecodeCache_decode (DecodeCache cache, word start, int bank) {
+   decodedBlock block;
+
+   block = (decodedBlock)malloc(sizeof(struct decodedBlock));
+   assert (block != NULL);
+
+   block->start = start;
+   block->end = start;
+   block->bank = bank;
+   block->numInstructions = 0;
+   block->complete = FALSE;
+
+   /* Add to the lookup table */
+   block->next = cache->blocks[DecodeCache_hash (start, bank)];
+   cache->blocks[DecodeCache_hash (start, bank)] = block;
+   cache->numBlocks++;
+
+   if (!DecodeCache_append (cache, block, start)) {
+      /* Still has to be dropped if the byte at start changes */
+      if (DecodeCache_getRegion (start) >= REGION_WRAM) {
+         cache->codeMap[start >> 3] |= (1 << (start & 7));
+      }
+   }
+
+   return block;
+}
+
+bool DecodeCache_append (DecodeCache cache, decodedBlock block, word pc) {
+   MMU mmu = GB_getMMU (cache->gb);
+   decodedInstruction *instruction;
+   CPU_instruction execute;
+   region startRegion;
+   byte opcode;
+   int length;
+   int address;
+
+   opcode = MMU_readByte (mmu, pc);
+   length = CPU_getInstructionLength (opcode);
+   startRegion = DecodeCache_getRegion (block->start);
+
+   if (DecodeCache_getRegion (pc + length - 1) != startRegion) {
+      /* Instruction runs off the end of the region */
+      block->complete = TRUE;
+      return FALSE;
+   }
+
+   if (opcode == 0xCB) {
+      execute = CPU_getInstruction (MMU_readByte (mmu, pc + 1), TRUE);
+   } else {
+      execute = CPU_getInstruction (opcode, FALSE);
+   }
+
+   if (execute == NULL) {
+      /* Left to the interpreter to report */
+      block->complete = TRUE;
+      return FALSE;
+   }
+
+   instruction = &block->instructions[block->numInstructions++];
+   instruction->execute = execute;
+   instruction->address = pc;
+   instruction->opcode = opcode;
+   instruction->length = length;
+
+   if (length == 3) {
+      instruction->immediate = MMU_readWord (mmu, pc + 1);
+   } else if (length == 2) {
+      instruction->immediate = MMU_readByte (mmu, pc + 1);
+   } else {
+      instruction->immediate = 0;
+   }
+
+   block->end = pc + length - 1;
+   block->complete = DecodeCache_endsBlock (opcode) ||
+                     block->numInstructions == CACHE_MAX_BLOCK_INSTRUCTIONS;
+
+   if (startRegion == REGION_WRAM || startRegion == REGION_HRAM) {
+      for (address = pc; address <= block->end; address++) {
+         cache->codeMap[address >> 3] |= (1 << (address & 7));
+      }
+   }
+
+   return TRUE;
+}
+
+bool DecodeCache_endsBlock (byte opcode) {
+   bool ends = FALSE;
+
+   if (opcode == 0xC3 || opcode == 0x18 || opcode == 0xCD ||
+       opcode == 0xC9 || opcode == 0xD9 || opcode == 0xE9) {
+      /* JP nn, JR n, CALL nn, RET, RETI, JP (HL) */
+      ends = TRUE;
+   } else if ((opcode & 0xE7) == 0xC2 || (opcode & 0xE7) == 0x20 ||
+              (opcode & 0xE7) == 0xC4 || (opcode & 0xE7) == 0xC0) {
+      /* JP cc, JR cc, CALL cc, RET cc */
+      ends = TRUE;
+   } else if ((opcode & 0xC7) == 0xC7) {
+      /* RST */
+      ends = TRUE;
+   } else if (opcode == 0x76 || opcode == 0x10) {
+      /* HALT, STOP */
+      ends = TRUE;
+   }
+
+   return ends;
+}
+
+void DecodeCache_drop (DecodeCache cache, decodedBlock block) {
+   decodedBlock *link = &cache->blocks[DecodeCache_hash (block->start, block->bank)];
+
+   while (*link != block) {
+      link = &(*link)->next;
+   }
+   *link = block->next;
+   cache->numBlocks--;
+
+   if (cache->current == block) {
+      cache->current = NULL;
+   }
+
+   /* The write may have come from an instruction in this block */
+   block->next = cache->dropped;
+   cache->dropped = block;
+}
+
+void DecodeCache_freeDropped (DecodeCache cache) {
+   decodedBlock block, next;
+
+   block = cache->dropped;
+   while (block != NULL) {
+      next = block->next;
+      free (block);
+      block = next;
+   }
+   cache->dropped = NULL;
+}
+
+void DecodeCache_flush (DecodeCache cache) {
+   int i;
+   decodedBlock block, next;
+
+   for (i = 0; i < CACHE_NUM_BUCKETS; i++) {
+      block = cache->blocks[i];
+      while (block != NULL) {
+         next = block->next;
+         free (block);
+         block = next;
+      }
+      cache->blocks[i] = NULL;
+   }
+
+   memset (cache->codeMap, 0, sizeof(cache->codeMap));
+   cache->numBlocks = 0;
+   cache->current = NULL;
+}
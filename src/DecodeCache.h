@@ -0,0 +1,39 @@
+#ifndef _DECODECACHE_H_
+#define _DECODECACHE_H_
+
+#include "GB_type.h"
+#include "DecodeCache_type.h"
+
+#include "CPU.h"
+#include "types.h"
+
+/* An instruction decoded ahead of time */
+typedef struct decodedInstruction {
+   CPU_instruction execute;
+
+   word address;
+   byte opcode;
+   byte length;
+
+   /* The byte or word following the opcode */
+   word immediate;
+} decodedInstruction;
+
+/* Constructor and Destructor */
+DecodeCache DecodeCache_init (GB gb);
+void DecodeCache_free (DecodeCache cache);
+
+/* Gets the decoded instruction at pc, decoding the basic block that
+   starts there if needed. Returns NULL if the instruction can't be
+   cached and has to be fetched through the MMU */
+decodedInstruction * DecodeCache_lookup (DecodeCache cache, word pc);
+
+/* Called by the MMU on every write, drops the blocks decoded from
+   the written byte */
+void DecodeCache_notifyWrite (DecodeCache cache, int location);
+
+/* Called by the MMU when another ROM bank is mapped at 0x0000-0x3FFF,
+   drops the blocks decoded from the old one */
+void DecodeCache_notifyROMBank0 (DecodeCache cache);
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef _DECODECACHE_TYPE_H_
+#define _DECODECACHE_TYPE_H_
+
+typedef struct DecodeCache *DecodeCache;
+
+#endif
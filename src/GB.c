@@ -8,10 +8,27 @@
 #include "GPU.h"
 #include "Cartridge.h"
 #include "GUI.h"
+#include "CPU_idle.h"
+#include "Scheduler.h"
+#include "Pacer.h"
+#include "Timer.h"
+#include "Profiler.h"
+#ifdef GB_COROUTINES
+#include "Coroutine.h"
+#endif
+#ifdef CPU_JIT
+#include "JIT.h"
+#endif
+#ifdef CPU_DECODE_CACHE
+#include "DecodeCache.h"
+#endif
 
 #include "bitOperations.h"
 #include "types.h"
 
+/* Idle loop heads outside ROM, which are looked at every time */
+#define NO_BANK -1
+
 struct GB {
    bool isRunning;
    bool isHalted;
@@ -23,6 +40,77 @@ struct GB {
    Cartridge cartridge;
 
    GUI gui;
+
+   /* Keeps GB_run to speed times the Game Boy's frame rate, unless
+      it is GB_SPEED_UNCAPPED. Then only one frame in every frameSkip
+      is shown. GB_run stops after frameLimit frames if it isn't 0 */
+   Pacer pacer;
+   int speed;
+   int frameSkip;
+   long frameLimit;
+
+   /* Battery backed RAM is flushed to its save file every
+      saveInterval frames of emulated time, however the GB is run, or
+      only at the end if it is 0 */
+   int saveInterval;
+
+   /* Where the host's time goes, reported by GB_run every emulated
+      second while it is on */
+   Profiler profiler;
+
+#ifdef CPU_JIT
+   JIT jit;
+#endif
+#ifdef CPU_DECODE_CACHE
+   DecodeCache decodeCache;
+#endif
+
+   /* When the GPU and timer next have something to do, and the cycle
+      the GPU was last brought up to. The GPU is only caught up when
+      it is due to interrupt or start or end V-Blank, or when the CPU
+      uses something that depends on it. LCD registers written since
+      then get it rescheduled at the end of the slice */
+   Scheduler scheduler;
+   long long gpuCycles;
+   bool isGPUWritten;
+   bool isGPUSyncing;
+
+   /* The most cycles the GPU is left behind the CPU for, 0 for as
+      long as nothing needs it */
+   int syncWindow;
+
+#ifdef GB_COROUTINES
+   /* The GPU runs on its own stack, switched to to catch up and back
+      once it has */
+   Coroutine cpuCoroutine;
+   Coroutine gpuCoroutine;
+#endif
+
+   /* Whether the CPU read LY or STAT in the last slice */
+   bool isGPUPolled;
+
+   /* The divider and timer are only worked out when they are used:
+      the 16 bit counter that DIV is the top half of has counted every
+      cycle since dividerStart, and TIMA was timerValue at timerCycles */
+   long long dividerStart;
+   long long timerCycles;
+   byte timerValue;
+
+   /* Where the CPU last started a slice and the ROM bank mapped there,
+      and the jump that closes the loop there if it only polls memory */
+   word idleLoopHead;
+   int idleLoopBank;
+   int idleLoopBranch;
+   bool isIdleLoop;
+
+   bool idleSkipping;
+   long skippedCycles;
+   long idleLoopSkips;
+
+   /* Cycles run since GB_init, and how far the last GB_runCycles went
+      past the number of cycles it was asked for */
+   long long cycles;
+   int overrun;
 };
 
 /* Runs the start up sequence for the gameboy */
@@ -31,34 +119,151 @@ void GB_runBootSequence (GB gb);
 /* Checks for any interrupts and handles them, returns the number of cycles used */
 int GB_handleInterrupts (GB gb);
 
-/* Updates the timers */
-void GB_handleTimers (GB gb, int cycles);
+/* Brings TIMA up to the current cycle, reloading it from TMA and requesting
+   an interrupt each time it overflows */
+void GB_updateTimer (GB gb);
+
+/* Adds increments to TIMA */
+void GB_incrementTimer (GB gb, long long increments);
+
+/* Gets the counter DIV is the top 8 bits of */
+int GB_getDividerCounter (GB gb);
+
+/* Gets the number of cycles between timer increments, which happen as
+   the counter bit at half that goes from 1 to 0 */
+int GB_getTimerPeriod (byte timerControl);
+
+/* Gets the number of cycles until the timer next overflows */
+int GB_cyclesUntilTimerOverflow (GB gb);
+
+/* Runs the CPU for at least budget cycles (less if it stops to let the
+   GB take over) before bringing the GPU, timers and interrupts up to
+   date. Returns the number of cycles used */
+int GB_runSlice (GB gb, int budget);
+
+/* Runs a pass of the polling loop at PC and skips the passes after it
+   up to budget cycles. Returns the number of cycles used, 0 if there
+   is no polling loop at PC */
+int GB_runIdleLoop (GB gb, int budget);
+
+/* Gets the cycle the CPU is on, which is past gb->cycles part way
+   through a slice */
+long long GB_getCurrentCycle (GB gb);
+
+/* Brings the GPU up to the current cycle, GB_catchUpGPU only does so
+   if it is behind */
+void GB_syncGPU (GB gb);
+void GB_catchUpGPU (GB gb);
+
+/* Does the work of GB_syncGPU, on the GPU's stack in builds where it
+   has one */
+void GB_runGPU (GB gb);
+
+#ifdef GB_COROUTINES
+/* The GPU's coroutine, catches it up each time it is switched to */
+void GB_runGPUCoroutine (void *argument);
+#endif
+
+/* Schedules the next time the GPU has to be brought up to date. That
+   only moves when it gets there or its registers are written, not
+   when it is caught up in between */
+void GB_scheduleGPU (GB gb);
+
+/* Schedules the next timer overflow */
+void GB_scheduleTimer (GB gb);
+
+/* Schedules the next flush of battery backed RAM */
+void GB_scheduleSave (GB gb);
+
+/* Brings up to date everything that is due or has been written */
+void GB_runEvents (GB gb);
+
+/* Shows the frame and reads the keys */
+void GB_updateGUI (GB gb);
 
 GB GB_init () {
    GB newGB = (GB)malloc(sizeof(struct GB));
    assert (newGB != NULL);
 
+   newGB->scheduler = Scheduler_init ();
+   newGB->gpuCycles = 0;
+   newGB->isGPUWritten = FALSE;
+   newGB->isGPUSyncing = FALSE;
+   newGB->isGPUPolled = FALSE;
+   newGB->syncWindow = 0;
+#ifdef GB_COROUTINES
+   newGB->cpuCoroutine = Coroutine_initThread ();
+   newGB->gpuCoroutine = Coroutine_init (GB_runGPUCoroutine, newGB,
+                                         COROUTINE_STACK_SIZE);
+#endif
+   newGB->dividerStart = 0;
+   newGB->timerCycles = 0;
+   newGB->timerValue = 0;
+   newGB->cycles = 0;
+
    newGB->cpu = CPU_init (newGB);
    newGB->mmu = MMU_init (newGB);
    newGB->gpu = GPU_init (newGB);
    newGB->cartridge = Cartridge_init (newGB);
    newGB->gui = GUI_init (newGB);
+   newGB->pacer = Pacer_init (FRAME_CYCLES, CLOCK_SPEED);
+   newGB->speed = 1;
+   newGB->frameSkip = 10;
+   newGB->frameLimit = 0;
+   newGB->saveInterval = GB_SAVE_INTERVAL;
+   newGB->profiler = Profiler_init ();
+#ifdef CPU_JIT
+   newGB->jit = JIT_init (newGB);
+#endif
+#ifdef CPU_DECODE_CACHE
+   newGB->decodeCache = DecodeCache_init (newGB);
+#endif
 
    newGB->isRunning = FALSE;
-   newGB->isRunning = FALSE;
+   newGB->isHalted = FALSE;
+
+   newGB->idleLoopHead = 0;
+   newGB->idleLoopBank = NO_BANK;
+   newGB->idleLoopBranch = NO_IDLE_LOOP;
+   newGB->isIdleLoop = FALSE;
+   newGB->idleSkipping = TRUE;
+   newGB->skippedCycles = 0;
+   newGB->idleLoopSkips = 0;
+
+   newGB->overrun = 0;
+
    GB_runBootSequence (newGB);
 
+   /* Work out when things happen once the first instruction has run */
+   Scheduler_schedule (newGB->scheduler, EVENT_GPU, 0);
+   GB_scheduleTimer (newGB);
+   GB_scheduleSave (newGB);
+
    return newGB;
 }
 
 void GB_free (GB gb) {
    assert (gb != NULL);
 
+   /* First, as saving the cartridge's clock needs the cycle count */
+   Cartridge_free (gb->cartridge);
    CPU_free (gb->cpu);
    MMU_free (gb->mmu);
    GPU_free (gb->gpu);
-   Cartridge_free (gb->cartridge);
    GUI_free (gb->gui);
+   Pacer_free (gb->pacer);
+   Profiler_free (gb->profiler);
+#ifdef CPU_JIT
+   JIT_free (gb->jit);
+#endif
+#ifdef CPU_DECODE_CACHE
+   DecodeCache_free (gb->decodeCache);
+#endif
+   Scheduler_free (gb->scheduler);
+#ifdef GB_COROUTINES
+   Coroutine_free (gb->gpuCoroutine);
+   Coroutine_free (gb->cpuCoroutine);
+#endif
 
    free (gb);
 }
@@ -68,32 +273,525 @@ void GB_loadRom (GB gb, const char *location) {
 }
 
 void GB_run (GB gb) {
-   int cyclesSoFar = 0;
-   int cyclesThisIteration = 0;
+   Timer timer;
+   long frames = 0;
+   double seconds;
+   long long reportCycles;
+   subsystem previous;
 
    gb->isRunning = TRUE;
 
+   if (gb->speed == GB_SPEED_UNCAPPED) {
+      GUI_setFrameSkip (gb->gui, gb->frameSkip);
+   } else {
+      GUI_setFrameSkip (gb->gui, 1);
+      Pacer_setSpeed (gb->pacer, gb->speed);
+      Pacer_start (gb->pacer);
+   }
+
+   timer = Timer_init ();
+   Timer_start (timer);
+   Profiler_reset (gb->profiler);
+   reportCycles = gb->cycles;
+
    while (gb->isRunning) {
-      if (!gb->isHalted) {
-         cyclesThisIteration = CPU_step (gb->cpu);
-         cyclesSoFar += cyclesThisIteration;
-      } else {
-         /* CPU is halted, execute NOPs */
-         cyclesThisIteration = 4;
-         cyclesSoFar += cyclesThisIteration;
+      GB_runFrame (gb);
+      frames++;
+
+      if (gb->speed != GB_SPEED_UNCAPPED) {
+         previous = Profiler_switch (gb->profiler, SUBSYSTEM_IDLE);
+         Pacer_waitForFrame (gb->pacer);
+         Profiler_switch (gb->profiler, previous);
+      }
+      if (Profiler_isEnabled (gb->profiler) &&
+          gb->cycles - reportCycles >= CLOCK_SPEED) {
+         Profiler_report (gb->profiler,
+                          (double)(gb->cycles - reportCycles) / CLOCK_SPEED);
+         reportCycles = gb->cycles;
+      }
+      if (frames == gb->frameLimit) {
+         gb->isRunning = FALSE;
+      }
+   }
+
+   /* How many frames a second were emulated, for comparing builds */
+   seconds = (double)Timer_getNanoseconds (timer) / TIMER_SECOND;
+   printf ("%ld frames in %.2lf s, %.2lf fps\n", frames, seconds,
+           frames / seconds);
+
+   Timer_free (timer);
+}
+
+int GB_runCycles (GB gb, int cycles) {
+   int cyclesRun = 0;
+   int cyclesWanted;
+   int budget;
+   int sliceCycles;
+   int gpuCycles;
+   long long deadline;
+
+   /* Make up for going over last time so calls stay in step with
+      the cycles asked for */
+   cyclesWanted = cycles - gb->overrun;
+
+   while (cyclesRun < cyclesWanted) {
+      /* Run the CPU straight up to the next event */
+      deadline = Scheduler_getNextTime (gb->scheduler);
+      budget = cyclesWanted - cyclesRun;
+      if (deadline - gb->cycles < budget) {
+         budget = (int)(deadline - gb->cycles);
+      }
+      if (gb->isGPUPolled && !gb->isHalted) {
+         /* Probably waiting for LY or the mode to change, stop when
+            it does so an idle loop can be picked up from the start */
+         gb->isGPUPolled = FALSE;
+         gpuCycles = GB_cyclesUntilNextEvent (gb);
+         if (gpuCycles < budget) {
+            budget = gpuCycles;
+         }
+      }
+      if (budget < 1) {
+         budget = 1;
       }
 
-      if (cyclesSoFar >= CLOCK_SPEED) {
-         /* delay */
-         cyclesSoFar = 0;
+      sliceCycles = GB_runSlice (gb, budget);
+      if (sliceCycles == 0) {
+         /* Opcode not implemented */
+         break;
       }
+      cyclesRun += sliceCycles;
+   }
 
-      cyclesSoFar += GB_handleInterrupts (gb); 
-      GPU_update (gb->gpu, cyclesThisIteration);
-      GB_handleTimers (gb, cyclesThisIteration);
+   gb->overrun = (cyclesRun > cyclesWanted) ? cyclesRun - cyclesWanted : 0;
 
-      GUI_update (gb->gui);
+   return cyclesRun;
+}
+
+int GB_runFrame (GB gb) {
+   return GB_runCycles (gb, FRAME_CYCLES);
+}
+
+long long GB_getCycles (GB gb) {
+   return GB_getCurrentCycle (gb);
+}
+
+int GB_step (GB gb) {
+   /* The shortest slice there is */
+   return GB_runSlice (gb, 1);
+}
+
+int GB_runSlice (GB gb, int budget) {
+   int cycles;
+   int interruptCycles;
+
+   if (!gb->isHalted) {
+      cycles = GB_runIdleLoop (gb, budget);
+      if (cycles == 0) {
+         cycles = CPU_run (gb->cpu, budget);
+      }
+   } else {
+      /* CPU is halted, execute NOPs */
+      cycles = (budget + 3) & ~3;
    }
+
+   gb->cycles += cycles;
+
+   /* Anything that happened part way through the slice is only seen
+      from here on */
+   GB_runEvents (gb);
+   interruptCycles = GB_handleInterrupts (gb); 
+
+   GB_updateGUI (gb);
+
+   gb->cycles += interruptCycles;
+   cycles += interruptCycles;
+
+   return cycles;
+}
+
+int GB_runIdleLoop (GB gb, int budget) {
+   word pc;
+   int bank;
+   int limit;
+   int cycles = 0;
+   int passes;
+   int skipped;
+
+   pc = CPU_get16bitRegisterValue (gb->cpu, PC);
+   if (!gb->idleSkipping) {
+      return 0;
+   }
+
+   /* Code in ROM only changes with the bank mapped there, anything
+      else may have been written since it was looked at */
+   if (pc < 0x4000) {
+      bank = Cartridge_getROMBank0 (gb->cartridge);
+   } else if (pc < 0x8000) {
+      bank = Cartridge_getROMBank (gb->cartridge);
+   } else {
+      bank = NO_BANK;
+   }
+
+   if (pc != gb->idleLoopHead || bank != gb->idleLoopBank ||
+       bank == NO_BANK) {
+      gb->idleLoopHead = pc;
+      gb->idleLoopBank = bank;
+      gb->idleLoopBranch = CPU_findIdleLoop (gb->cpu, gb->mmu, pc);
+      gb->isIdleLoop = (gb->idleLoopBranch != NO_IDLE_LOOP);
+   }
+
+   if (!gb->isIdleLoop) {
+      return 0;
+   }
+
+   /* An interrupt about to be taken, or let in by EI after the next
+      instruction, is left to CPU_run so it is taken on time */
+   if (CPU_isIMEPending (gb->cpu) ||
+       (CPU_getIME (gb->cpu) && MMU_getPendingInterrupts (gb->mmu))) {
+      return 0;
+   }
+
+   /* The loop may be polling the GPU, which doesn't have an event for
+      every change */
+   limit = GB_cyclesUntilNextEvent (gb);
+   if (limit < budget) {
+      budget = limit;
+   }
+
+   /* Nothing the loop reads changes until the end of the slice, so
+      once it has been round from the start every pass is the same */
+   do {
+      cycles += CPU_step (gb->cpu);
+      pc = CPU_get16bitRegisterValue (gb->cpu, PC);
+
+      if (CPU_getIME (gb->cpu) && MMU_getPendingInterrupts (gb->mmu)) {
+         /* Came up during the pass, the slice ends here to take it */
+         return cycles;
+      }
+   } while (pc > gb->idleLoopHead && pc <= gb->idleLoopBranch);
+
+   if (pc == gb->idleLoopHead) {
+      /* Up to the last pass that is over by the end of the slice, one
+         that runs past it may read something after it has changed */
+      passes = budget / cycles;
+      skipped = (passes - 1) * cycles;
+
+      if (skipped > 0) {
+         gb->skippedCycles += skipped;
+         gb->idleLoopSkips++;
+         cycles += skipped;
+      }
+   }
+
+   return cycles;
+}
+
+long long GB_getCurrentCycle (GB gb) {
+   return gb->cycles + CPU_getRunCycles (gb->cpu);
+}
+
+void GB_syncGPU (GB gb) {
+   subsystem previous;
+
+   previous = Profiler_switch (gb->profiler, SUBSYSTEM_GPU);
+
+   /* The GPU's own register accesses don't need it caught up */
+   gb->isGPUSyncing = TRUE;
+#ifdef GB_COROUTINES
+   Coroutine_switch (gb->cpuCoroutine, gb->gpuCoroutine);
+#else
+   GB_runGPU (gb);
+#endif
+   gb->isGPUSyncing = FALSE;
+
+   Profiler_switch (gb->profiler, previous);
+}
+
+void GB_runGPU (GB gb) {
+   int cycles;
+   long long now;
+
+   now = GB_getCurrentCycle (gb);
+   cycles = (int)(now - gb->gpuCycles);
+   gb->gpuCycles = now;
+
+   GPU_update (gb->gpu, cycles);
+   if (gb->isGPUWritten) {
+      /* Work the LCD status out again from the new registers */
+      GPU_update (gb->gpu, 0);
+   }
+}
+
+#ifdef GB_COROUTINES
+void GB_runGPUCoroutine (void *argument) {
+   GB gb = (GB)argument;
+
+   /* The CPU is stopped where it needs the GPU up to, and carries on
+      from there once it is */
+   for (;;) {
+      GB_runGPU (gb);
+      Coroutine_switch (gb->gpuCoroutine, gb->cpuCoroutine);
+   }
+}
+#endif
+
+void GB_scheduleGPU (GB gb) {
+   int cycles;
+   subsystem previous;
+
+   previous = Profiler_switch (gb->profiler, SUBSYSTEM_GPU);
+   cycles = GPU_cyclesUntilCatchUp (gb->gpu);
+   Profiler_switch (gb->profiler, previous);
+
+   if (gb->syncWindow > 0 && cycles > gb->syncWindow) {
+      cycles = gb->syncWindow;
+   }
+   if (cycles < 1) {
+      cycles = 1;
+   }
+   Scheduler_schedule (gb->scheduler, EVENT_GPU, gb->gpuCycles + cycles);
+
+   gb->isGPUWritten = FALSE;
+}
+
+void GB_catchUpGPU (GB gb) {
+   if (!gb->isGPUSyncing && GB_getCurrentCycle (gb) > gb->gpuCycles) {
+      GB_syncGPU (gb);
+   }
+}
+
+void GB_scheduleTimer (GB gb) {
+   if (testBit (MMU_getMemory (gb->mmu)[0xFF07], 2)) {
+      Scheduler_schedule (gb->scheduler, EVENT_TIMER,
+                          GB_getCurrentCycle (gb) +
+                          GB_cyclesUntilTimerOverflow (gb));
+   } else {
+      Scheduler_cancel (gb->scheduler, EVENT_TIMER);
+   }
+}
+
+void GB_scheduleSave (GB gb) {
+   if (gb->saveInterval > 0) {
+      Scheduler_schedule (gb->scheduler, EVENT_SAVE,
+                          GB_getCurrentCycle (gb) +
+                          (long long)gb->saveInterval * FRAME_CYCLES);
+   } else {
+      Scheduler_cancel (gb->scheduler, EVENT_SAVE);
+   }
+}
+
+void GB_runEvents (GB gb) {
+   int e;
+   subsystem previous;
+
+   while ((e = Scheduler_nextDueEvent (gb->scheduler, gb->cycles)) != NO_EVENT) {
+      if (e == EVENT_GPU) {
+         GB_syncGPU (gb);
+         GB_scheduleGPU (gb);
+      } else if (e == EVENT_TIMER) {
+         previous = Profiler_switch (gb->profiler, SUBSYSTEM_TIMER);
+         GB_updateTimer (gb);
+         GB_scheduleTimer (gb);
+         Profiler_switch (gb->profiler, previous);
+      } else if (e == EVENT_DMA) {
+         MMU_runDMA (gb->mmu);
+      } else if (e == EVENT_SAVE) {
+         Cartridge_flushRAM (gb->cartridge);
+         GB_scheduleSave (gb);
+      }
+   }
+
+   /* Written registers can move the next event either way */
+   if (gb->isGPUWritten) {
+      GB_syncGPU (gb);
+      GB_scheduleGPU (gb);
+   }
+}
+
+void GB_scheduleDMA (GB gb, long long end) {
+   Scheduler_schedule (gb->scheduler, EVENT_DMA, end);
+}
+
+void GB_notifyWrite (GB gb, int location) {
+   if ((location >= 0x8000 && location <= 0x9FFF) ||
+       (location >= 0xFE00 && location <= 0xFE9F)) {
+      /* Scanlines up to here are drawn from the old VRAM and OAM */
+      GB_catchUpGPU (gb);
+   } else if (location >= 0xFF40 && location <= 0xFF4B) {
+      /* And with the old LCD registers, which can also move the next
+         interrupt */
+      GB_catchUpGPU (gb);
+      if (!gb->isGPUSyncing) {
+         gb->isGPUWritten = TRUE;
+      }
+   }
+}
+
+void GB_notifyRead (GB gb, int location) {
+   /* STAT and LY */
+   GB_catchUpGPU (gb);
+   gb->isGPUPolled = TRUE;
+}
+
+void GB_notifyInterrupt (GB gb) {
+   if (CPU_getIME (gb->cpu) || gb->isHalted) {
+      CPU_requestExit (gb->cpu);
+   }
+}
+
+byte GB_readTimer (GB gb, int location) {
+   byte value;
+   subsystem previous;
+
+   previous = Profiler_switch (gb->profiler, SUBSYSTEM_TIMER);
+
+   if (location == 0xFF04) {
+      value = GB_getDividerCounter (gb) / (CLOCK_SPEED/TIMER_DIVIDER_FREQ);
+   } else if (location == 0xFF05) {
+      GB_updateTimer (gb);
+      value = gb->timerValue;
+   } else {
+      /* TMA and TAC */
+      value = MMU_getMemory (gb->mmu)[location];
+   }
+
+   Profiler_switch (gb->profiler, previous);
+
+   return value;
+}
+
+void GB_writeTimer (GB gb, int location, byte value) {
+   byte *memory;
+   byte timerControl;
+   int counter;
+   bool wasHigh, isHigh;
+   subsystem previous;
+
+   previous = Profiler_switch (gb->profiler, SUBSYSTEM_TIMER);
+
+   memory = MMU_getMemory (gb->mmu);
+   timerControl = memory[0xFF07];
+
+   /* Up to here ran under the old values */
+   GB_updateTimer (gb);
+
+   /* TIMA increments when its counter bit ANDed with the enable bit
+      goes from 1 to 0, which resetting DIV or changing TAC can do */
+   counter = GB_getDividerCounter (gb);
+   wasHigh = testBit (timerControl, 2) &&
+             (counter & (GB_getTimerPeriod (timerControl) / 2));
+
+   if (location == 0xFF04) {
+      /* Writing to the divider register resets the whole counter */
+      gb->dividerStart = GB_getCurrentCycle (gb);
+      isHigh = FALSE;
+   } else if (location == 0xFF07) {
+      memory[0xFF07] = value;
+      isHigh = testBit (value, 2) &&
+               (counter & (GB_getTimerPeriod (value) / 2));
+   } else {
+      if (location == 0xFF05) {
+         gb->timerValue = value;
+      } else {
+         memory[location] = value;
+      }
+      isHigh = wasHigh;
+   }
+
+   if (wasHigh && !isHigh) {
+      GB_incrementTimer (gb, 1);
+   }
+
+   GB_scheduleTimer (gb);
+
+   Profiler_switch (gb->profiler, previous);
+}
+
+int GB_cyclesUntilNextEvent (GB gb) {
+   int cycles;
+   int timerCycles;
+   int dmaCycles;
+
+   /* Needs to know where the GPU is up to */
+   GB_catchUpGPU (gb);
+
+   if ((CPU_getIME (gb->cpu) || gb->isHalted) &&
+       MMU_getPendingInterrupts (gb->mmu)) {
+      /* About to be interrupted or woken up */
+      cycles = 0;
+   } else {
+      cycles = GPU_cyclesUntilNextEvent (gb->gpu);
+      timerCycles = GB_cyclesUntilTimerOverflow (gb);
+
+      if (timerCycles < cycles) {
+         cycles = timerCycles;
+      }
+
+      /* Memory comes back when DMA finishes */
+      dmaCycles = MMU_cyclesUntilDMAEnds (gb->mmu);
+      if (dmaCycles >= 0 && dmaCycles < cycles) {
+         cycles = dmaCycles;
+      }
+   }
+
+   return cycles;
+}
+
+void GB_setIdleSkipping (GB gb, bool enabled) {
+   gb->idleSkipping = enabled;
+}
+
+long GB_getSkippedCycles (GB gb) {
+   return gb->skippedCycles;
+}
+
+long GB_getIdleLoopSkips (GB gb) {
+   return gb->idleLoopSkips;
+}
+
+void GB_setSpeed (GB gb, int speed) {
+   assert (speed >= 0);
+   gb->speed = speed;
+}
+
+void GB_setFrameSkip (GB gb, int frames) {
+   assert (frames > 0);
+   gb->frameSkip = frames;
+}
+
+void GB_setFrameLimit (GB gb, long frames) {
+   assert (frames >= 0);
+   gb->frameLimit = frames;
+}
+
+void GB_setSaveInterval (GB gb, int frames) {
+   assert (frames >= 0);
+   gb->saveInterval = frames;
+   GB_scheduleSave (gb);
+}
+
+void GB_setOfflineTime (GB gb, bool enabled) {
+   Cartridge_setOfflineTime (gb->cartridge, enabled);
+}
+
+void GB_setProfiling (GB gb, bool enabled) {
+   Profiler_setEnabled (gb->profiler, enabled);
+}
+
+void GB_setSyncWindow (GB gb, int cycles) {
+   assert (gb != NULL);
+   assert (cycles >= 0);
+
+   gb->syncWindow = cycles;
+   GB_scheduleGPU (gb);
+}
+
+void GB_updateGUI (GB gb) {
+   subsystem previous;
+
+   previous = Profiler_switch (gb->profiler, SUBSYSTEM_FRONTEND);
+   GUI_update (gb->gui);
+   Profiler_switch (gb->profiler, previous);
 }
 
 void GB_setRunning (GB gb, bool running) {
@@ -101,12 +799,8 @@ void GB_setRunning (GB gb, bool running) {
 }
 
 void GB_requestInterrupt (GB gb, int interrupt) {
-   byte IFRegister;
    assert (interrupt >= 0 && interrupt <= INT_JOYPAD);
-
-   IFRegister = MMU_readByte (gb->mmu, 0xFF0F);
-   setBit (&IFRegister, interrupt);
-   MMU_writeByte (gb->mmu, 0xFF0F, IFRegister);
+   MMU_requestInterrupt (gb->mmu, interrupt);
 }
 
 void GB_halt (GB gb) {
@@ -133,6 +827,30 @@ GUI GB_getGUI (GB gb) {
    return (gb->gui);
 }
 
+Pacer GB_getPacer (GB gb) {
+   assert (gb != NULL);
+   return (gb->pacer);
+}
+
+Profiler GB_getProfiler (GB gb) {
+   assert (gb != NULL);
+   return (gb->profiler);
+}
+
+#ifdef CPU_JIT
+JIT GB_getJIT (GB gb) {
+   assert (gb != NULL);
+   return (gb->jit);
+}
+#endif
+
+#ifdef CPU_DECODE_CACHE
+DecodeCache GB_getDecodeCache (GB gb) {
+   assert (gb != NULL);
+   return (gb->decodeCache);
+}
+#endif
+
 void GB_runBootSequence (GB gb) {
    byte *memory;
 
@@ -147,7 +865,7 @@ void GB_runBootSequence (GB gb) {
    memory = MMU_getMemory (gb->mmu);
 
    /* Initialise values in memory */
-   memory[0xFF05] = 0x00;
+   gb->timerValue = 0x00;
    memory[0xFF06] = 0x00;
    memory[0xFF07] = 0x00;
    memory[0xFF10] = 0x80;
@@ -169,104 +887,113 @@ void GB_runBootSequence (GB gb) {
    memory[0xFF25] = 0xF3;
    memory[0xFF26] = 0xF1;
    memory[0xFF40] = 0x91;
+   memory[0xFF41] = 0x85;
    memory[0xFF42] = 0x00;
    memory[0xFF43] = 0x00;
+   memory[0xFF44] = 0x00;
    memory[0xFF45] = 0x00;
    memory[0xFF47] = 0xFC;
    memory[0xFF48] = 0xFF;
    memory[0xFF49] = 0xFF;
    memory[0xFF4A] = 0x00;
    memory[0xFF4B] = 0x00;
-   memory[0xFFFF] = 0x00;
+   MMU_writeByte (gb->mmu, 0xFFFF, 0x00);
 }
 
 int GB_handleInterrupts (GB gb) {
    int cycles = 0;
-   byte IERegister; /* Tells us which interrupts are enabled */
-   byte IFRegister; /* Tells us which interrupts have been requested */
-
-   IERegister = MMU_readByte (gb->mmu, 0xFFFF);
-   IFRegister = MMU_readByte (gb->mmu, 0xFF0F);
-
-   /* If the Interrupt Master Enable flag is set */
-   if (CPU_getIME(gb->cpu)) {
-      if ((IERegister & 1) && (IFRegister & 1)) {
-         /* V-Blank */
-         gb->isHalted = FALSE;
-         cycles = CPU_executeInterrupt (gb->cpu, INT_VBLANK);
-      } else if ((IERegister & 2) && (IFRegister & 2)) {
-         /* LCD STAT */
-         gb->isHalted = FALSE;
-         cycles = CPU_executeInterrupt (gb->cpu, INT_LCDSTAT);
-      } else if ((IERegister & 4) && (IFRegister & 4)) {
-         /* Timer */
-         gb->isHalted = FALSE;
-         cycles = CPU_executeInterrupt (gb->cpu, INT_TIMER);
-      } else if ((IERegister & 8) && (IFRegister & 8)) {
-         /* Serial */
-         gb->isHalted = FALSE;
-         cycles = CPU_executeInterrupt (gb->cpu, INT_SERIAL);
-      } else if ((IERegister & 16) && (IFRegister & 16)) {
-         /* Joypad */
-         gb->isHalted = FALSE;
-         cycles = CPU_executeInterrupt (gb->cpu, INT_JOYPAD);
+   byte pending; /* Interrupts that are enabled and requested */
+   subsystem previous;
+
+   pending = MMU_getPendingInterrupts (gb->mmu);
+
+   if (pending) {
+      previous = Profiler_switch (gb->profiler, SUBSYSTEM_INTERRUPTS);
+
+      /* Any interrupt that is enabled and requested ends a HALT, even
+         when the IME is clear and it isn't serviced */
+      gb->isHalted = FALSE;
+
+      if (CPU_getIME (gb->cpu)) {
+         /* V-Blank, LCD STAT, timer, serial then joypad, which is the
+            order of their bits */
+         cycles = CPU_executeInterrupt (gb->cpu, lowestSetBit (pending));
       }
+
+      Profiler_switch (gb->profiler, previous);
    }
 
    return cycles;
 }
 
-void GB_handleTimers (GB gb, int cycles) {
-   byte *memory; /* We need direct memory access to change the 
-                    divider register */
+void GB_updateTimer (GB gb) {
+   byte timerControl;
+   long long period;
+   long long now;
 
-   byte timerControl; /* This tells us the status of the timer
-                         and the frequency */
+   now = GB_getCurrentCycle (gb);
 
-   static int dividerCounter = 0;
-   static int timerCounter = 0;
-   int frequencyIndex;
-   int dividerTimer;
-   int timer;
+   timerControl = MMU_getMemory (gb->mmu)[0xFF07];
 
-   memory = MMU_getMemory (gb->mmu);
+   if (testBit (timerControl, 2)) {
+      /* One increment for every falling edge of the counter bit since
+         TIMA was last brought up to date */
+      period = GB_getTimerPeriod (timerControl);
+      GB_incrementTimer (gb, (now - gb->dividerStart) / period -
+                             (gb->timerCycles - gb->dividerStart) / period);
+   }
+
+   gb->timerCycles = now;
+}
 
-   /* Get timer information */
-   timerControl = MMU_readByte (gb->mmu, 0xFF07);
-   dividerTimer = MMU_readByte (gb->mmu, 0xFF04);
-   timer = MMU_readByte (gb->mmu, 0xFF05);
-
-   /* Update the divider register */
-   dividerCounter += cycles;
-   while (dividerCounter >= (CLOCK_SPEED/TIMER_DIVIDER_FREQ)) {
-      /* Update the timer based on the cycles passed */
-      dividerTimer++;
-      dividerCounter -= (CLOCK_SPEED/TIMER_DIVIDER_FREQ);
-
-      if (dividerTimer > 0xFF) {
-         /* Overflow */
-         dividerTimer = 0;
+void GB_incrementTimer (GB gb, long long increments) {
+   byte modulo;
+
+   while (increments >= 0x100 - gb->timerValue) {
+      /* Overflow */
+      increments -= 0x100 - gb->timerValue;
+      modulo = MMU_getMemory (gb->mmu)[0xFF06];
+      gb->timerValue = modulo;
+      GB_requestInterrupt (gb, INT_TIMER);
+
+      if (modulo == 0xFF) {
+         /* Overflows on every increment, no need to go round for each */
+         increments = 0;
       }
    }
 
+   gb->timerValue += increments;
+}
+
+int GB_getDividerCounter (GB gb) {
+   return (int)((GB_getCurrentCycle (gb) - gb->dividerStart) & 0xFFFF);
+}
+
+int GB_getTimerPeriod (byte timerControl) {
+   return CLOCK_SPEED/timerFrequencies[timerControl & 3];
+}
+
+int GB_cyclesUntilTimerOverflow (GB gb) {
+   byte timerControl;
+   long long period;
+   long long elapsed;
+   int cycles;
+
+   timerControl = MMU_getMemory (gb->mmu)[0xFF07];
+
    if (testBit (timerControl, 2)) {
-      /* If the timer is enabled */
-      timerCounter += cycles;
-      frequencyIndex = ((timerControl & 1) << 1) | (timerControl & 0);
-
-      while (timerCounter >= (CLOCK_SPEED/timerFrequencies[frequencyIndex])) {
-         timer++;
-         timerCounter -= (CLOCK_SPEED/timerFrequencies[frequencyIndex]);
-
-         if (timer > 0xFF) {
-            /* Overflow */
-            timer = MMU_readByte (gb->mmu, 0xFF06);
-            GB_requestInterrupt (gb, INT_TIMER);   
-         }
-      }
+      GB_updateTimer (gb);
+
+      /* The increment that overflows is the (0x100 - TIMA)th falling
+         edge from here */
+      period = GB_getTimerPeriod (timerControl);
+      elapsed = GB_getCurrentCycle (gb) - gb->dividerStart;
+      cycles = (int)((elapsed / period + 0x100 - gb->timerValue) * period -
+                     elapsed);
+   } else {
+      /* Stopped */
+      cycles = CLOCK_SPEED;
    }
 
-   /* Write new timer values */
-   memory[0xFF04] = dividerTimer;
-   memory[0xFF05] = timer;
+   return cycles;
 }
@@ -6,6 +6,10 @@
 #include "MMU_type.h"
 #include "Cartridge_type.h"
 #include "GUI_type.h"
+#include "Pacer_type.h"
+#include "Profiler_type.h"
+#include "JIT_type.h"
+#include "DecodeCache_type.h"
 
 #include "types.h"
 
@@ -18,8 +22,99 @@ GB GB_init ();
 void GB_free (GB gb);
 
 void GB_loadRom (GB gb, const char *location);
+
+/* Runs frames at the speed set by GB_setSpeed until stopped, then
+   prints how many frames a second it managed */
 void GB_run (GB gb);
 
+/* Speed for GB_setSpeed that runs frames as fast as possible */
+#define GB_SPEED_UNCAPPED 0
+
+/* Sets GB_run to speed times a Game Boy's speed (1 by default) or to
+   GB_SPEED_UNCAPPED. Uncapped, only one frame in every frameSkip (10
+   by default) is drawn and shown. GB_run stops by itself after a
+   frame limit that isn't 0 (the default) */
+void GB_setSpeed (GB gb, int speed);
+void GB_setFrameSkip (GB gb, int frames);
+void GB_setFrameLimit (GB gb, long frames);
+
+/* Default frames between flushing the cartridge's battery backed RAM
+   to its save file, about a second */
+#define GB_SAVE_INTERVAL 60
+
+/* Sets how many frames of emulated time go between flushing battery
+   backed RAM to its save file, whether the GB is run by GB_run or a
+   frame or slice at a time. With 0 it is only written when the GB is
+   freed */
+void GB_setSaveInterval (GB gb, int frames);
+
+/* Whether a cartridge clock saved by an earlier run is moved on by
+   the host time since then when the ROM is loaded, so call it before
+   GB_loadRom. Off (the default) the clock only counts emulated
+   cycles, so a run is the same every time */
+void GB_setOfflineTime (GB gb, bool enabled);
+
+/* Turns on or off timing how much host time the CPU, GPU, timer,
+   interrupts and frontend take (see Profiler.h). While it is on
+   GB_run prints the split every emulated second */
+void GB_setProfiling (GB gb, bool enabled);
+
+/* Sets the most cycles the CPU runs ahead of the GPU before catching
+   it up, 0 (the default) to only catch it up when it is due to
+   change something or is used. Reads and writes of the GPU's
+   registers and memory still see it exactly up to date either way */
+void GB_setSyncWindow (GB gb, int cycles);
+
+/* Runs for at least the given number of cycles, or a frame's worth,
+   keeping the GPU, timers and interrupts in step only at the points
+   where something can happen (see Scheduler.h) rather than after every
+   instruction.
+   Anything run past the end is taken off the next call. Returns the
+   number of cycles run */
+int GB_runCycles (GB gb, int cycles);
+int GB_runFrame (GB gb);
+
+/* Gets the master clock: the number of cycles run since the GB was
+   created, up to the instruction in progress. Everything else (the
+   GPU, timers and scheduled events) is timed against it */
+long long GB_getCycles (GB gb);
+
+/* Runs the shortest slice there is: the next instruction (a pass of a
+   polling loop, or a NOP while halted) along with the GPU, timers and
+   interrupts. Returns the number of cycles used */
+int GB_step (GB gb);
+
+/* Gets the number of cycles until the next interrupt (or, while halted,
+   wake up), LY or LCD mode change, or timer overflow */
+int GB_cyclesUntilNextEvent (GB gb);
+
+/* Turns skipping idle time on or off (on by default): the passes of
+   polling loops that can't see anything change, up to the end of the
+   slice. Gets how many cycles and loops have been skipped */
+void GB_setIdleSkipping (GB gb, bool enabled);
+long GB_getSkippedCycles (GB gb);
+long GB_getIdleLoopSkips (GB gb);
+
+/* Called by the MMU on writes to VRAM, OAM and I/O and on reads of
+   STAT and LY, brings the GPU up to date before anything it depends
+   on changes or anything that depends on it is read */
+void GB_notifyWrite (GB gb, int location);
+void GB_notifyRead (GB gb, int location);
+
+/* Called by the MMU when an interrupt becomes both enabled and
+   requested, stops the CPU after the instruction it is on if the
+   interrupt is going to be taken or wake it */
+void GB_notifyInterrupt (GB gb);
+
+/* Called by the MMU when OAM DMA starts, to have it ended at the
+   given cycle */
+void GB_scheduleDMA (GB gb, long long end);
+
+/* Called by the MMU for the divider and timer registers (0xFF04 to
+   0xFF07), which are worked out from the cycle count when used */
+byte GB_readTimer (GB gb, int location);
+void GB_writeTimer (GB gb, int location, byte value);
+
 void GB_setRunning (GB gb, bool running);
 void GB_requestInterrupt (GB gb, int interrupt);
 
@@ -29,5 +124,13 @@ CPU GB_getCPU (GB gb);
 MMU GB_getMMU (GB gb);
 Cartridge GB_getCartridge (GB gb);
 GUI GB_getGUI (GB gb);
+Pacer GB_getPacer (GB gb);
+Profiler GB_getProfiler (GB gb);
+#ifdef CPU_JIT
+JIT GB_getJIT (GB gb);
+#endif
+#ifdef CPU_DECODE_CACHE
+DecodeCache GB_getDecodeCache (GB gb);
+#endif
 
 #endif
@@ -47,6 +47,13 @@ int getTileDataAddress (int lcdControl, int tileIndex);
    if necessary */
 void GPU_updateLCDStatus (GPU gpu);
 
+/* Gets the number of cycles from a point in a frame until LY or the
+   LCD mode next changes */
+int GPU_cyclesUntilChange (int line, int counter);
+
+/* Gets the LCD mode at a point in a frame */
+int GPU_getMode (int line, int counter);
+
 GPU GPU_init (GB gb) {
    GPU newGPU = (GPU)malloc(sizeof(struct GPU));
    assert (newGPU != NULL);
@@ -62,8 +69,141 @@ void GPU_free (GPU gpu) {
 }
 
 void GPU_update (GPU gpu, int cycles) {
-   GPU_updateScanline (gpu, cycles);
-   GPU_updateLCDStatus (gpu);
+   int step;
+
+   if (cycles > 0 && cycles < GPU_cyclesUntilNextEvent (gpu) &&
+       testBit (MMU_getMemory (GB_getMMU (gpu->gb))[0xFF40], 7)) {
+      /* Not far enough for anything to change */
+      gpu->scanlineCounter += cycles;
+      return;
+   }
+
+   /* Stop at every LY and mode change on the way, so however far
+      behind the GPU is each scanline is drawn and each interrupt
+      requested just as if it had been updated after every
+      instruction */
+   do {
+      step = GPU_cyclesUntilNextEvent (gpu);
+      if (step < 1 || step > cycles) {
+         step = cycles;
+      }
+
+      GPU_updateScanline (gpu, step);
+      GPU_updateLCDStatus (gpu);
+
+      cycles -= step;
+   } while (cycles > 0);
+}
+
+int GPU_cyclesUntilNextEvent (GPU gpu) {
+   byte *memory;
+   int cycles;
+
+   memory = MMU_getMemory (GB_getMMU (gpu->gb));
+
+   if (!testBit (memory[0xFF40], 7)) {
+      /* Nothing happens while the LCD is off, but don't leave it
+         too long before checking again */
+      cycles = SCANLINE_CYCLES;
+   } else {
+      cycles = GPU_cyclesUntilChange (memory[0xFF44], gpu->scanlineCounter);
+   }
+
+   if (cycles < 0) {
+      cycles = 0;
+   }
+
+   return cycles;
+}
+
+int GPU_cyclesUntilCatchUp (GPU gpu) {
+   byte *memory;
+   byte status;
+   int line, counter;
+   int mode, lastMode;
+   int cycles = 0;
+
+   memory = MMU_getMemory (GB_getMMU (gpu->gb));
+   status = memory[0xFF41];
+
+   if (!testBit (memory[0xFF40], 7)) {
+      /* Nothing happens until the LCD is turned back on, which
+         catches the GPU up anyway */
+      return FRAME_CYCLES;
+   }
+
+   line = memory[0xFF44];
+   counter = gpu->scanlineCounter;
+   lastMode = GPU_getMode (line, counter);
+
+   /* Walk through the changes to come the same way GPU_update would
+      until one of them requests an interrupt or starts or ends
+      V-Blank */
+   while (cycles < FRAME_CYCLES) {
+      cycles += GPU_cyclesUntilChange (line, counter);
+      counter += GPU_cyclesUntilChange (line, counter);
+
+      if (counter >= SCANLINE_CYCLES) {
+         counter -= SCANLINE_CYCLES;
+         line++;
+
+         if (line >= NUM_SCANLINES) {
+            /* End of the frame */
+            break;
+         } else if (line == NUM_VISIBLE_SCANLINES) {
+            /* V-Blank */
+            break;
+         } else if (line == memory[0xFF45] && testBit (status, 6)) {
+            /* Coincidence */
+            break;
+         }
+      }
+
+      mode = GPU_getMode (line, counter);
+      if (mode != lastMode &&
+          ((mode == 0 && testBit (status, 3)) ||
+           (mode == 2 && testBit (status, 5)))) {
+         /* H-Blank or OAM search */
+         break;
+      }
+      lastMode = mode;
+   }
+
+   return cycles;
+}
+
+int GPU_cyclesUntilChange (int line, int counter) {
+   int cycles;
+
+   if (line >= NUM_VISIBLE_SCANLINES) {
+      cycles = SCANLINE_CYCLES - counter;
+   } else if (counter <= 80) {
+      /* Mode 2 until the counter passes 80, then mode 3 until it
+         passes 172, see GPU_updateLCDStatus */
+      cycles = 81 - counter;
+   } else if (counter <= 172) {
+      cycles = 173 - counter;
+   } else {
+      cycles = SCANLINE_CYCLES - counter;
+   }
+
+   return cycles;
+}
+
+int GPU_getMode (int line, int counter) {
+   int mode;
+
+   if (line >= NUM_VISIBLE_SCANLINES) {
+      mode = 1;
+   } else if (counter <= 80) {
+      mode = 2;
+   } else if (counter <= 172) {
+      mode = 3;
+   } else {
+      mode = 0;
+   }
+
+   return mode;
 }
 
 void GPU_updateScanline (GPU gpu, int cycles) {
@@ -76,8 +216,11 @@ void GPU_updateScanline (GPU gpu, int cycles) {
    memory = MMU_getMemory (mmu);
 
    gpu->scanlineCounter += cycles;
-   currentLine = MMU_readByte (mmu, 0xFF44);
-   lcdControl = MMU_readByte (mmu, 0xFF40);
+
+   /* LY and LCDC are read from memory, only the CPU reading them
+      means it is waiting on the GPU */
+   currentLine = memory[0xFF44];
+   lcdControl = memory[0xFF40];
 
    if (testBit (lcdControl, 7)) {
       if (gpu->scanlineCounter >= SCANLINE_CYCLES) {
@@ -88,11 +231,14 @@ void GPU_updateScanline (GPU gpu, int cycles) {
 
          currentLine++;
          gpu->scanlineCounter -= SCANLINE_CYCLES;
+
+         if (currentLine == NUM_VISIBLE_SCANLINES) {
+            /* Once, on entering V-Blank */
+            GB_requestInterrupt (gpu->gb, INT_VBLANK);
+         }
       }
       
-      if (currentLine >= NUM_VISIBLE_SCANLINES) {
-         GB_requestInterrupt (gpu->gb, INT_VBLANK);
-      } else if (currentLine >= NUM_SCANLINES) {
+      if (currentLine >= NUM_SCANLINES) {
          currentLine = 0;
       }
 
@@ -101,12 +247,17 @@ void GPU_updateScanline (GPU gpu, int cycles) {
 }
 
 void GPU_drawScanline (GPU gpu) {
-   MMU mmu;
+   byte *memory;
    int currentLine;
 
-   mmu = GB_getMMU (gpu->gb);
+   if (!GUI_isFrameShown (GB_getGUI (gpu->gb))) {
+      /* Skipped, nothing would see it */
+      return;
+   }
 
-   currentLine = MMU_readByte (mmu, 0xFF44);
+   memory = MMU_getMemory (GB_getMMU (gpu->gb));
+
+   currentLine = memory[0xFF44];
 
    GPU_getPalette (gpu, PALETTE_BG);
    GPU_getPalette (gpu, PALETTE_OBJ0);
@@ -120,6 +271,7 @@ void GPU_drawBackground (GPU gpu) {
    GUI gui;
    MMU mmu;
    byte lcdControl;
+   byte *memory;
    Uint8 *pixels;
    int i;
    int currentLine;
@@ -137,15 +289,19 @@ void GPU_drawBackground (GPU gpu) {
    mmu = GB_getMMU (gpu->gb);
    gui = GB_getGUI (gpu->gb);
 
-   lcdControl = MMU_readByte (mmu, 0xFF40);
-   currentLine = MMU_readByte (mmu, 0xFF44);
+   /* Video RAM is read from memory rather than as the CPU would,
+      which OAM DMA can stop */
+   memory = MMU_getMemory (mmu);
+
+   lcdControl = memory[0xFF40];
+   currentLine = memory[0xFF44];
 
    pixels = GUI_getFramebuffer (gui);
 
    if (testBit (lcdControl, 0)) {
       /* If background display is enabled */
-      scrollX = MMU_readByte (mmu, 0xFF43);
-      scrollY = MMU_readByte (mmu, 0xFF42);
+      scrollX = memory[0xFF43];
+      scrollY = memory[0xFF42];
      
       /* Get the start tile information */
       verticalTileIndex = (scrollY+currentLine)/BG_TILE_HEIGHT;
@@ -167,14 +323,14 @@ void GPU_drawBackground (GPU gpu) {
          tileIndexLocation = 0x9C00+verticalTileIndex*BG_NUM_HORIZONTAL_TILES+horizontalTileIndex;
       }
 
-      tileIndex = MMU_readByte (mmu, tileIndexLocation);
+      tileIndex = memory[tileIndexLocation];
       
       /* Get tile information */
       tileDataAddress = getTileDataAddress (lcdControl, tileIndex);
 
       /* Read the bytes that contain the pixel data */
-      first = MMU_readByte (mmu, tileDataAddress + 2*tileVerticalOffset);
-      second = MMU_readByte (mmu, tileDataAddress + 2*tileVerticalOffset + 1);
+      first = memory[tileDataAddress + 2*tileVerticalOffset];
+      second = memory[tileDataAddress + 2*tileVerticalOffset + 1];
       
       framebufferIndex = currentLine*WINDOW_WIDTH;
 
@@ -198,12 +354,12 @@ void GPU_drawBackground (GPU gpu) {
                tileIndexLocation -= BG_NUM_HORIZONTAL_TILES;
             }
 
-            tileIndex = MMU_readByte (mmu, tileIndexLocation);
+            tileIndex = memory[tileIndexLocation];
 
             tileDataAddress = getTileDataAddress (lcdControl, tileIndex);
 
-            first = MMU_readByte (mmu, tileDataAddress + 2*tileVerticalOffset);
-            second = MMU_readByte (mmu, tileDataAddress + 2*tileVerticalOffset + 1);
+            first = memory[tileDataAddress + 2*tileVerticalOffset];
+            second = memory[tileDataAddress + 2*tileVerticalOffset + 1];
          }
 
          framebufferIndex++;
@@ -241,8 +397,8 @@ void GPU_drawSprites (GPU gpu) {
    memory = MMU_getMemory (mmu);
    pixels = GUI_getFramebuffer (gui);
 
-   lcdControl = MMU_readByte (mmu, 0xFF40);
-   currentLine = MMU_readByte (mmu, 0xFF44);
+   lcdControl = memory[0xFF40];
+   currentLine = memory[0xFF44];
 
    if (testBit (lcdControl, 1)) {
       /* If sprites are enabled */
@@ -267,8 +423,8 @@ void GPU_drawSprites (GPU gpu) {
             tileDataAddress = 0x8000 + (TILE_SIZE_BYTES*(spriteHeight/8)*(sprite.tileNumber));
 
             /* Read the bytes that contain the pixel data */
-            first = MMU_readByte (mmu, tileDataAddress + 2*tileVerticalOffset);
-            second = MMU_readByte (mmu, tileDataAddress + 2*tileVerticalOffset + 1);
+            first = memory[tileDataAddress + 2*tileVerticalOffset];
+            second = memory[tileDataAddress + 2*tileVerticalOffset + 1];
 
             for (j = BG_TILE_WIDTH-1; j >= 0; j--) {
                framebufferIndex = currentLine*WINDOW_WIDTH + sprite.xPos + (7-j);
@@ -295,24 +451,24 @@ void GPU_drawSprites (GPU gpu) {
 }
 
 void GPU_getPalette (GPU gpu, int type) {
-   MMU mmu;
+   byte *memory;
    byte paletteData;
    Uint8 *palette;
    GUI gui;
    int i;
    int curColourIndex;
 
-   mmu = GB_getMMU (gpu->gb);
+   memory = MMU_getMemory (GB_getMMU (gpu->gb));
    gui = GB_getGUI (gpu->gb);
    
    if (type == PALETTE_BG) {
-      paletteData = MMU_readByte (mmu, 0xFF47); 
+      paletteData = memory[0xFF47]; 
       palette = gpu->bgPalette;
    } else if (type == PALETTE_OBJ0) {
-      paletteData = MMU_readByte (mmu, 0xFF48); 
+      paletteData = memory[0xFF48]; 
       palette = gpu->objPalette0;
    } else if (type == PALETTE_OBJ1) {
-      paletteData = MMU_readByte (mmu, 0xFF49); 
+      paletteData = memory[0xFF49]; 
       palette = gpu->objPalette1;
    } else {
       palette = NULL;
@@ -379,12 +535,12 @@ void GPU_updateLCDStatus (GPU gpu) {
    bool requestInterrupt = FALSE;
 
    mmu = GB_getMMU (gpu->gb);
-   lcdControl = MMU_readByte (mmu, 0xFF40);
-   status = MMU_readByte (mmu, 0xFF41);
+   memory = MMU_getMemory (mmu);
+   lcdControl = memory[0xFF40];
+   status = memory[0xFF41];
 
    if (testBit (lcdControl, 7)) {
-      memory = MMU_getMemory (mmu);
-      currentLine = MMU_readByte (mmu, 0xFF44);
+      currentLine = memory[0xFF44];
       lastMode = status & 3;
       
       /* Update the LCD status register according to the current
@@ -419,12 +575,12 @@ void GPU_updateLCDStatus (GPU gpu) {
          GB_requestInterrupt (gpu->gb, INT_LCDSTAT);
       }
 
-      /* Update coincidence flag */
-      if (MMU_readByte (mmu, 0xFF44) == MMU_readByte (mmu, 0xFF45)) {
-         setBit (&status, 2);
-         if (testBit (status, 6)) {
+      /* Update coincidence flag, interrupting as it is set */
+      if (currentLine == memory[0xFF45]) {
+         if (!testBit (status, 2) && testBit (status, 6)) {
             GB_requestInterrupt (gpu->gb, INT_LCDSTAT);
          }
+         setBit (&status, 2);
       } else {
          clearBit (&status, 2);
       }
@@ -7,6 +7,7 @@
 #define NUM_VISIBLE_SCANLINES 144
 #define NUM_SCANLINES 154
 #define SCANLINE_CYCLES 456
+#define FRAME_CYCLES (SCANLINE_CYCLES * NUM_SCANLINES)
 
 #define BG_TILE_WIDTH 8
 #define BG_TILE_HEIGHT 8
@@ -31,4 +32,13 @@ GPU GPU_init (GB gb);
 void GPU_free (GPU gpu);
 void GPU_update (GPU gpu, int cycles);
 
+/* Gets the number of cycles until the GPU next changes LY or the LCD
+   mode, or requests an interrupt it isn't requesting already */
+int GPU_cyclesUntilNextEvent (GPU gpu);
+
+/* Gets the number of cycles the GPU can be left without being updated
+   before it requests an interrupt or starts or ends V-Blank, assuming
+   nothing it depends on changes */
+int GPU_cyclesUntilCatchUp (GPU gpu);
+
 #endif
@@ -1,3 +1,4 @@
+#include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 
@@ -9,6 +10,7 @@
 #include "GPU.h"
 #include "MMU.h"
 #include "Timer.h"
+#include "Pacer.h"
 
 #include "types.h"
 #include "bitOperations.h"
@@ -35,11 +37,16 @@ struct GUI {
    bool flippedThisFrame;
    bool keyDown[NUM_KEYS];
    int frameCount;
+
+   /* Frames since GUI_init, one in every frameSkip is shown */
+   long frameNumber;
+   int frameSkip;
 };
 
 void GUI_initPalette (GUI gui);
 void GUI_handleEvents (GUI gui);
 void GUI_updateJoypad (GUI gui);
+void GUI_printLateness (GUI gui);
 
 GUI GUI_init (GB gb) {
    int i;
@@ -49,6 +56,8 @@ GUI GUI_init (GB gb) {
    newGUI->gb = gb;
    newGUI->flippedThisFrame = FALSE;
    newGUI->frameCount = 0;
+   newGUI->frameNumber = 0;
+   newGUI->frameSkip = 1;
    newGUI->frameTimer = Timer_init ();
 
    for (i = 0; i < NUM_KEYS; i++) {
@@ -82,7 +91,10 @@ void GUI_update (GUI gui) {
    int currentLine;
 
    mmu = GB_getMMU (gui->gb);
-   currentLine = MMU_readByte (mmu, 0xFF44);
+
+   /* LY as the GPU last left it, it is always brought up to date at
+      the start and end of V-Blank, so don't make it catch up */
+   currentLine = MMU_getMemory (mmu)[0xFF44];
 
    /* Update screen */
 
@@ -92,14 +104,19 @@ void GUI_update (GUI gui) {
    
    if (currentLine >= NUM_VISIBLE_SCANLINES && !gui->flippedThisFrame) {
       /* Entered V-Blank, flip the SDL screen once */
-      SDL_Flip (gui->screen); 
+      if (GUI_isFrameShown (gui)) {
+         SDL_Flip (gui->screen); 
+      }
       gui->flippedThisFrame = TRUE;
       gui->frameCount++;
+      gui->frameNumber++;
 
       GUI_handleEvents (gui);
 
       if (Timer_getTicks (gui->frameTimer) >= 5000) {
-         printf ("fps = %.2lf\n", (double)(gui->frameCount)/5);
+         printf ("fps = %.2lf (%.2lfx)\n", (double)(gui->frameCount)/5,
+                 (double)(gui->frameCount)/5 * FRAME_CYCLES / CLOCK_SPEED);
+         GUI_printLateness (gui);
          gui->frameCount = 0;
          Timer_reset (gui->frameTimer);
       }
@@ -108,6 +125,18 @@ void GUI_update (GUI gui) {
    GUI_updateJoypad (gui);
 }
 
+void GUI_printLateness (GUI gui) {
+   Pacer pacer = GB_getPacer (gui->gb);
+
+   /* Only GB_run paces frames */
+   if (Pacer_getLateness (pacer, 100) >= 0) {
+      printf ("frames late by %lld/%lld/%lld us (median/99%%/worst)\n",
+              Pacer_getLateness (pacer, 50) / 1000,
+              Pacer_getLateness (pacer, 99) / 1000,
+              Pacer_getLateness (pacer, 100) / 1000);
+   }
+}
+
 void GUI_initPalette (GUI gui) {
    gui->colours[COLOUR_WHITE].r = 255;
    gui->colours[COLOUR_WHITE].g = 255;
@@ -217,3 +246,12 @@ void GUI_updateJoypad (GUI gui) {
 Uint8 * GUI_getFramebuffer (GUI gui) {
    return gui->screen->pixels;
 }
+
+void GUI_setFrameSkip (GUI gui, int frames) {
+   assert (frames > 0);
+   gui->frameSkip = frames;
+}
+
+bool GUI_isFrameShown (GUI gui) {
+   return (gui->frameNumber % gui->frameSkip == 0);
+}
@@ -17,4 +17,10 @@ void GUI_free (GUI gui);
 void GUI_update (GUI gui);
 Uint8 * GUI_getFramebuffer (GUI gui);
 
+/* Draws and shows only one frame in every frames, 1 shows them all */
+void GUI_setFrameSkip (GUI gui, int frames);
+
+/* Whether the frame being drawn is going to be shown */
+bool GUI_isFrameShown (GUI gui);
+
 #endif
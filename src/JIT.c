@@ -0,0 +1,879 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+
+#include "GB.h"
+#include "CPU.h"
+#include "CPU_state.h"
+#include "MMU.h"
+#include "JIT.h"
+
+#include "types.h"
+
+/*
+JIT
+
+Translates hot basic blocks of guest code into x86-64 machine code.
+Every guest instruction becomes either a few native instructions that
+work directly on the CPU register file (register loads, immediate
+loads, 16 bit increments and jumps) or a call to the interpreter
+function for that opcode, so translated code always does exactly what
+the interpreter does. Immediates are read at translation time and
+baked into the native code.
+
+Registers while translated code is running:
+   rbx   the CPU register file
+   r12d  cycles the CPU_run has used so far, stored to the CPU's run
+         cycles before each interpreter function so that its memory
+         accesses are timed from the start of its instruction
+   r13   pointer to the exit requested flag
+   r14   the CPU, passed on to interpreter functions
+   r15d  the run cycles the budget ends at
+
+A block ends at a jump, call or return, and before any instruction the
+interpreter has to run itself: HALT, STOP, EI and RETI, which hand
+control back to the GB, and I/O accesses. Exits with a known target are
+patched to jump straight into the target block once it has been
+translated, and are only taken while the budget has not been used up.
+
+Blocks are looked up by PC and, for 0x4000-0x7FFF, by the ROM bank that
+was mapped when they were translated, so a bank switch never runs code
+from the wrong bank. Blocks in 0x0000-0x3FFF are invalidated when
+MBC1 maps another bank there, and blocks in internal RAM by writes to
+the bytes they were translated from.
+*/
+
+#define JIT_CODE_SIZE              0x100000
+#define JIT_MAX_BLOCK_CODE         0x1000
+#define JIT_MAX_BLOCK_INSTRUCTIONS 32
+#define JIT_MAX_BLOCK_BYTES        (JIT_MAX_BLOCK_INSTRUCTIONS * 3)
+#define JIT_NUM_BUCKETS            0x1000
+
+/* Number of times the interpreter runs an address before it is translated */
+#define JIT_HOT_THRESHOLD          16
+
+/* Offsets of the registers in the register file (assumes little endian) */
+#define REG16_OFFSET(r)    ((r) * (int)sizeof(reg))
+#define REG_LOW_OFFSET(r)  (REG16_OFFSET(r))
+#define REG_HIGH_OFFSET(r) (REG16_OFFSET(r) + 1)
+
+#define FLAG_ZERO_MASK  (1 << FLAG_ZERO_BIT)
+#define FLAG_CARRY_MASK (1 << FLAG_CARRY_BIT)
+
+typedef enum region {
+   REGION_NONE,
+   REGION_ROM0,
+   REGION_ROMX,
+   REGION_WRAM,
+   REGION_HRAM
+} region;
+
+/* Signature of the stub that enters translated code */
+typedef int (*JITEntry)(reg *registers, CPU cpu, byte *exitRequested,
+                        int end, byte *code, int start);
+
+typedef struct JITBlock *JITBlock;
+
+typedef struct JITExit {
+   /* The jmp that gets patched to link this exit, and where it goes */
+   byte *jump;
+   word target;
+   JITBlock source;
+} JITExit;
+
+struct JITBlock {
+   word start;
+   word end;
+   int bank;
+   bool banked;
+
+   /* NULL if the first instruction has to be run by the interpreter */
+   byte *code;
+   byte *invalidateStub;
+
+   JITExit exits[2];
+   int numExits;
+
+   JITBlock next;
+};
+
+struct JIT {
+   GB gb;
+
+   byte *buffer;
+   int used;
+   int stubsSize;
+
+   JITEntry enter;
+   byte *leave;
+
+   JITBlock blocks[JIT_NUM_BUCKETS];
+   byte hotness[JIT_NUM_BUCKETS];
+
+   /* One bit per address in internal RAM that translated code came from */
+   byte codeMap[MAPPED_MEM_SIZE / 8];
+
+   byte exitRequested;
+   JITExit *lastExit;
+};
+
+/* Register file offsets of the 8 bit registers in the order they are
+   encoded in opcodes, (HL) has no offset */
+static const int reg8Offsets[8] = {
+   REG_HIGH_OFFSET(BC), REG_LOW_OFFSET(BC),
+   REG_HIGH_OFFSET(DE), REG_LOW_OFFSET(DE),
+   REG_HIGH_OFFSET(HL), REG_LOW_OFFSET(HL),
+   -1,                  REG_HIGH_OFFSET(AF)
+};
+
+/* Register pairs in the order they are encoded in opcodes */
+static const register16 reg16Pairs[4] = {BC, DE, HL, SP};
+
+#if defined(__x86_64__)
+
+#include <sys/mman.h>
+
+region JIT_getRegion (int address);
+int JIT_hash (word pc, int bank);
+JITBlock JIT_findBlock (JIT jit, word pc, int bank);
+JITBlock JIT_translate (JIT jit, word start, int bank, bool banked);
+bool JIT_isTranslatable (JIT jit, word pc, byte opcode, region startRegion);
+void JIT_link (JIT jit, JITExit *exit);
+void JIT_invalidateBlock (JIT jit, JITBlock block);
+void JIT_flush (JIT jit);
+void JIT_emitStubs (JIT jit);
+
+/* Machine code emitters */
+void JIT_emitByte (JIT jit, byte value);
+void JIT_emitWord (JIT jit, word value);
+void JIT_emit32 (JIT jit, unsigned int value);
+void JIT_emit64 (JIT jit, unsigned long long value);
+void JIT_emitJumpTo (JIT jit, byte *target);
+void JIT_patchJump (byte *jump, byte *target);
+void JIT_emitAddCycles (JIT jit, int cycles);
+void JIT_emitSetPC (JIT jit, word pc);
+void JIT_emitCall (JIT jit, CPU_instruction function);
+void JIT_emitUpdateFlags (JIT jit);
+void JIT_emitCheckExit (JIT jit);
+void JIT_emitLeave (JIT jit);
+void JIT_emitExit (JIT jit, JITBlock block, word target);
+
+JIT JIT_init (GB gb) {
+   JIT newJIT = (JIT)malloc(sizeof(struct JIT));
+   assert (newJIT != NULL);
+
+   newJIT->gb = gb;
+   newJIT->buffer = mmap (NULL, JIT_CODE_SIZE,
+                          PROT_READ | PROT_WRITE | PROT_EXEC,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+   if (newJIT->buffer == MAP_FAILED) {
+      fprintf (stderr, "Warning: no executable memory, JIT disabled\n");
+      free (newJIT);
+      return NULL;
+   }
+
+   memset (newJIT->blocks, 0, sizeof(newJIT->blocks));
+   memset (newJIT->hotness, 0, sizeof(newJIT->hotness));
+   memset (newJIT->codeMap, 0, sizeof(newJIT->codeMap));
+   newJIT->exitRequested = FALSE;
+   newJIT->lastExit = NULL;
+
+   newJIT->used = 0;
+   JIT_emitStubs (newJIT);
+   newJIT->stubsSize = newJIT->used;
+
+   return newJIT;
+}
+
+void JIT_free (JIT jit) {
+   if (jit != NULL) {
+      JIT_flush (jit);
+      munmap (jit->buffer, JIT_CODE_SIZE);
+      free (jit);
+   }
+}
+
+int JIT_run (JIT jit, CPU cpu, reg *registers, int budget) {
+   word pc = registers[PC].value;
+   region startRegion;
+   int bank = 0;
+   int hash;
+   int start;
+   int cycles;
+   JITBlock block;
+
+   if (jit == NULL) {
+      return 0;
+   }
+
+   startRegion = JIT_getRegion (pc);
+   if (startRegion == REGION_NONE) {
+      return 0;
+   } else if (startRegion == REGION_ROMX) {
+      bank = MMU_getROMBank (GB_getMMU (jit->gb));
+   }
+
+   block = JIT_findBlock (jit, pc, bank);
+   if (block == NULL) {
+      /* Leave code to the interpreter until it turns out to be hot */
+      hash = JIT_hash (pc, bank);
+      if (jit->hotness[hash] < JIT_HOT_THRESHOLD) {
+         jit->hotness[hash]++;
+         return 0;
+      }
+      jit->hotness[hash] = 0;
+
+      block = JIT_translate (jit, pc, bank, startRegion == REGION_ROMX);
+   }
+
+   if (block->code == NULL) {
+      return 0;
+   }
+
+   jit->exitRequested = FALSE;
+   jit->lastExit = NULL;
+   start = cpu->runCycles;
+   cycles = jit->enter (registers, cpu, &jit->exitRequested,
+                        start + budget, block->code, start) - start;
+   cpu->runCycles = start;
+
+   /* Link the exit the block left through, next time it can jump
+      straight into its target */
+   if (jit->lastExit != NULL) {
+      JIT_link (jit, jit->lastExit);
+   }
+
+   return cycles;
+}
+
+void JIT_notifyWrite (JIT jit, int location) {
+   int start;
+   JITBlock block;
+
+   if (jit == NULL || location >= MAPPED_MEM_SIZE) {
+      return;
+   }
+
+   if (location < 0x8000) {
+      /* MBC register, the rest of a block in 0x4000-0x7FFF
+         may no longer be mapped */
+      jit->exitRequested = TRUE;
+      return;
+   }
+
+   if (location >= 0xE000 && location < 0xFE00) {
+      /* Echo of internal RAM */
+      location -= 0x2000;
+   }
+
+   if ((jit->codeMap[location >> 3] & (1 << (location & 7))) == 0) {
+      return;
+   }
+
+   /* Blocks never span more than JIT_MAX_BLOCK_BYTES */
+   for (start = location - JIT_MAX_BLOCK_BYTES; start <= location; start++) {
+      if (start >= 0) {
+         block = JIT_findBlock (jit, start, 0);
+         if (block != NULL && block->end >= location) {
+            JIT_invalidateBlock (jit, block);
+         }
+      }
+   }
+
+   jit->exitRequested = TRUE;
+}
+
+void JIT_notifyROMBank0 (JIT jit) {
+   int i;
+   JITBlock block, next;
+
+   if (jit == NULL) {
+      return;
+   }
+
+   for (i = 0; i < JIT_NUM_BUCKETS; i++) {
+      block = jit->blocks[i];
+      while (block != NULL) {
+         next = block->next;
+         if (JIT_getRegion (block->start) == REGION_ROM0) {
+            JIT_invalidateBlock (jit, block);
+         }
+         block = next;
+      }
+   }
+
+   jit->exitRequested = TRUE;
+}
+
+void JIT_requestExit (JIT jit) {
+   if (jit != NULL) {
+      jit->exitRequested = TRUE;
+   }
+}
+
+region JIT_getRegion (int address) {
+   region r = REGION_NONE;
+
+   if (address < 0x4000) {
+      r = REGION_ROM0;
+   } else if (address < 0x8000) {
+      r = REGION_ROMX;
+   } else if (address >= 0xC000 && address < 0xE000) {
+      r = REGION_WRAM;
+   } else if (address >= 0xFF80 && address < 0xFFFF) {
+      r = REGION_HRAM;
+   }
+
+   return r;
+}
+
+int JIT_hash (word pc, int bank) {
+   return (pc ^ (bank << 7)) & (JIT_NUM_BUCKETS - 1);
+}
+
+JITBlock JIT_findBlock (JIT jit, word pc, int bank) {
+   JITBlock block = jit->blocks[JIT_hash (pc, bank)];
+
+   while (block != NULL && (block->start != pc || block->bank != bank)) {
+      block = block->next;
+   }
+
+   return block;
+}
+
+bool JIT_isTranslatable (JIT jit, word pc, byte opcode, region startRegion) {
+   MMU mmu = GB_getMMU (jit->gb);
+   bool translatable = TRUE;
+   word address;
+   int length = CPU_getInstructionLength (opcode);
+
+   if (JIT_getRegion (pc + length - 1) != startRegion) {
+      /* Instruction runs off the end of the region */
+      translatable = FALSE;
+   } else if (opcode == 0x10 || opcode == 0x76 ||
+              opcode == 0xD9 || opcode == 0xFB) {
+      /* STOP, HALT, RETI and EI hand control back to the GB */
+      translatable = FALSE;
+   } else if (opcode == 0xE0 || opcode == 0xF0 ||
+              opcode == 0xE2 || opcode == 0xF2) {
+      /* I/O */
+      translatable = FALSE;
+   } else if (opcode == 0xEA || opcode == 0xFA) {
+      address = MMU_readWord (mmu, pc + 1);
+      if (address >= 0xFF00 && address < 0xFF80) {
+         /* I/O */
+         translatable = FALSE;
+      }
+   } else if (opcode == 0xCB) {
+      translatable = (CPU_getInstruction (MMU_readByte (mmu, pc + 1), TRUE) != NULL);
+   } else {
+      translatable = (CPU_getInstruction (opcode, FALSE) != NULL);
+   }
+
+   return translatable;
+}
+
+JITBlock JIT_translate (JIT jit, word start, int bank, bool banked) {
+   MMU mmu = GB_getMMU (jit->gb);
+   JITBlock block;
+   byte opcode;
+   byte *notTaken;
+   region startRegion;
+   int address;
+   int numInstructions = 0;
+   int pendingCycles = 0;
+   int length;
+   int dest, src, mask;
+   bool done = FALSE;
+   word pc = start;
+   word next, target;
+
+   if (jit->used + JIT_MAX_BLOCK_CODE > JIT_CODE_SIZE) {
+      JIT_flush (jit);
+   }
+
+   block = (JITBlock)malloc(sizeof(struct JITBlock));
+   assert (block != NULL);
+
+   block->start = start;
+   block->bank = bank;
+   block->banked = banked;
+   block->code = jit->buffer + jit->used;
+   block->numExits = 0;
+
+   /* 5 byte nop, overwritten with a jump to the invalidate stub
+      when the block is invalidated */
+   JIT_emitByte (jit, 0x0F);
+   JIT_emitByte (jit, 0x1F);
+   JIT_emitByte (jit, 0x44);
+   JIT_emitByte (jit, 0x00);
+   JIT_emitByte (jit, 0x00);
+
+   startRegion = JIT_getRegion (start);
+
+   while (!done && numInstructions < JIT_MAX_BLOCK_INSTRUCTIONS) {
+      opcode = MMU_readByte (mmu, pc);
+      length = CPU_getInstructionLength (opcode);
+
+      if (!JIT_isTranslatable (jit, pc, opcode, startRegion)) {
+         break;
+      }
+
+      next = pc + length;
+
+      if (opcode == 0x00) {
+         /* NOP */
+         pendingCycles += 4;
+      } else if (opcode >= 0x40 && opcode <= 0x7F &&
+                 (opcode & 7) != 6 && ((opcode >> 3) & 7) != 6) {
+         /* LD r,r' */
+         dest = reg8Offsets[(opcode >> 3) & 7];
+         src = reg8Offsets[opcode & 7];
+         if (dest != src) {
+            /* mov al, [rbx+src]; mov [rbx+dest], al */
+            JIT_emitByte (jit, 0x8A);
+            JIT_emitByte (jit, 0x43);
+            JIT_emitByte (jit, src);
+            JIT_emitByte (jit, 0x88);
+            JIT_emitByte (jit, 0x43);
+            JIT_emitByte (jit, dest);
+         }
+         pendingCycles += 4;
+      } else if ((opcode & 0xC7) == 0x06 && opcode != 0x36) {
+         /* LD r,n: mov byte [rbx+dest], n */
+         JIT_emitByte (jit, 0xC6);
+         JIT_emitByte (jit, 0x43);
+         JIT_emitByte (jit, reg8Offsets[(opcode >> 3) & 7]);
+         JIT_emitByte (jit, MMU_readByte (mmu, pc + 1));
+         pendingCycles += 8;
+      } else if ((opcode & 0xCF) == 0x01) {
+         /* LD rr,nn: mov word [rbx+dest], nn */
+         JIT_emitByte (jit, 0x66);
+         JIT_emitByte (jit, 0xC7);
+         JIT_emitByte (jit, 0x43);
+         JIT_emitByte (jit, REG16_OFFSET(reg16Pairs[opcode >> 4]));
+         JIT_emitWord (jit, MMU_readWord (mmu, pc + 1));
+         pendingCycles += 12;
+      } else if ((opcode & 0xC7) == 0x03) {
+         /* INC rr/DEC rr: inc/dec word [rbx+dest] */
+         JIT_emitByte (jit, 0x66);
+         JIT_emitByte (jit, 0xFF);
+         JIT_emitByte (jit, (opcode & 0x08) ? 0x4B : 0x43);
+         JIT_emitByte (jit, REG16_OFFSET(reg16Pairs[opcode >> 4]));
+         pendingCycles += 8;
+      } else if (opcode == 0xF9) {
+         /* LD SP,HL: mov ax, [rbx+HL]; mov [rbx+SP], ax */
+         JIT_emitByte (jit, 0x66);
+         JIT_emitByte (jit, 0x8B);
+         JIT_emitByte (jit, 0x43);
+         JIT_emitByte (jit, REG16_OFFSET(HL));
+         JIT_emitByte (jit, 0x66);
+         JIT_emitByte (jit, 0x89);
+         JIT_emitByte (jit, 0x43);
+         JIT_emitByte (jit, REG16_OFFSET(SP));
+         pendingCycles += 8;
+      } else if (opcode == 0xC3 || opcode == 0x18) {
+         /* JP nn, JR n */
+         if (opcode == 0xC3) {
+            target = MMU_readWord (mmu, pc + 1);
+            pendingCycles += 12;
+         } else {
+            target = next + (signed_byte)MMU_readByte (mmu, pc + 1);
+            pendingCycles += 8;
+         }
+         JIT_emitAddCycles (jit, pendingCycles);
+         JIT_emitExit (jit, block, target);
+         done = TRUE;
+      } else if ((opcode & 0xE7) == 0xC2 || (opcode & 0xE7) == 0x20) {
+         /* JP cc,nn, JR cc,n */
+         if ((opcode & 0xE7) == 0xC2) {
+            target = MMU_readWord (mmu, pc + 1);
+            pendingCycles += 12;
+         } else {
+            target = next + (signed_byte)MMU_readByte (mmu, pc + 1);
+            pendingCycles += 8;
+         }
+         JIT_emitAddCycles (jit, pendingCycles);
+         JIT_emitUpdateFlags (jit);
+
+         /* test byte [rbx+F], mask */
+         mask = (opcode & 0x10) ? FLAG_CARRY_MASK : FLAG_ZERO_MASK;
+         JIT_emitByte (jit, 0xF6);
+         JIT_emitByte (jit, 0x43);
+         JIT_emitByte (jit, REG_LOW_OFFSET(AF));
+         JIT_emitByte (jit, mask);
+
+         /* Z and C are taken when the flag is set, NZ and NC when it
+            is clear: jz/jnz to the not taken exit */
+         JIT_emitByte (jit, 0x0F);
+         JIT_emitByte (jit, (opcode & 0x08) ? 0x84 : 0x85);
+         notTaken = jit->buffer + jit->used;
+         JIT_emit32 (jit, 0);
+
+         JIT_emitExit (jit, block, target);
+         JIT_patchJump (notTaken - 1, jit->buffer + jit->used);
+         JIT_emitExit (jit, block, next);
+         done = TRUE;
+      } else {
+         /* Everything else is left to the interpreter function */
+         JIT_emitAddCycles (jit, pendingCycles);
+         pendingCycles = 0;
+
+         JIT_emitSetPC (jit, pc);
+         if (opcode == 0xCB) {
+            JIT_emitCall (jit, CPU_getInstruction (MMU_readByte (mmu, pc + 1), TRUE));
+         } else {
+            JIT_emitCall (jit, CPU_getInstruction (opcode, FALSE));
+         }
+
+         if (opcode == 0xCD || (opcode & 0xC7) == 0xC7) {
+            /* CALL nn and RST go somewhere known */
+            target = (opcode == 0xCD) ? MMU_readWord (mmu, pc + 1) : (opcode & 0x38);
+            JIT_emitCheckExit (jit);
+            JIT_emitExit (jit, block, target);
+            done = TRUE;
+         } else if (opcode == 0xE9 || opcode == 0xC9 ||
+                    (opcode & 0xE7) == 0xC0 || (opcode & 0xE7) == 0xC4) {
+            /* JP (HL), RET, RET cc and CALL cc leave the new PC to
+               the interpreter function */
+            JIT_emitLeave (jit);
+            done = TRUE;
+         } else {
+            /* The instruction may have written to this block
+               or switched ROM banks */
+            JIT_emitCheckExit (jit);
+         }
+      }
+
+      pc = next;
+      numInstructions++;
+   }
+
+   if (numInstructions == 0) {
+      /* Remembered so the interpreter gets to run it straight away */
+      jit->used = block->code - jit->buffer;
+      block->code = NULL;
+      block->end = start;
+      block->invalidateStub = NULL;
+   } else {
+      if (!done) {
+         JIT_emitAddCycles (jit, pendingCycles);
+         JIT_emitExit (jit, block, pc);
+      }
+      block->end = pc - 1;
+
+      /* Entered through the patched entry of an invalidated block */
+      block->invalidateStub = jit->buffer + jit->used;
+      JIT_emitSetPC (jit, start);
+      JIT_emitLeave (jit);
+   }
+
+   assert (jit->used <= JIT_CODE_SIZE);
+
+   /* Add to the lookup table */
+   block->next = jit->blocks[JIT_hash (start, bank)];
+   jit->blocks[JIT_hash (start, bank)] = block;
+
+   if (startRegion == REGION_WRAM || startRegion == REGION_HRAM) {
+      for (address = block->start; address <= block->end; address++) {
+         jit->codeMap[address >> 3] |= (1 << (address & 7));
+      }
+   }
+
+   return block;
+}
+
+void JIT_link (JIT jit, JITExit *exit) {
+   JITBlock target;
+   int bank = 0;
+
+   if (JIT_getRegion (exit->target) == REGION_ROMX) {
+      /* Only blocks in the same bank may jump straight into the
+         switchable bank, anything else has to look up the bank
+         that is mapped when it gets there */
+      if (!exit->source->banked) {
+         return;
+      }
+      bank = exit->source->bank;
+   }
+
+   target = JIT_findBlock (jit, exit->target, bank);
+   if (target != NULL && target->code != NULL) {
+      JIT_patchJump (exit->jump, target->code);
+   }
+}
+
+void JIT_invalidateBlock (JIT jit, JITBlock block) {
+   JITBlock *link = &jit->blocks[JIT_hash (block->start, block->bank)];
+
+   while (*link != block) {
+      link = &(*link)->next;
+   }
+   *link = block->next;
+
+   if (block->code != NULL) {
+      /* Linked exits of other blocks still jump to the entry */
+      block->code[0] = 0xE9;
+      JIT_patchJump (block->code, block->invalidateStub);
+   }
+
+   free (block);
+}
+
+void JIT_flush (JIT jit) {
+   int i;
+   JITBlock block, next;
+
+   for (i = 0; i < JIT_NUM_BUCKETS; i++) {
+      block = jit->blocks[i];
+      while (block != NULL) {
+         next = block->next;
+         free (block);
+         block = next;
+      }
+      jit->blocks[i] = NULL;
+   }
+
+   memset (jit->codeMap, 0, sizeof(jit->codeMap));
+   jit->used = jit->stubsSize;
+}
+
+void JIT_emitStubs (JIT jit) {
+   byte *enter = jit->buffer + jit->used;
+   JITExit **lastExit = &jit->lastExit;
+
+   /* Enter: push rbx, r12-r15 (leaves the stack 16 byte aligned) */
+   JIT_emitByte (jit, 0x53);
+   JIT_emitByte (jit, 0x41);
+   JIT_emitByte (jit, 0x54);
+   JIT_emitByte (jit, 0x41);
+   JIT_emitByte (jit, 0x55);
+   JIT_emitByte (jit, 0x41);
+   JIT_emitByte (jit, 0x56);
+   JIT_emitByte (jit, 0x41);
+   JIT_emitByte (jit, 0x57);
+
+   /* mov rbx, rdi; mov r14, rsi; mov r13, rdx; mov r15d, ecx */
+   JIT_emitByte (jit, 0x48);
+   JIT_emitByte (jit, 0x89);
+   JIT_emitByte (jit, 0xFB);
+   JIT_emitByte (jit, 0x49);
+   JIT_emitByte (jit, 0x89);
+   JIT_emitByte (jit, 0xF6);
+   JIT_emitByte (jit, 0x49);
+   JIT_emitByte (jit, 0x89);
+   JIT_emitByte (jit, 0xD5);
+   JIT_emitByte (jit, 0x41);
+   JIT_emitByte (jit, 0x89);
+   JIT_emitByte (jit, 0xCF);
+
+   /* mov r12d, r9d; jmp r8 */
+   JIT_emitByte (jit, 0x45);
+   JIT_emitByte (jit, 0x89);
+   JIT_emitByte (jit, 0xCC);
+   JIT_emitByte (jit, 0x41);
+   JIT_emitByte (jit, 0xFF);
+   JIT_emitByte (jit, 0xE0);
+
+   /* Leave, rdx holds the exit taken: mov rcx, &lastExit; mov [rcx], rdx */
+   jit->leave = jit->buffer + jit->used;
+   JIT_emitByte (jit, 0x48);
+   JIT_emitByte (jit, 0xB9);
+   JIT_emit64 (jit, (unsigned long long)lastExit);
+   JIT_emitByte (jit, 0x48);
+   JIT_emitByte (jit, 0x89);
+   JIT_emitByte (jit, 0x11);
+
+   /* mov eax, r12d; pop r15-r12, rbx; ret */
+   JIT_emitByte (jit, 0x44);
+   JIT_emitByte (jit, 0x89);
+   JIT_emitByte (jit, 0xE0);
+   JIT_emitByte (jit, 0x41);
+   JIT_emitByte (jit, 0x5F);
+   JIT_emitByte (jit, 0x41);
+   JIT_emitByte (jit, 0x5E);
+   JIT_emitByte (jit, 0x41);
+   JIT_emitByte (jit, 0x5D);
+   JIT_emitByte (jit, 0x41);
+   JIT_emitByte (jit, 0x5C);
+   JIT_emitByte (jit, 0x5B);
+   JIT_emitByte (jit, 0xC3);
+
+   /* ISO C has no cast from data to function pointers */
+   memcpy (&jit->enter, &enter, sizeof(jit->enter));
+}
+
+void JIT_emitByte (JIT jit, byte value) {
+   jit->buffer[jit->used++] = value;
+}
+
+void JIT_emitWord (JIT jit, word value) {
+   JIT_emitByte (jit, value & 0xFF);
+   JIT_emitByte (jit, value >> 8);
+}
+
+void JIT_emit32 (JIT jit, unsigned int value) {
+   JIT_emitWord (jit, value & 0xFFFF);
+   JIT_emitWord (jit, value >> 16);
+}
+
+void JIT_emit64 (JIT jit, unsigned long long value) {
+   JIT_emit32 (jit, value & 0xFFFFFFFF);
+   JIT_emit32 (jit, value >> 32);
+}
+
+void JIT_emitJumpTo (JIT jit, byte *target) {
+   /* jmp rel32 */
+   JIT_emitByte (jit, 0xE9);
+   JIT_emit32 (jit, 0);
+   JIT_patchJump (jit->buffer + jit->used - 5, target);
+}
+
+void JIT_patchJump (byte *jump, byte *target) {
+   /* Rewrites the rel32 of the 5 byte jump at jump */
+   int offset = target - (jump + 5);
+   memcpy (jump + 1, &offset, sizeof(offset));
+}
+
+void JIT_emitAddCycles (JIT jit, int cycles) {
+   if (cycles > 0) {
+      /* add r12d, cycles */
+      JIT_emitByte (jit, 0x41);
+      JIT_emitByte (jit, 0x81);
+      JIT_emitByte (jit, 0xC4);
+      JIT_emit32 (jit, cycles);
+   }
+}
+
+void JIT_emitSetPC (JIT jit, word pc) {
+   /* mov word [rbx+PC], pc */
+   JIT_emitByte (jit, 0x66);
+   JIT_emitByte (jit, 0xC7);
+   JIT_emitByte (jit, 0x43);
+   JIT_emitByte (jit, REG16_OFFSET(PC));
+   JIT_emitWord (jit, pc);
+}
+
+void JIT_emitCall (JIT jit, CPU_instruction function) {
+   unsigned long long address;
+
+   memcpy (&address, &function, sizeof(address));
+
+   /* mov [r14+runCycles], r12d */
+   assert (offsetof(struct CPU, runCycles) < 0x80);
+   JIT_emitByte (jit, 0x45);
+   JIT_emitByte (jit, 0x89);
+   JIT_emitByte (jit, 0x66);
+   JIT_emitByte (jit, offsetof(struct CPU, runCycles));
+
+   /* mov rdi, r14; mov rax, function; call rax; add r12d, eax */
+   JIT_emitByte (jit, 0x4C);
+   JIT_emitByte (jit, 0x89);
+   JIT_emitByte (jit, 0xF7);
+   JIT_emitByte (jit, 0x48);
+   JIT_emitByte (jit, 0xB8);
+   JIT_emit64 (jit, address);
+   JIT_emitByte (jit, 0xFF);
+   JIT_emitByte (jit, 0xD0);
+   JIT_emitByte (jit, 0x41);
+   JIT_emitByte (jit, 0x01);
+   JIT_emitByte (jit, 0xC4);
+}
+
+void JIT_emitUpdateFlags (JIT jit) {
+#ifdef CPU_LAZY_FLAGS
+   void (*function)(CPU) = &CPU_updateFlags;
+   unsigned long long address;
+
+   memcpy (&address, &function, sizeof(address));
+
+   /* mov rdi, r14; mov rax, CPU_updateFlags; call rax */
+   JIT_emitByte (jit, 0x4C);
+   JIT_emitByte (jit, 0x89);
+   JIT_emitByte (jit, 0xF7);
+   JIT_emitByte (jit, 0x48);
+   JIT_emitByte (jit, 0xB8);
+   JIT_emit64 (jit, address);
+   JIT_emitByte (jit, 0xFF);
+   JIT_emitByte (jit, 0xD0);
+#endif
+}
+
+void JIT_emitCheckExit (JIT jit) {
+   /* cmp byte [r13], 0; je over the leave */
+   JIT_emitByte (jit, 0x41);
+   JIT_emitByte (jit, 0x80);
+   JIT_emitByte (jit, 0x7D);
+   JIT_emitByte (jit, 0x00);
+   JIT_emitByte (jit, 0x00);
+   JIT_emitByte (jit, 0x74);
+   JIT_emitByte (jit, 0x07);
+   JIT_emitLeave (jit);
+}
+
+void JIT_emitLeave (JIT jit) {
+   /* xor edx, edx; jmp leave (7 bytes) */
+   JIT_emitByte (jit, 0x31);
+   JIT_emitByte (jit, 0xD2);
+   JIT_emitJumpTo (jit, jit->leave);
+}
+
+void JIT_emitExit (JIT jit, JITBlock block, word target) {
+   JITExit *exit;
+   unsigned long long address;
+
+   assert (block->numExits < 2);
+   exit = &block->exits[block->numExits++];
+   exit->target = target;
+   exit->source = block;
+
+   JIT_emitSetPC (jit, target);
+
+   /* cmp r12d, r15d; jge over the link */
+   JIT_emitByte (jit, 0x45);
+   JIT_emitByte (jit, 0x39);
+   JIT_emitByte (jit, 0xFC);
+   JIT_emitByte (jit, 0x7D);
+   JIT_emitByte (jit, 0x05);
+
+   /* The link, a jmp to the next instruction until it is patched */
+   exit->jump = jit->buffer + jit->used;
+   JIT_emitByte (jit, 0xE9);
+   JIT_emit32 (jit, 0);
+
+   /* mov rdx, exit; jmp leave */
+   address = (unsigned long long)exit;
+   JIT_emitByte (jit, 0x48);
+   JIT_emitByte (jit, 0xBA);
+   JIT_emit64 (jit, address);
+   JIT_emitJumpTo (jit, jit->leave);
+}
+
+#else
+
+/* Translated code is x86-64 only, everything runs in the interpreter */
+
+JIT JIT_init (GB gb) {
+   return NULL;
+}
+
+void JIT_free (JIT jit) {
+}
+
+int JIT_run (JIT jit, CPU cpu, reg *registers, int budget) {
+   return 0;
+}
+
+void JIT_notifyWrite (JIT jit, int location) {
+}
+
+void JIT_notifyROMBank0 (JIT jit) {
+}
+
+void JIT_requestExit (JIT jit) {
+}
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef _JIT_H_
+#define _JIT_H_
+
+#include "GB_type.h"
+#include "CPU_type.h"
+#include "JIT_type.h"
+
+#include "CPU.h"
+#include "types.h"
+
+/* Constructor and Destructor, JIT_init returns NULL when translated
+   code can't be run on this host (not x86-64, or no executable memory) */
+JIT JIT_init (GB gb);
+void JIT_free (JIT jit);
+
+/* Runs the translated block starting at the current PC, following
+   linked blocks while fewer than budget cycles have been used.
+   Returns the number of cycles used, or 0 if the interpreter has to
+   run the next instruction instead */
+int JIT_run (JIT jit, CPU cpu, reg *registers, int budget);
+
+/* Called by the MMU on every write, invalidates translated code the
+   write lands on and makes the running block hand back control */
+void JIT_notifyWrite (JIT jit, int location);
+
+/* Called by the MMU when another ROM bank is mapped at 0x0000-0x3FFF,
+   invalidates the code translated from the old one */
+void JIT_notifyROMBank0 (JIT jit);
+
+/* Makes the running block hand back control after the instruction
+   it is on */
+void JIT_requestExit (JIT jit);
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef _JIT_TYPE_H_
+#define _JIT_TYPE_H_
+
+typedef struct JIT *JIT;
+
+#endif
@@ -1,37 +1,134 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 #include "GB.h"
 #include "Cartridge.h"
 #include "MMU.h"
+#ifdef CPU_JIT
+#include "JIT.h"
+#endif
+#ifdef CPU_DECODE_CACHE
+#include "DecodeCache.h"
+#endif
 
 #include "types.h"
 
+/*
+Memory Map
+
+Reads and writes look up the top byte of the address in a table of
+where each 256 byte page is in host memory and go straight there, so
+most of them (opcode fetches from ROM especially) cost a shift and two
+loads. Pages that can't be accessed directly, because the access has
+side effects or the page isn't mapped yet, are NULL in the table and
+go through MMU_readUnmapped and MMU_writeUnmapped. That covers the
+I/O page, writes to ROM (the cartridge's bank controller), external
+RAM while no bank is mapped, and video RAM and OAM writes (which the
+GPU may need catching up for). Switching banks just points the bank's
+pages somewhere else.
+
+Work RAM is only kept at 0xC000-0xDFFF. Its echo at 0xE000-0xFDFF is
+the same pages mapped a second time, so there is nothing to keep in
+step and memory at 0xE000-0xFDFF is never used.
+
+OAM DMA copies 0xA0 bytes to OAM, one every M-cycle, and the CPU can
+only use the 0xFF00 page (HRAM and the I/O registers) while it does.
+The GPU reads video RAM and OAM from memory, so it isn't held up.
+For the length of the transfer the pages below 0xFF00 are taken out
+of the tables and kept aside, so the CPU's accesses all come through
+MMU_readUnmapped and MMU_writeUnmapped without the fast path having
+to check for it. The source is read through the kept pages, the same
+memory map the CPU would see. Normally the whole copy is done as soon
+as 0xFF46 is written and only the CPU's accesses are held up. Built
+with ACCURATE=1, the bytes are copied as the cycles they go at pass,
+and only accesses on the same bus as the source (video RAM, or the
+cartridge and work RAM) or to OAM are affected: reads see the byte
+being copied, or 0xFF in OAM, and writes are lost.
+*/
+
 struct MMU {
    GB gb;  
 
    /* Mapped memory */
    byte memory[MAPPED_MEM_SIZE];
 
-   byte RAMBanks[0x8000];
+   /* Where each page is for reading and writing, NULL if it has to
+      go through MMU_readUnmapped or MMU_writeUnmapped */
+   byte *readPages[MMU_NUM_PAGES];
+   byte *writePages[MMU_NUM_PAGES];
 
-   /* The current switchable ROM and RAM bank numbers */
-   int currentROMBank;
-   int currentRAMBank;
-   bool externalRAMEnabled;
-   int ROMRAMMode;
+   /* IE & IF for the five interrupts */
+   byte pendingInterrupts;
+
+   /* The OAM DMA in progress: where from, the cycle it copies the
+      first byte at and how many it has copied. While it runs the
+      pages below 0xFF00 are kept here instead of in the tables */
+   bool isDMAActive;
+   int dmaSource;
+   long long dmaStart;
+   int dmaCopied;
+   byte *dmaReadPages[MMU_NUM_PAGES - 1];
+   byte *dmaWritePages[MMU_NUM_PAGES - 1];
 };
 
+/* Points the pages from start up to end (exclusive) at consecutive
+   pages of host memory from host, or at NULL */
+void MMU_mapPages (byte **pages, int start, int end, byte *host);
+
+/* The page tables the memory map is kept in, which are put aside
+   during OAM DMA */
+byte ** MMU_getReadPages (MMU mmu);
+byte ** MMU_getWritePages (MMU mmu);
+
+/* Reads and writes that can't go straight to a page */
+byte MMU_readUnmapped (MMU mmu, int location);
+void MMU_writeUnmapped (MMU mmu, int location, byte byteToWrite);
+
+/* Works out IE & IF again after either is written */
+void MMU_updatePendingInterrupts (MMU mmu);
+
+/* Starts OAM DMA from the given page */
+void MMU_startDMA (MMU mmu, byte page);
+
+/* Copies the source up to byte end to OAM */
+void MMU_copyDMA (MMU mmu, int end);
+
+/* Whether an access to location below 0xFF00 conflicts with the DMA
+   in progress, and the value a conflicting read sees */
+bool MMU_isDMAConflict (MMU mmu, int location);
+byte MMU_readDMAConflict (MMU mmu, int location);
+
 MMU MMU_init (GB gb) {
    MMU newMMU = (MMU)malloc(sizeof(struct MMU));
    assert (newMMU != NULL);
 
    newMMU->gb = gb;
-   newMMU->currentROMBank = 1;
-   newMMU->currentRAMBank = 0;
-   newMMU->externalRAMEnabled = FALSE;
-   newMMU->ROMRAMMode = 0;
+   newMMU->pendingInterrupts = 0;
+   newMMU->isDMAActive = FALSE;
+
+   /* Registers the boot sequence doesn't set (and the unused ones)
+      start out the same every time */
+   memset (newMMU->memory, 0, sizeof(newMMU->memory));
+
+   /* Video RAM, work RAM and its echo, and OAM read straight from
+      memory, the cartridge's banks aren't mapped until it is loaded
+      and the I/O page never is. Only work RAM is written straight to */
+   MMU_mapPages (newMMU->readPages, 0x0000, 0x10000, NULL);
+   MMU_mapPages (newMMU->readPages, 0x8000, 0xA000,
+                 &newMMU->memory[0x8000]);
+   MMU_mapPages (newMMU->readPages, 0xC000, 0xE000,
+                 &newMMU->memory[0xC000]);
+   MMU_mapPages (newMMU->readPages, 0xE000, 0xFE00,
+                 &newMMU->memory[0xC000]);
+   MMU_mapPages (newMMU->readPages, 0xFE00, 0xFF00,
+                 &newMMU->memory[0xFE00]);
+   MMU_mapPages (newMMU->writePages, 0x0000, 0x10000, NULL);
+   MMU_mapPages (newMMU->writePages, 0xC000, 0xE000,
+                 &newMMU->memory[0xC000]);
+   MMU_mapPages (newMMU->writePages, 0xE000, 0xFE00,
+                 &newMMU->memory[0xC000]);
 
    return newMMU;
 }
@@ -40,24 +137,91 @@ void MMU_free (MMU mmu) {
    free (mmu);
 }
 
+void MMU_mapROM (MMU mmu, byte *bank0, byte *bank) {
+   if (MMU_getReadPages (mmu)[0] != bank0) {
+#ifdef CPU_JIT
+      /* Code translated from 0x0000-0x3FFF is only looked up by PC */
+      JIT_notifyROMBank0 (GB_getJIT (mmu->gb));
+#endif
+#ifdef CPU_DECODE_CACHE
+      DecodeCache_notifyROMBank0 (GB_getDecodeCache (mmu->gb));
+#endif
+   }
+
+   MMU_mapPages (MMU_getReadPages (mmu), 0x0000, 0x4000, bank0);
+   MMU_mapPages (MMU_getReadPages (mmu), 0x4000, 0x8000, bank);
+}
+
+void MMU_mapRAM (MMU mmu, byte *bank) {
+   MMU_mapPages (MMU_getReadPages (mmu), 0xA000, 0xC000, bank);
+   MMU_mapPages (MMU_getWritePages (mmu), 0xA000, 0xC000, bank);
+}
+
+byte ** MMU_getReadPages (MMU mmu) {
+   return mmu->isDMAActive ? mmu->dmaReadPages : mmu->readPages;
+}
+
+byte ** MMU_getWritePages (MMU mmu) {
+   return mmu->isDMAActive ? mmu->dmaWritePages : mmu->writePages;
+}
+
+void MMU_mapPages (byte **pages, int start, int end, byte *host) {
+   int page;
+
+   for (page = start / MMU_PAGE_SIZE; page < end / MMU_PAGE_SIZE; page++) {
+      pages[page] = host;
+      if (host != NULL) {
+         host += MMU_PAGE_SIZE;
+      }
+   }
+}
+
 byte MMU_readByte (MMU mmu, int location) {
+   byte *page = mmu->readPages[location >> 8];
+
+   if (page != NULL) {
+      return page[location & 0xFF];
+   }
+
+   return MMU_readUnmapped (mmu, location);
+}
+
+byte MMU_readUnmapped (MMU mmu, int location) {
    byte *bankData;
+   byte *page;
    byte value;
    Cartridge cartridge;
-   
-   if (location >= 0 && location <= 0x3FFF) {
-      cartridge = GB_getCartridge (mmu->gb); 
-      bankData = Cartridge_getData (cartridge, 0);
 
-      value = bankData[location];
+   if (mmu->isDMAActive) {
+      MMU_runDMA (mmu);
+   }
+   if (mmu->isDMAActive && location < 0xFF00) {
+      /* Kept aside while DMA runs */
+      if (MMU_isDMAConflict (mmu, location)) {
+         return MMU_readDMAConflict (mmu, location);
+      }
+      page = mmu->dmaReadPages[location >> 8];
+      if (page != NULL) {
+         return page[location & 0xFF];
+      }
+   }
 
-   } else if (location >= 0x4000 && location <= 0x7FFF) {
+   if (location >= 0 && location <= 0x7FFF) {
+      /* ROM is always mapped once there is any */
       cartridge = GB_getCartridge (mmu->gb); 
-      bankData = Cartridge_getData (cartridge, mmu->currentROMBank);
+      bankData = Cartridge_getData (cartridge, 0);
 
-      value = bankData[location-0x4000];
+      value = bankData[location];
    } else if (location >= 0xA000 && location <= 0xBFFF) {
-      value = mmu->RAMBanks[(0x2000 * mmu->currentRAMBank) + (location-0xA000)];
+      /* External RAM that isn't simply a bank */
+      value = Cartridge_readRAM (GB_getCartridge (mmu->gb), location);
+   } else if (location == 0xFF04 || location == 0xFF05) {
+      /* The divider and timer are worked out when they are read */
+      value = GB_readTimer (mmu->gb, location);
+   } else if (location == 0xFF41 || location == 0xFF44) {
+      /* So is where the GPU is up to */
+      GB_notifyRead (mmu->gb, location);
+      value = mmu->memory[location];
    } else {
       value = mmu->memory[location];
    }
@@ -66,67 +230,202 @@ byte MMU_readByte (MMU mmu, int location) {
 }
 
 void MMU_writeByte (MMU mmu, int location, byte byteToWrite) {
-   Cartridge cartridge;
-   int i, address;
+   byte *page;
 
-   cartridge = GB_getCartridge (mmu->gb);
-   
-   if (location >= 0x0000 && location <= 0x1FFF) {
-      /* External RAM enable */ 
-      if ((byteToWrite & 0x0F) == 0x0A) {
-         mmu->externalRAMEnabled = TRUE;
-      } else {
-         mmu->externalRAMEnabled = FALSE;
+#ifdef CPU_JIT
+   /* Translated code may have come from here */
+   JIT_notifyWrite (GB_getJIT (mmu->gb), location);
+#endif
+#ifdef CPU_DECODE_CACHE
+   /* So may decoded instructions */
+   DecodeCache_notifyWrite (GB_getDecodeCache (mmu->gb), location);
+#endif
+
+   page = mmu->writePages[location >> 8];
+   if (page != NULL) {
+      page[location & 0xFF] = byteToWrite;
+   } else {
+      MMU_writeUnmapped (mmu, location, byteToWrite);
+   }
+}
+
+void MMU_writeUnmapped (MMU mmu, int location, byte byteToWrite) {
+   byte *page;
+
+   if (mmu->isDMAActive) {
+      MMU_runDMA (mmu);
+   }
+   if (mmu->isDMAActive && location < 0xFF00) {
+      /* Kept aside while DMA runs */
+      if (MMU_isDMAConflict (mmu, location)) {
+         return;
       }
-   } else if (location >= 0x2000 && location <= 0x3FFF) {
-      /* ROM Bank number change */
-      if (byteToWrite == 0) {
-         mmu->currentROMBank = 1; 
-      } else {
-         mmu->currentROMBank = byteToWrite;
+      page = mmu->dmaWritePages[location >> 8];
+      if (page != NULL) {
+         page[location & 0xFF] = byteToWrite;
+         return;
       }
-   } else if (location >= 0x4000 && location <= 0x5FFF) {
-      /* RAM Bank number change */
-     assert (byteToWrite <= 3);
-     if (mmu->ROMRAMMode) {
-        mmu->currentRAMBank = byteToWrite;
-     } else {
-        mmu->currentROMBank |= (byteToWrite << 5);
-     }
-   } else if (location >= 0x6000 && location <= 0x7FFF) {
-      /* ROM/RAM Mode select */
-      assert (byteToWrite == 0 || byteToWrite == 1);
-      mmu->ROMRAMMode = byteToWrite;
+   }
+
+   if ((location >= 0x8000 && location <= 0x9FFF) || location >= 0xFE00) {
+      /* The GPU may need catching up before the write */
+      GB_notifyWrite (mmu->gb, location);
+   }
+   
+   if (location >= 0x0000 && location <= 0x7FFF) {
+      /* The cartridge's bank controller */
+      Cartridge_writeControl (GB_getCartridge (mmu->gb), location,
+                              byteToWrite);
    } else if (location >= 0xA000 && location <= 0xBFFF) {
-      mmu->RAMBanks[(0x2000 * mmu->currentRAMBank) + (location-0xA000)] = byteToWrite;
-   } else if (location >= 0xC000 && location <= 0xDE00) {
-      /* Echo of RAM */
+      Cartridge_writeRAM (GB_getCartridge (mmu->gb), location, byteToWrite);
+   } else if (location >= 0xFF04 && location <= 0xFF07) {
+      /* Divider and timer registers, writing to the divider resets it
+         to zero */
+      GB_writeTimer (mmu->gb, location, byteToWrite);
+   } else if (location == 0xFF0F || location == 0xFFFF) {
+      /* Interrupt flags and enable */
       mmu->memory[location] = byteToWrite;
-      mmu->memory[location+0x2000] = byteToWrite;
-   } else if (location >= 0xE000 && location <= 0xFE00) {
-      /* Echo of RAM */
-      mmu->memory[location] = byteToWrite;
-      mmu->memory[location-0x2000] = byteToWrite;
-   } else if (location == 0xFF04) {
-      /* Writing to the divider register, which resets it to zero */
-      mmu->memory[location]= 0;
+      MMU_updatePendingInterrupts (mmu);
    } else if (location == 0xFF44) {
       /* Writing to the scanline register, which resets it to zero */
       mmu->memory[location] = 0;
    } else if (location == 0xFF46) {
-      /* DMA transfer */
-      address = byteToWrite * 0x100;      
-      for (i = 0; i <= 0x9F; i++) {
-         mmu->memory[0xFE00+i] = mmu->memory[address+i];
-      }
+      /* OAM DMA */
+      mmu->memory[location] = byteToWrite;
+      MMU_startDMA (mmu, byteToWrite);
    } else {
       mmu->memory[location] = byteToWrite;
    }
 }
 
+void MMU_startDMA (MMU mmu, byte page) {
+   if (mmu->isDMAActive) {
+      /* Starting again cuts the one in progress short */
+      MMU_runDMA (mmu);
+   } else {
+      memcpy (mmu->dmaReadPages, mmu->readPages, sizeof(mmu->dmaReadPages));
+      memcpy (mmu->dmaWritePages, mmu->writePages,
+              sizeof(mmu->dmaWritePages));
+      MMU_mapPages (mmu->readPages, 0x0000, 0xFF00, NULL);
+      MMU_mapPages (mmu->writePages, 0x0000, 0xFF00, NULL);
+      mmu->isDMAActive = TRUE;
+   }
+
+   /* Pages from 0xE0 up read work RAM, as they do from the CPU below
+      OAM */
+   mmu->dmaSource = page * 0x100;
+   if (mmu->dmaSource >= 0xE000) {
+      mmu->dmaSource -= 0x2000;
+   }
+
+   /* It gets going an M-cycle after the write */
+   mmu->dmaStart = GB_getCycles (mmu->gb) + 4;
+   mmu->dmaCopied = 0;
+   GB_scheduleDMA (mmu->gb, mmu->dmaStart + MMU_DMA_LENGTH * 4);
+
+#ifndef CPU_ACCURATE
+   MMU_copyDMA (mmu, MMU_DMA_LENGTH);
+#endif
+}
+
+void MMU_runDMA (MMU mmu) {
+   long long elapsed;
+
+   if (!mmu->isDMAActive) {
+      return;
+   }
+
+   elapsed = GB_getCycles (mmu->gb) - mmu->dmaStart;
+
+#ifdef CPU_ACCURATE
+   /* The bytes whose M-cycles have gone by */
+   if (elapsed > 0) {
+      MMU_copyDMA (mmu, (elapsed / 4 < MMU_DMA_LENGTH) ?
+                        (int)(elapsed / 4) : MMU_DMA_LENGTH);
+   }
+#endif
+
+   if (elapsed >= MMU_DMA_LENGTH * 4) {
+      memcpy (mmu->readPages, mmu->dmaReadPages, sizeof(mmu->dmaReadPages));
+      memcpy (mmu->writePages, mmu->dmaWritePages,
+              sizeof(mmu->dmaWritePages));
+      mmu->isDMAActive = FALSE;
+   }
+}
+
+int MMU_cyclesUntilDMAEnds (MMU mmu) {
+   if (!mmu->isDMAActive) {
+      return -1;
+   }
+   return (int)(mmu->dmaStart + MMU_DMA_LENGTH * 4 -
+                GB_getCycles (mmu->gb));
+}
+
+void MMU_copyDMA (MMU mmu, int end) {
+   byte *page = mmu->dmaReadPages[mmu->dmaSource >> 8];
+   int i;
+
+   if (end <= mmu->dmaCopied) {
+      return;
+   }
+
+   /* Sprites drawn up to here use the old OAM */
+   GB_notifyWrite (mmu->gb, 0xFE00);
+
+   if (page != NULL) {
+      /* The source never crosses a page */
+      memcpy (&mmu->memory[0xFE00 + mmu->dmaCopied], page + mmu->dmaCopied,
+              end - mmu->dmaCopied);
+   } else {
+      /* External RAM with no bank mapped, the only source that isn't
+         a page of memory once there is a ROM */
+      for (i = mmu->dmaCopied; i < end; i++) {
+         mmu->memory[0xFE00 + i] =
+            (mmu->dmaSource >= 0xA000 && mmu->dmaSource <= 0xBFFF) ?
+            Cartridge_readRAM (GB_getCartridge (mmu->gb),
+                               mmu->dmaSource + i) : 0xFF;
+      }
+   }
+
+   mmu->dmaCopied = end;
+}
+
+bool MMU_isDMAConflict (MMU mmu, int location) {
+#ifdef CPU_ACCURATE
+   bool isVideo = (location >= 0x8000 && location <= 0x9FFF);
+   bool isSourceVideo = (mmu->dmaSource >= 0x8000 &&
+                         mmu->dmaSource <= 0x9FFF);
+
+   if (GB_getCycles (mmu->gb) < mmu->dmaStart) {
+      /* Not going yet */
+      return FALSE;
+   }
+
+   return location >= 0xFE00 || isVideo == isSourceVideo;
+#else
+   return TRUE;
+#endif
+}
+
+byte MMU_readDMAConflict (MMU mmu, int location) {
+#ifdef CPU_ACCURATE
+   int i;
+
+   if (location < 0xFE00) {
+      /* The byte on the bus is the one being copied */
+      i = (int)(GB_getCycles (mmu->gb) - mmu->dmaStart) / 4;
+      MMU_copyDMA (mmu, i + 1);
+      return mmu->memory[0xFE00 + i];
+   }
+#endif
+
+   return 0xFF;
+}
+
 word MMU_readWord (MMU mmu, int location) {
    word value;
-   value = (MMU_readByte(mmu, location)) | (MMU_readByte(mmu, location+1) << 8);
+   value = (MMU_readByte(mmu, location)) |
+           (MMU_readByte(mmu, (location+1) & 0xFFFF) << 8);
 
    return value;
 }
@@ -139,7 +438,32 @@ void MMU_writeWord (MMU mmu, int location, word wordToWrite) {
    MSB = (wordToWrite & 0xFF);
 
    MMU_writeByte (mmu, location, LSB);
-   MMU_writeByte (mmu, location+1, MSB);
+   MMU_writeByte (mmu, (location+1) & 0xFFFF, MSB);
+}
+
+byte MMU_getPendingInterrupts (MMU mmu) {
+   return mmu->pendingInterrupts;
+}
+
+void MMU_requestInterrupt (MMU mmu, int interrupt) {
+   assert (interrupt >= 0 && interrupt < 5);
+
+   mmu->memory[0xFF0F] |= 1 << interrupt;
+   MMU_updatePendingInterrupts (mmu);
+}
+
+void MMU_updatePendingInterrupts (MMU mmu) {
+   byte pending = mmu->memory[0xFFFF] & mmu->memory[0xFF0F] & 0x1F;
+
+   if (pending != 0 && mmu->pendingInterrupts == 0) {
+      /* May need taking before the slice is over */
+      GB_notifyInterrupt (mmu->gb);
+   }
+   mmu->pendingInterrupts = pending;
+}
+
+int MMU_getROMBank (MMU mmu) {
+   return Cartridge_getROMBank (GB_getCartridge (mmu->gb));
 }
 
 byte * MMU_getMemory (MMU mmu) {
@@ -36,10 +36,26 @@ Echo of 8kB Internal RAM
 
 #define MAPPED_MEM_SIZE 0x10000
 
+/* Memory is mapped in pages of MMU_PAGE_SIZE bytes */
+#define MMU_PAGE_SIZE 0x100
+#define MMU_NUM_PAGES (MAPPED_MEM_SIZE / MMU_PAGE_SIZE)
+
+/* Bytes OAM DMA copies, one each M-cycle, and the cycles from writing
+   to 0xFF46 to it finishing */
+#define MMU_DMA_LENGTH 0xA0
+#define MMU_DMA_CYCLES (4 + MMU_DMA_LENGTH * 4)
+
 /* Constructor and Destructor */
 MMU MMU_init (GB gb);
 void MMU_free (MMU mmu);
 
+/* Maps the cartridge's ROM banks at 0x0000-0x3FFF and 0x4000-0x7FFF,
+   and a RAM bank at 0xA000-0xBFFF (NULL to leave accesses there to
+   the cartridge). The banks have to stay where they are until they
+   are mapped again */
+void MMU_mapROM (MMU mmu, byte *bank0, byte *bank);
+void MMU_mapRAM (MMU mmu, byte *bank);
+
 /* Writes and reads bytes */
 byte MMU_readByte (MMU mmu, int location);
 void MMU_writeByte (MMU mmu, int location, byte byteToWrite);
@@ -48,6 +64,22 @@ void MMU_writeByte (MMU mmu, int location, byte byteToWrite);
 word MMU_readWord (MMU mmu, int location);
 void MMU_writeWord (MMU mmu, int location, word wordToWrite);
 
+/* Brings the OAM DMA in progress up to the current cycle, ending it
+   once it is done, and gets the cycles until it ends (-1 if there
+   isn't one) */
+void MMU_runDMA (MMU mmu);
+int MMU_cyclesUntilDMAEnds (MMU mmu);
+
+/* Interrupts that are both enabled (IE) and requested (IF), kept up
+   to date as those registers are written */
+byte MMU_getPendingInterrupts (MMU mmu);
+
+/* Sets an interrupt's bit in IF */
+void MMU_requestInterrupt (MMU mmu, int interrupt);
+
+/* The ROM bank currently mapped at 0x4000-0x7FFF */
+int MMU_getROMBank (MMU mmu);
+
 /* Direct access to the mapped memory */
 byte * MMU_getMemory (MMU mmu);
 
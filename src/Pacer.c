@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "Pacer.h"
+#include "Timer.h"
+
+#include "types.h"
+
+/*
+Pacer
+
+Holds the emulator to the Game Boy's own frame rate (CLOCK_SPEED
+cycles a second, FRAME_CYCLES a frame, about 59.73 Hz). Frame n ends
+at start + n frame lengths, so rounding never adds up, and the wait
+for it is a sleep followed by a short spin because a sleep can wake
+late but a spin can't. How long to spin follows how late the sleeps
+have been waking, within limits, so a host with a coarse sleep still
+gets frames on time and one with a precise sleep barely spins at
+all. Anything much later than that (a slow host or
+the process being stopped) starts the timing again instead of
+running frames back to back to catch up.
+*/
+
+/* Limits on how long before the end of a frame to stop sleeping and
+   spin */
+#define PACER_MIN_SPIN_TIME 20000LL
+#define PACER_MAX_SPIN_TIME 2000000LL
+
+/* How late a frame can end before timing starts again from it */
+#define PACER_MAX_LATENESS (TIMER_SECOND / 10)
+
+struct Pacer {
+   int cyclesPerFrame;
+   int clockSpeed;
+   int speed;
+
+   /* Frames are counted from startTime */
+   long long startTime;
+   long long frames;
+
+   long long spinTime;
+
+   /* How late the last PACER_SAMPLES frames ended, oldest overwritten
+      first */
+   long long lateness[PACER_SAMPLES];
+   int numSamples;
+   int nextSample;
+};
+
+/* Gets the time frame number frame is due to end */
+long long Pacer_getFrameTime (Pacer pacer, long long frame);
+
+/* Orders lateness samples for qsort */
+int Pacer_compareSamples (const void *a, const void *b);
+
+Pacer Pacer_init (int cyclesPerFrame, int clockSpeed) {
+   Pacer newPacer = (Pacer)malloc(sizeof(struct Pacer));
+   assert (newPacer != NULL);
+   assert (cyclesPerFrame > 0 && clockSpeed > 0);
+
+   newPacer->cyclesPerFrame = cyclesPerFrame;
+   newPacer->clockSpeed = clockSpeed;
+   newPacer->speed = 1;
+
+   newPacer->spinTime = PACER_MIN_SPIN_TIME;
+
+   Pacer_start (newPacer);
+
+   return newPacer;
+}
+
+void Pacer_free (Pacer pacer) {
+   assert (pacer != NULL);
+   free (pacer);
+}
+
+void Pacer_setSpeed (Pacer pacer, int speed) {
+   assert (speed > 0);
+   pacer->speed = speed;
+}
+
+void Pacer_start (Pacer pacer) {
+   pacer->startTime = Timer_getTime ();
+   pacer->frames = 0;
+   pacer->numSamples = 0;
+   pacer->nextSample = 0;
+}
+
+void Pacer_waitForFrame (Pacer pacer) {
+   long long frameTime;
+   long long now;
+   long long late;
+
+   pacer->frames++;
+   frameTime = Pacer_getFrameTime (pacer, pacer->frames);
+
+   now = Timer_getTime ();
+   if (now < frameTime - pacer->spinTime) {
+      Timer_sleepUntil (frameTime - pacer->spinTime);
+      now = Timer_getTime ();
+
+      /* Spin for longer if the sleep overslept the frame, and
+         gradually less while it doesn't */
+      if (now > frameTime) {
+         pacer->spinTime += now - frameTime;
+      } else {
+         pacer->spinTime -= pacer->spinTime / 16;
+      }
+      if (pacer->spinTime < PACER_MIN_SPIN_TIME) {
+         pacer->spinTime = PACER_MIN_SPIN_TIME;
+      } else if (pacer->spinTime > PACER_MAX_SPIN_TIME) {
+         pacer->spinTime = PACER_MAX_SPIN_TIME;
+      }
+   }
+   while (now < frameTime) {
+      now = Timer_getTime ();
+   }
+
+   late = now - frameTime;
+
+   pacer->lateness[pacer->nextSample] = late;
+   pacer->nextSample = (pacer->nextSample + 1) % PACER_SAMPLES;
+   if (pacer->numSamples < PACER_SAMPLES) {
+      pacer->numSamples++;
+   }
+
+   if (late > PACER_MAX_LATENESS) {
+      /* Too far behind to catch up */
+      pacer->startTime = now;
+      pacer->frames = 0;
+   }
+}
+
+long long Pacer_getLateness (Pacer pacer, int percentile) {
+   long long sorted[PACER_SAMPLES];
+
+   assert (percentile >= 0 && percentile <= 100);
+
+   if (pacer->numSamples == 0) {
+      return -1;
+   }
+
+   memcpy (sorted, pacer->lateness, pacer->numSamples * sizeof(long long));
+   qsort (sorted, pacer->numSamples, sizeof(long long), Pacer_compareSamples);
+
+   return sorted[(pacer->numSamples - 1) * percentile / 100];
+}
+
+long long Pacer_getFrameTime (Pacer pacer, long long frame) {
+   long long cycles = frame * pacer->cyclesPerFrame;
+   long long clockSpeed = (long long)pacer->clockSpeed * pacer->speed;
+
+   /* Whole seconds first, so it doesn't overflow */
+   return pacer->startTime +
+          cycles / clockSpeed * TIMER_SECOND +
+          cycles % clockSpeed * TIMER_SECOND / clockSpeed;
+}
+
+int Pacer_compareSamples (const void *a, const void *b) {
+   long long x = *(const long long *)a;
+   long long y = *(const long long *)b;
+
+   return (x > y) - (x < y);
+}
@@ -0,0 +1,31 @@
+#ifndef _PACER_H_
+#define _PACER_H_
+
+#include "Pacer_type.h"
+
+#include "types.h"
+
+/* Number of frames the lateness percentiles are taken over */
+#define PACER_SAMPLES 512
+
+/* Constructor and Destructor, frames are cyclesPerFrame cycles long
+   at clockSpeed cycles a second */
+Pacer Pacer_init (int cyclesPerFrame, int clockSpeed);
+void Pacer_free (Pacer pacer);
+
+/* Runs speed times as fast as the clock speed says, from the next
+   Pacer_start */
+void Pacer_setSpeed (Pacer pacer, int speed);
+
+/* Starts timing frames from now and clears the statistics */
+void Pacer_start (Pacer pacer);
+
+/* Waits until the current frame is due to end. Sleeps for most of
+   the wait and only spins for the last moment */
+void Pacer_waitForFrame (Pacer pacer);
+
+/* Gets how late (in nanoseconds) frames have ended, at the given
+   percentile of the last PACER_SAMPLES frames. -1 if none have */
+long long Pacer_getLateness (Pacer pacer, int percentile);
+
+#endif
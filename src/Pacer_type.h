@@ -0,0 +1,6 @@
+#ifndef _PACER_TYPE_H_
+#define _PACER_TYPE_H_
+
+typedef struct Pacer *Pacer;
+
+#endif
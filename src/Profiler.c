@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "Profiler.h"
+#include "Timer.h"
+
+#include "types.h"
+
+/*
+Profiler
+
+Splits the host's time between the parts of the emulator. Whatever is
+about to do some work switches the profiler to its subsystem and back
+again afterwards, so the time from one switch to the next is charged
+to one subsystem and work done inside another (such as the GPU being
+caught up by an instruction) is charged to the inner one. While
+timing is off a switch is just an assignment.
+*/
+
+struct Profiler {
+   bool isEnabled;
+
+   subsystem current;
+   long long switchTime;
+
+   long long times[NUM_SUBSYSTEMS];
+};
+
+static const char *subsystemNames[NUM_SUBSYSTEMS] = {
+   "cpu", "gpu", "timer", "interrupts", "frontend", "idle"
+};
+
+Profiler Profiler_init () {
+   Profiler newProfiler = (Profiler)malloc(sizeof(struct Profiler));
+   assert (newProfiler != NULL);
+
+   newProfiler->isEnabled = FALSE;
+   newProfiler->current = SUBSYSTEM_CPU;
+   Profiler_reset (newProfiler);
+
+   return newProfiler;
+}
+
+void Profiler_free (Profiler profiler) {
+   assert (profiler != NULL);
+   free (profiler);
+}
+
+void Profiler_setEnabled (Profiler profiler, bool enabled) {
+   profiler->isEnabled = enabled;
+   profiler->switchTime = Timer_getTime ();
+}
+
+bool Profiler_isEnabled (Profiler profiler) {
+   return profiler->isEnabled;
+}
+
+subsystem Profiler_switch (Profiler profiler, subsystem s) {
+   subsystem previous = profiler->current;
+   long long now;
+
+   assert (s >= 0 && s < NUM_SUBSYSTEMS);
+
+   if (profiler->isEnabled) {
+      now = Timer_getTime ();
+      profiler->times[previous] += now - profiler->switchTime;
+      profiler->switchTime = now;
+   }
+   profiler->current = s;
+
+   return previous;
+}
+
+long long Profiler_getTime (Profiler profiler, subsystem s) {
+   assert (s >= 0 && s < NUM_SUBSYSTEMS);
+   return profiler->times[s];
+}
+
+void Profiler_reset (Profiler profiler) {
+   int s;
+
+   for (s = 0; s < NUM_SUBSYSTEMS; s++) {
+      profiler->times[s] = 0;
+   }
+   profiler->switchTime = Timer_getTime ();
+}
+
+void Profiler_report (Profiler profiler, double emulatedSeconds) {
+   int s;
+
+   /* Charge the time up to now */
+   Profiler_switch (profiler, profiler->current);
+
+   printf ("ms per emulated second:");
+   for (s = 0; s < NUM_SUBSYSTEMS; s++) {
+      printf (" %s %.2lf", subsystemNames[s],
+              profiler->times[s] / emulatedSeconds / 1000000);
+   }
+   printf ("\n");
+
+   Profiler_reset (profiler);
+}
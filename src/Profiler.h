@@ -0,0 +1,40 @@
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+
+#include "Profiler_type.h"
+
+#include "types.h"
+
+/* What the host's time goes on */
+typedef enum subsystem {
+   SUBSYSTEM_CPU,         /* Running instructions, and the GB around it */
+   SUBSYSTEM_GPU,         /* Catching the GPU up, drawing included */
+   SUBSYSTEM_TIMER,       /* DIV and TIMA */
+   SUBSYSTEM_INTERRUPTS,  /* Checking for and starting interrupts */
+   SUBSYSTEM_FRONTEND,    /* SDL: flipping the screen, events, joypad */
+   SUBSYSTEM_IDLE,        /* Waiting for the next frame to be due */
+   NUM_SUBSYSTEMS
+} subsystem;
+
+/* Constructor and Destructor */
+Profiler Profiler_init ();
+void Profiler_free (Profiler profiler);
+
+/* Turns timing on or off (off by default). Subsystems are still
+   tracked while it is off but nothing is timed */
+void Profiler_setEnabled (Profiler profiler, bool enabled);
+bool Profiler_isEnabled (Profiler profiler);
+
+/* Charges the time from here on to s, returns the subsystem it was
+   being charged to so that it can be switched back */
+subsystem Profiler_switch (Profiler profiler, subsystem s);
+
+/* Gets the nanoseconds charged to s since the last reset */
+long long Profiler_getTime (Profiler profiler, subsystem s);
+void Profiler_reset (Profiler profiler);
+
+/* Prints the time charged to each subsystem per emulated second,
+   given how many seconds were emulated in it, then resets */
+void Profiler_report (Profiler profiler, double emulatedSeconds);
+
+#endif
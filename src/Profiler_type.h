@@ -0,0 +1,6 @@
+#ifndef _PROFILER_TYPE_H_
+#define _PROFILER_TYPE_H_
+
+typedef struct Profiler *Profiler;
+
+#endif
@@ -0,0 +1,163 @@
+#include <stdlib.h>
+#include <assert.h>
+
+#include "Scheduler.h"
+
+#include "types.h"
+
+/*
+Scheduler
+
+A binary min-heap of events ordered by the cycle they are due at, so
+the GB can run the CPU straight up to the earliest of them and only
+bring up to date the parts that have something to do. Every event has
+a fixed slot and is in the heap at most once, so rescheduling moves it
+rather than adding another entry.
+*/
+
+struct Scheduler {
+   long long times[NUM_EVENTS];
+
+   /* Events in heap order, and where each one is in the heap (-1 if
+      it isn't scheduled) */
+   int heap[NUM_EVENTS];
+   int position[NUM_EVENTS];
+   int size;
+};
+
+/* Swaps two entries in the heap */
+void Scheduler_swap (Scheduler scheduler, int i, int j);
+
+/* Moves an entry up or down the heap to where its time belongs */
+void Scheduler_siftUp (Scheduler scheduler, int i);
+void Scheduler_siftDown (Scheduler scheduler, int i);
+
+Scheduler Scheduler_init () {
+   int i;
+
+   Scheduler newScheduler = (Scheduler)malloc(sizeof(struct Scheduler));
+   assert (newScheduler != NULL);
+
+   for (i = 0; i < NUM_EVENTS; i++) {
+      newScheduler->times[i] = SCHEDULER_NEVER;
+      newScheduler->position[i] = -1;
+   }
+   newScheduler->size = 0;
+
+   return newScheduler;
+}
+
+void Scheduler_free (Scheduler scheduler) {
+   assert (scheduler != NULL);
+   free (scheduler);
+}
+
+void Scheduler_schedule (Scheduler scheduler, event e, long long time) {
+   int i;
+   long long oldTime;
+
+   assert (e >= 0 && e < NUM_EVENTS);
+
+   oldTime = scheduler->times[e];
+   scheduler->times[e] = time;
+
+   i = scheduler->position[e];
+   if (i < 0) {
+      i = scheduler->size++;
+      scheduler->heap[i] = e;
+      scheduler->position[e] = i;
+      Scheduler_siftUp (scheduler, i);
+   } else if (time < oldTime) {
+      Scheduler_siftUp (scheduler, i);
+   } else {
+      Scheduler_siftDown (scheduler, i);
+   }
+}
+
+void Scheduler_cancel (Scheduler scheduler, event e) {
+   int i;
+
+   assert (e >= 0 && e < NUM_EVENTS);
+
+   i = scheduler->position[e];
+   if (i < 0) {
+      return;
+   }
+
+   /* Fill the gap with the last entry */
+   scheduler->size--;
+   if (i != scheduler->size) {
+      Scheduler_swap (scheduler, i, scheduler->size);
+      Scheduler_siftUp (scheduler, i);
+      Scheduler_siftDown (scheduler, i);
+   }
+
+   scheduler->position[e] = -1;
+   scheduler->times[e] = SCHEDULER_NEVER;
+}
+
+long long Scheduler_getNextTime (Scheduler scheduler) {
+   long long time = SCHEDULER_NEVER;
+
+   if (scheduler->size > 0) {
+      time = scheduler->times[scheduler->heap[0]];
+   }
+
+   return time;
+}
+
+int Scheduler_nextDueEvent (Scheduler scheduler, long long now) {
+   int e = NO_EVENT;
+
+   if (scheduler->size > 0 && scheduler->times[scheduler->heap[0]] <= now) {
+      e = scheduler->heap[0];
+      Scheduler_cancel (scheduler, e);
+   }
+
+   return e;
+}
+
+void Scheduler_swap (Scheduler scheduler, int i, int j) {
+   int e;
+
+   e = scheduler->heap[i];
+   scheduler->heap[i] = scheduler->heap[j];
+   scheduler->heap[j] = e;
+
+   scheduler->position[scheduler->heap[i]] = i;
+   scheduler->position[scheduler->heap[j]] = j;
+}
+
+void Scheduler_siftUp (Scheduler scheduler, int i) {
+   int parent;
+
+   while (i > 0) {
+      parent = (i - 1) / 2;
+      if (scheduler->times[scheduler->heap[parent]] <=
+          scheduler->times[scheduler->heap[i]]) {
+         break;
+      }
+
+      Scheduler_swap (scheduler, i, parent);
+      i = parent;
+   }
+}
+
+void Scheduler_siftDown (Scheduler scheduler, int i) {
+   int child;
+
+   while ((child = 2*i + 1) < scheduler->size) {
+      if (child + 1 < scheduler->size &&
+          scheduler->times[scheduler->heap[child + 1]] <
+          scheduler->times[scheduler->heap[child]]) {
+         child++;
+      }
+      if (scheduler->times[scheduler->heap[i]] <=
+          scheduler->times[scheduler->heap[child]]) {
+         break;
+      }
+
+      Scheduler_swap (scheduler, i, child);
+      i = child;
+   }
+}
@@ -0,0 +1,39 @@
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#include "Scheduler_type.h"
+
+#include "types.h"
+
+/* Time of an event that isn't scheduled */
+#define SCHEDULER_NEVER 0x7FFFFFFFFFFFFFFFLL
+
+#define NO_EVENT -1
+
+/* Things that happen at a known cycle, each scheduled at most once */
+typedef enum event {
+   EVENT_GPU,     /* LY or LCD mode change */
+   EVENT_TIMER,   /* TIMA overflow */
+   EVENT_DMA,     /* OAM DMA finishing */
+   EVENT_SAVE,    /* Flushing battery backed RAM to its save file */
+   NUM_EVENTS
+} event;
+
+/* Constructor and Destructor */
+Scheduler Scheduler_init ();
+void Scheduler_free (Scheduler scheduler);
+
+/* Sets the cycle the event next happens at, replacing any time it was
+   already scheduled for */
+void Scheduler_schedule (Scheduler scheduler, event e, long long time);
+void Scheduler_cancel (Scheduler scheduler, event e);
+
+/* Gets the time of the earliest event, SCHEDULER_NEVER if there isn't
+   one */
+long long Scheduler_getNextTime (Scheduler scheduler);
+
+/* Takes the earliest event off the schedule if it is due by now,
+   returns the event or NO_EVENT */
+int Scheduler_nextDueEvent (Scheduler scheduler, long long now);
+
+#endif
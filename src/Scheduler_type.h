@@ -0,0 +1,6 @@
+#ifndef _SCHEDULER_TYPE_H_
+#define _SCHEDULER_TYPE_H_
+
+typedef struct Scheduler *Scheduler;
+
+#endif
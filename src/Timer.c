@@ -1,15 +1,18 @@
+/* For clock_gettime and clock_nanosleep */
+#define _POSIX_C_SOURCE 200112L
+
 #include <stdlib.h>
 #include <assert.h>
-
-#include <SDL.h>
+#include <errno.h>
+#include <time.h>
 
 #include "Timer.h"
 #include "types.h"
 
 struct timer {
    bool running;
-   unsigned int startTime;
-   unsigned int stopTime;
+   long long startTime;
+   long long stopTime;
 };
 
 Timer Timer_init () {
@@ -17,7 +20,7 @@ Timer Timer_init () {
    assert (newTimer != NULL);
 
    newTimer->running = FALSE;
-   newTimer->startTime = SDL_GetTicks ();
+   newTimer->startTime = Timer_getTime ();
    newTimer->stopTime = newTimer->startTime;
 
    return newTimer;
@@ -30,29 +33,62 @@ void Timer_free (Timer timer) {
 void Timer_start (Timer timer) {
    if (!(timer->running)) {
       timer->running = TRUE;
-      timer->startTime = SDL_GetTicks ();
+      timer->startTime = Timer_getTime ();
    }
 }
 
 void Timer_stop (Timer timer) {
    if (timer->running) {
       timer->running = FALSE;
-      timer->stopTime = SDL_GetTicks ();
+      timer->stopTime = Timer_getTime ();
    }
 }
 
 void Timer_reset (Timer timer) {
-   timer->startTime = SDL_GetTicks ();
+   timer->startTime = Timer_getTime ();
 }
 
-unsigned int Timer_getTicks (Timer timer) {
-   unsigned int ticks;
+long long Timer_getNanoseconds (Timer timer) {
+   long long time;
    if (timer->running) {
-      ticks = SDL_GetTicks () - timer->startTime;
+      time = Timer_getTime () - timer->startTime;
    } else {
-      ticks = timer->stopTime - timer->startTime;
+      time = timer->stopTime - timer->startTime;
    }
 
-  return ticks;
+   return time;
+}
+
+unsigned int Timer_getTicks (Timer timer) {
+   return (unsigned int)(Timer_getNanoseconds (timer) / 1000000);
 }
 
+long long Timer_getTime () {
+   struct timespec now;
+
+   clock_gettime (CLOCK_MONOTONIC, &now);
+
+   return (long long)now.tv_sec * TIMER_SECOND + now.tv_nsec;
+}
+
+void Timer_sleepUntil (long long time) {
+   struct timespec wakeTime;
+
+#ifdef TIMER_ABSTIME
+   wakeTime.tv_sec = time / TIMER_SECOND;
+   wakeTime.tv_nsec = time % TIMER_SECOND;
+
+   /* Starts again after a signal, gives up on any other error rather
+      than spinning on it */
+   while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeTime, NULL) == EINTR) {
+   }
+#else
+   /* No absolute sleep, sleep for what is left instead */
+   time -= Timer_getTime ();
+   if (time > 0) {
+      wakeTime.tv_sec = time / TIMER_SECOND;
+      wakeTime.tv_nsec = time % TIMER_SECOND;
+      nanosleep (&wakeTime, NULL);
+   }
+#endif
+}
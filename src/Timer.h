@@ -3,12 +3,25 @@
 
 #include "Timer_type.h"
 
+/* Nanoseconds in a second */
+#define TIMER_SECOND 1000000000LL
+
 Timer Timer_init ();
 void Timer_free (Timer timer);
 
-void Timer_start ();
-void Timer_stop ();
-void Timer_reset ();
+void Timer_start (Timer timer);
+void Timer_stop (Timer timer);
+void Timer_reset (Timer timer);
+
+/* Time the timer has been running, in milliseconds and nanoseconds */
 unsigned int Timer_getTicks (Timer timer);
+long long Timer_getNanoseconds (Timer timer);
+
+/* Nanoseconds on a clock that only goes forwards, from some fixed
+   point in the past */
+long long Timer_getTime ();
+
+/* Sleeps until Timer_getTime reaches time, or a little after */
+void Timer_sleepUntil (long long time);
 
 #endif
@@ -18,3 +18,18 @@ void clearBit (byte *value, byte bit) {
    }
 }
 
+int lowestSetBit (byte value) {
+   assert (value != 0);
+#ifdef __GNUC__
+   return __builtin_ctz (value);
+#else
+   {
+      int bit = 0;
+      while (!(value & (1<<bit))) {
+         bit++;
+      }
+      return bit;
+   }
+#endif
+}
+
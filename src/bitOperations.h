@@ -7,4 +7,7 @@ bool testBit (byte value, byte bit);
 void setBit (byte *value, byte bit);
 void clearBit (byte *value, byte bit);
 
+/* Gets the number of the lowest set bit, value must not be 0 */
+int lowestSetBit (byte value);
+
 #endif
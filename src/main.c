@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 #include <SDL.h>
@@ -8,17 +10,51 @@
 void showUsage (const char *name);
 
 int main (int argc, char *argv[]) {
-   GB gb; 
+   GB gb;
+   int speed = 1;
+   int frameSkip = 10;
+   long frameLimit = 0;
+   bool isProfiling = FALSE;
+   bool isValid = TRUE;
+   int i;
 
-   if (argc < 2) {
+   /* Options come before the ROM */
+   for (i = 1; i < argc - 1 && argv[i][0] == '-'; i++) {
+      if (strcmp (argv[i], "-u") == 0) {
+         speed = GB_SPEED_UNCAPPED;
+      } else if (strcmp (argv[i], "-p") == 0) {
+         isProfiling = TRUE;
+      } else if (strcmp (argv[i], "-s") == 0 && i + 1 < argc - 1) {
+         speed = atoi (argv[++i]);
+         isValid = isValid && speed > 0;
+      } else if (strcmp (argv[i], "-k") == 0 && i + 1 < argc - 1) {
+         frameSkip = atoi (argv[++i]);
+         isValid = isValid && frameSkip > 0;
+      } else if (strcmp (argv[i], "-f") == 0 && i + 1 < argc - 1) {
+         frameLimit = atol (argv[++i]);
+         isValid = isValid && frameLimit > 0;
+      } else {
+         isValid = FALSE;
+      }
+   }
+
+   if (!isValid || i != argc - 1) {
       showUsage (argv[0]);
    } else {
       gb = GB_init ();
       assert (gb != NULL);
 
-      GB_loadRom (gb, argv[1]);
+      GB_setSpeed (gb, speed);
+      GB_setFrameSkip (gb, frameSkip);
+      GB_setFrameLimit (gb, frameLimit);
+      GB_setProfiling (gb, isProfiling);
+
+      /* The cartridge's clock kept going while the emulator wasn't */
+      GB_setOfflineTime (gb, TRUE);
+
+      GB_loadRom (gb, argv[i]);
       GB_run (gb);
-       
+
       GB_free (gb);
    }
 
@@ -26,5 +62,11 @@ int main (int argc, char *argv[]) {
 }
 
 void showUsage (const char *name) {
-   printf ("%s path_to_rom\n", name);
+   printf ("%s [options] path_to_rom\n", name);
+   printf ("  -s speed   run at speed times a Game Boy's speed\n");
+   printf ("  -u         run as fast as possible\n");
+   printf ("  -k frames  show one frame in every frames when running as\n"
+           "             fast as possible (10)\n");
+   printf ("  -f frames  stop after frames frames\n");
+   printf ("  -p         print where the time goes every emulated second\n");
 }
@@ -0,0 +1,390 @@
+#include <stdio.h>
+#include <time.h>
+
+#include <SDL.h>
+
+#include "GB.h"
+#include "CPU.h"
+#include "MMU.h"
+#include "ALUTables.h"
+#include "Coroutine.h"
+
+/*
+Microbenchmarks, built with "make bench"
+
+benchALUFlags times working out the result and flags of ADC and SBC
+for a stream of random operands one flag at a time, the way the ALU
+helpers used to, against a single load from the generated tables.
+benchALUInstructions times a loop of ALU instructions run through
+CPU_run, and benchLoadInstructions a loop of loads, stores, register
+increments and jumps, which mostly time getting at the registers and
+going from one instruction to the next. benchMemoryAccess times
+MMU_readByte and MMU_writeByte on their own over the parts of memory
+a program mostly uses. benchWorkRAM times stores to work RAM and its
+echo on their own and as a loop filling work RAM. benchCoroutineSwitch times
+switching to a coroutine and straight back, which the COROUTINES=1
+build does each time it catches the GPU up.
+*/
+
+#define FLAG_C (1 << FLAG_CARRY_BIT)
+
+#define NUM_OPERATIONS 50000000
+#define NUM_CYCLES     400000000
+#define NUM_SWITCHES   20000000
+#define NUM_ACCESSES   200000000
+
+/* Instructions and cycles in one pass of the ALU loop */
+#define LOOP_INSTRUCTIONS 12
+#define LOOP_CYCLES       68
+
+/* Instructions and cycles in the 256 passes of the load loop and the
+   jump back to its start */
+#define LOAD_LOOP_INSTRUCTIONS (256 * 7 + 1)
+#define LOAD_LOOP_CYCLES       (256 * 40 + 12)
+
+/* Instructions and cycles in the 256 passes of the work RAM loop
+   (the last not jumping back) and the jump to its start */
+#define WRAM_LOOP_INSTRUCTIONS (256 * 6 + 2)
+#define WRAM_LOOP_CYCLES       (256 * 48 - 4 + 8 + 16)
+
+void benchALUFlags ();
+void benchALUInstructions ();
+void benchLoadInstructions ();
+void benchMemoryAccess ();
+void benchWorkRAM ();
+void benchCoroutineSwitch ();
+
+/* Switches straight back to the coroutine it was started with */
+void switchBack (void *argument);
+Coroutine otherCoroutine;
+
+void branchyADC (CPU cpu, byte b);
+void branchySBC (CPU cpu, byte b);
+
+double secondsSince (clock_t start);
+
+int main (int argc, char *argv[]) {
+   benchALUFlags ();
+   benchALUInstructions ();
+   benchLoadInstructions ();
+   benchMemoryAccess ();
+   benchWorkRAM ();
+   benchCoroutineSwitch ();
+   return 0;
+}
+
+void benchALUFlags () {
+   GB gb;
+   CPU cpu;
+   clock_t start;
+   double branchyTime, tableTime;
+   unsigned int seed;
+   unsigned int sum;
+   word af;
+   int i;
+
+   gb = GB_init ();
+   cpu = GB_getCPU (gb);
+
+   /* Same operands for both, each result feeding the next operation
+      so neither loop can be cut short */
+   seed = 1;
+   sum = 0;
+   CPU_set16bitRegisterValue (cpu, AF, 0);
+   start = clock ();
+   for (i = 0; i < NUM_OPERATIONS; i++) {
+      seed = seed * 1103515245 + 12345;
+      branchyADC (cpu, seed >> 16);
+      branchySBC (cpu, seed >> 24);
+      sum += CPU_get16bitRegisterValue (cpu, AF);
+   }
+   branchyTime = secondsSince (start);
+   printf ("one flag at a time: %u\n", sum);
+
+   seed = 1;
+   sum = 0;
+   CPU_set16bitRegisterValue (cpu, AF, 0);
+   start = clock ();
+   for (i = 0; i < NUM_OPERATIONS; i++) {
+      seed = seed * 1103515245 + 12345;
+      af = CPU_get16bitRegisterValue (cpu, AF);
+      af = aluADD[(af & FLAG_C) ? 1 : 0][af >> 8][(seed >> 16) & 0xFF];
+      CPU_set16bitRegisterValue (cpu, AF, af);
+      af = aluSUB[(af & FLAG_C) ? 1 : 0][af >> 8][(seed >> 24) & 0xFF];
+      CPU_set16bitRegisterValue (cpu, AF, af);
+      sum += CPU_get16bitRegisterValue (cpu, AF);
+   }
+   tableTime = secondsSince (start);
+   printf ("tables:             %u\n", sum);
+
+   printf ("ADC+SBC: one flag at a time %.2f ns, tables %.2f ns (%.2fx)\n",
+           branchyTime * 1e9 / NUM_OPERATIONS,
+           tableTime * 1e9 / NUM_OPERATIONS,
+           branchyTime / tableTime);
+
+   GB_free (gb);
+}
+
+void benchALUInstructions () {
+   GB gb;
+   CPU cpu;
+   MMU mmu;
+   clock_t start;
+   double seconds;
+   long long cycles = 0;
+   int i;
+
+   byte program[] = {
+      0x80,             /* ADD A,B    */
+      0x89,             /* ADC A,C    */
+      0x92,             /* SUB D      */
+      0x9B,             /* SBC A,E    */
+      0xBC,             /* CP H       */
+      0x2C,             /* INC L      */
+      0x05,             /* DEC B      */
+      0x27,             /* DAA        */
+      0xCB, 0x01,       /* RLC C      */
+      0xCB, 0x1A,       /* RR D       */
+      0x19,             /* ADD HL,DE  */
+      0xC3, 0x00, 0xC0  /* JP 0xC000  */
+   };
+
+   gb = GB_init ();
+   mmu = GB_getMMU (gb);
+   cpu = GB_getCPU (gb);
+
+   GB_loadRom (gb, "ROMS/test1.ROM");
+
+   for (i = 0; i < sizeof(program); i++) {
+      MMU_writeByte (mmu, 0xC000 + i, program[i]);
+   }
+   CPU_set16bitRegisterValue (cpu, PC, 0xC000);
+
+   start = clock ();
+   while (cycles < NUM_CYCLES) {
+      cycles += CPU_run (cpu, 70224);
+   }
+   seconds = secondsSince (start);
+
+   printf ("ALU loop: %.2f ns per instruction, %.1fx realtime\n",
+           seconds * 1e9 / ((double)cycles / LOOP_CYCLES * LOOP_INSTRUCTIONS),
+           (double)cycles / CLOCK_SPEED / seconds);
+
+   GB_free (gb);
+}
+
+void benchLoadInstructions () {
+   GB gb;
+   CPU cpu;
+   MMU mmu;
+   clock_t start;
+   double seconds;
+   long long cycles = 0;
+   int i;
+
+   byte program[] = {
+      0x7E,             /* LD A,(HL)  */
+      0x2C,             /* INC L      */
+      0x12,             /* LD (DE),A  */
+      0x1C,             /* INC E      */
+      0x47,             /* LD B,A     */
+      0x0D,             /* DEC C      */
+      0x20, 0xF8,       /* JR NZ,-8   */
+      0xC3, 0x00, 0xC0  /* JP 0xC000  */
+   };
+
+   gb = GB_init ();
+   mmu = GB_getMMU (gb);
+   cpu = GB_getCPU (gb);
+
+   GB_loadRom (gb, "ROMS/test1.ROM");
+
+   for (i = 0; i < sizeof(program); i++) {
+      MMU_writeByte (mmu, 0xC000 + i, program[i]);
+   }
+   CPU_set16bitRegisterValue (cpu, BC, 0x0000);
+   CPU_set16bitRegisterValue (cpu, DE, 0xD000);
+   CPU_set16bitRegisterValue (cpu, HL, 0x0100);
+   CPU_set16bitRegisterValue (cpu, PC, 0xC000);
+
+   start = clock ();
+   while (cycles < NUM_CYCLES) {
+      cycles += CPU_run (cpu, 70224);
+   }
+   seconds = secondsSince (start);
+
+   printf ("load loop: %.2f ns per instruction, %.1f million instructions per second\n",
+           seconds * 1e9 / ((double)cycles / LOAD_LOOP_CYCLES * LOAD_LOOP_INSTRUCTIONS),
+           (double)cycles / LOAD_LOOP_CYCLES * LOAD_LOOP_INSTRUCTIONS / seconds / 1e6);
+
+   GB_free (gb);
+}
+
+void benchMemoryAccess () {
+   GB gb;
+   MMU mmu;
+   clock_t start;
+   double seconds;
+   unsigned int sum = 0;
+   int pass, i;
+
+   /* ROM, video RAM, external RAM and work RAM, as an instruction
+      stream and its operands would use them */
+   int bases[] = { 0x0100, 0x4100, 0x8100, 0xA100, 0xC100 };
+
+   gb = GB_init ();
+   mmu = GB_getMMU (gb);
+
+   GB_loadRom (gb, "ROMS/test1.ROM");
+
+   start = clock ();
+   for (pass = 0; pass < NUM_ACCESSES / 256 / 5; pass++) {
+      for (i = 0; i < 256; i++) {
+         sum += MMU_readByte (mmu, bases[0] + i);
+         sum += MMU_readByte (mmu, bases[1] + i);
+         sum += MMU_readByte (mmu, bases[2] + i);
+         sum += MMU_readByte (mmu, bases[3] + i);
+         sum += MMU_readByte (mmu, bases[4] + i);
+      }
+   }
+   seconds = secondsSince (start);
+   printf ("memory reads: %.2f ns per read (%u)\n",
+           seconds * 1e9 / NUM_ACCESSES, sum);
+
+   start = clock ();
+   for (pass = 0; pass < NUM_ACCESSES / 256; pass++) {
+      for (i = 0; i < 256; i++) {
+         MMU_writeByte (mmu, bases[3] + i, pass + i);
+      }
+   }
+   seconds = secondsSince (start);
+   printf ("external RAM writes: %.2f ns per write\n",
+           seconds * 1e9 / NUM_ACCESSES);
+
+   GB_free (gb);
+}
+
+void benchWorkRAM () {
+   GB gb;
+   CPU cpu;
+   MMU mmu;
+   clock_t start;
+   double seconds;
+   long long cycles = 0;
+   int pass, i;
+
+   byte program[] = {
+      0x22,             /* LD (HL+),A */
+      0x22,             /* LD (HL+),A */
+      0x22,             /* LD (HL+),A */
+      0x22,             /* LD (HL+),A */
+      0x0D,             /* DEC C      */
+      0x20, 0xF9,       /* JR NZ,-7   */
+      0x26, 0xD0,       /* LD H,0xD0  */
+      0xC3, 0x00, 0xC0  /* JP 0xC000  */
+   };
+
+   gb = GB_init ();
+   mmu = GB_getMMU (gb);
+   cpu = GB_getCPU (gb);
+
+   GB_loadRom (gb, "ROMS/test1.ROM");
+
+   /* Through both halves of work RAM and the echo of the first */
+   start = clock ();
+   for (pass = 0; pass < NUM_ACCESSES / 256 / 3; pass++) {
+      for (i = 0; i < 256; i++) {
+         MMU_writeByte (mmu, 0xC100 + i, pass + i);
+         MMU_writeByte (mmu, 0xD100 + i, pass + i);
+         MMU_writeByte (mmu, 0xE200 + i, pass + i);
+      }
+   }
+   seconds = secondsSince (start);
+   printf ("work RAM writes: %.2f ns per write\n",
+           seconds * 1e9 / NUM_ACCESSES);
+
+   for (i = 0; i < sizeof(program); i++) {
+      MMU_writeByte (mmu, 0xC000 + i, program[i]);
+   }
+   CPU_set16bitRegisterValue (cpu, BC, 0x0000);
+   CPU_set16bitRegisterValue (cpu, HL, 0xD000);
+   CPU_set16bitRegisterValue (cpu, PC, 0xC000);
+
+   start = clock ();
+   while (cycles < NUM_CYCLES) {
+      cycles += CPU_run (cpu, 70224);
+   }
+   seconds = secondsSince (start);
+
+   printf ("work RAM loop: %.2f ns per instruction, %.1f million instructions per second\n",
+           seconds * 1e9 / ((double)cycles / WRAM_LOOP_CYCLES * WRAM_LOOP_INSTRUCTIONS),
+           (double)cycles / WRAM_LOOP_CYCLES * WRAM_LOOP_INSTRUCTIONS / seconds / 1e6);
+
+   GB_free (gb);
+}
+
+void benchCoroutineSwitch () {
+   Coroutine thread;
+   Coroutine other;
+   clock_t start;
+   double seconds;
+   int i;
+
+   thread = Coroutine_initThread ();
+   other = Coroutine_init (switchBack, thread, COROUTINE_STACK_SIZE);
+   otherCoroutine = other;
+
+   start = clock ();
+   for (i = 0; i < NUM_SWITCHES; i++) {
+      Coroutine_switch (thread, other);
+   }
+   seconds = secondsSince (start);
+
+   printf ("coroutines: %.2f ns per switch there and back\n",
+           seconds * 1e9 / NUM_SWITCHES);
+
+   Coroutine_free (other);
+   Coroutine_free (thread);
+}
+
+void switchBack (void *argument) {
+   Coroutine thread = (Coroutine)argument;
+
+   for (;;) {
+      Coroutine_switch (otherCoroutine, thread);
+   }
+}
+
+/* ADC and SBC on A, setting the flags one at a time through the CPU
+   flag functions as the helpers in CPU_instructions.c did before the
+   tables */
+void branchyADC (CPU cpu, byte b) {
+   byte a = CPU_get8bitRegisterValue (cpu, A);
+   int C = CPU_isCarrySet (cpu) ? 1 : 0;
+   int result = (int)a + (int)b + C;
+
+   CPU_clearFlags (cpu);
+   if ((result & 0xFF) == 0) CPU_setZero (cpu);
+   if (result < 0 || result > 0xFF) CPU_setCarry (cpu);
+   if ((result & 0xF) < (a & 0xF)) CPU_setHalfCarry (cpu);
+
+   CPU_set8bitRegisterValue (cpu, A, result);
+}
+
+void branchySBC (CPU cpu, byte b) {
+   byte a = CPU_get8bitRegisterValue (cpu, A);
+   int C = CPU_isCarrySet (cpu) ? 1 : 0;
+   int result = (int)a - (int)b - C;
+
+   CPU_clearFlags (cpu);
+   CPU_setSub (cpu);
+   if (result == 0) CPU_setZero (cpu);
+   if (result < 0 || result > 0xFF) CPU_setCarry (cpu);
+   if ((result & 0xF) > (a & 0xF)) CPU_setHalfCarry (cpu);
+
+   CPU_set8bitRegisterValue (cpu, A, result);
+}
+
+double secondsSince (clock_t start) {
+   return (double)(clock () - start) / CLOCKS_PER_SEC;
+}
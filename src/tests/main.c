@@ -1,4 +1,7 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <assert.h>
 
 #include <SDL.h>
@@ -6,11 +9,89 @@
 #include "GB.h"
 #include "CPU.h"
 #include "MMU.h"
+#include "Cartridge.h"
+#include "GPU.h"
+#include "GUI.h"
+#include "Scheduler.h"
+#include "Pacer.h"
+#include "Timer.h"
+#include "Profiler.h"
+#include "Coroutine.h"
 
 void testCPU ();
+void testCPURun ();
+void testCPULoop ();
+void testCPUFlags ();
+void testCPUDAA ();
+void testCPUIdioms ();
+void testIdleLoops ();
+void testHalt ();
+void testRunCycles ();
+void testScheduler ();
+void testTimer ();
+void testGPUCatchUp ();
+void testInterrupts ();
+void testPacer ();
+void testSpeedModes ();
+void testAccessTiming ();
+void testProfiler ();
+void testCoroutines ();
+void testMemoryMap ();
+void testMappers ();
+void testClock ();
+void testSaveRAM ();
+void testDMA ();
+GB loadTestProgram (const byte *program, int size, const word *registers);
+int runUntilHalt (GB gb, int budget, int until);
+
+/* Makes a ROM of the given cartridge type, number of banks and RAM
+   size (as in the header), with each bank starting with its number
+   followed by a program that loads its low byte into A and halts,
+   and loads it */
+GB loadBankedROM (byte type, int numBanks, byte ramSize);
+int readBankNumber (MMU mmu, int location);
+
+/* Writes the ROM loadBankedROM loads to a new file, path is a
+   template for mkstemp that is filled in */
+void writeBankedROM (char *path, byte type, int numBanks, byte ramSize);
+
+/* Latches and reads all the clock registers, and writes one */
+void readClock (MMU mmu, byte *registers);
+void writeClock (MMU mmu, int reg, byte value);
+byte expectedFlags (byte opcode, int a, int b, byte flags);
+
+/* Counts up by one each time it is switched to */
+struct counter {
+   Coroutine self;
+   Coroutine caller;
+   int value;
+};
+void countInCoroutine (void *argument);
 
 int main (int argc, char *argv[]) {
    testCPU ();
+   testCPURun ();
+   testCPULoop ();
+   testCPUFlags ();
+   testCPUDAA ();
+   testCPUIdioms ();
+   testIdleLoops ();
+   testHalt ();
+   testRunCycles ();
+   testScheduler ();
+   testTimer ();
+   testGPUCatchUp ();
+   testInterrupts ();
+   testPacer ();
+   testSpeedModes ();
+   testAccessTiming ();
+   testProfiler ();
+   testCoroutines ();
+   testMemoryMap ();
+   testMappers ();
+   testClock ();
+   testSaveRAM ();
+   testDMA ();
    return 0;
 }
 
@@ -43,3 +124,1837 @@ void testCPU () {
 
    GB_free (gb);
 }
+
+void testCPURun () {
+   GB gb;
+   CPU cpu;
+   MMU mmu;
+   int i;
+   int cycles;
+
+   /* Sums 5+4+3+2+1 into A then halts */
+   byte program[] = {
+      0x06, 0x05,       /* LD B,5     */
+      0xAF,             /* XOR A      */
+      0x80,             /* ADD A,B    */
+      0x05,             /* DEC B      */
+      0x20, 0xFC,       /* JR NZ,-4   */
+      0x76              /* HALT       */
+   };
+
+   printf ("Testing CPU_run...\n");
+
+   gb = GB_init ();
+   mmu = GB_getMMU (gb);
+   cpu = GB_getCPU (gb);
+
+   GB_loadRom (gb, "ROMS/test1.ROM");
+
+   /* Run the program from internal RAM */
+   for (i = 0; i < sizeof(program); i++) {
+      MMU_writeByte (mmu, 0xC000 + i, program[i]);
+   }
+   CPU_set16bitRegisterValue (cpu, PC, 0xC000);
+
+   /* A budget of one cycle runs a single instruction */
+   cycles = CPU_run (cpu, 1);
+   assert (cycles == 8);
+   assert (CPU_get8bitRegisterValue (cpu, B) == 5);
+
+   /* The rest of the program runs until HALT hands control back */
+   cycles = CPU_run (cpu, 1000);
+   assert (cycles == 4 + 5*(4+4+8) + 4);
+   assert (CPU_get16bitRegisterValue (cpu, PC) == 0xC008);
+   assert (CPU_get8bitRegisterValue (cpu, A) == 15);
+   assert (CPU_get8bitRegisterValue (cpu, B) == 0);
+   assert (CPU_isZeroSet (cpu));
+
+   printf ("CPU_run tests passed.\n");
+
+   GB_free (gb);
+}
+
+void testCPULoop () {
+   GB gb;
+   CPU cpu;
+   MMU mmu;
+   int i;
+   int cycles;
+
+   /* Adds DE to HL 200 times then halts, long enough for the
+      loop to get translated when built with JIT=1 */
+   byte program[] = {
+      0x21, 0x00, 0x00, /* LD HL,0    */
+      0x11, 0x07, 0x00, /* LD DE,7    */
+      0x06, 0xC8,       /* LD B,200   */
+      0x19,             /* ADD HL,DE  */
+      0x05,             /* DEC B      */
+      0x20, 0xFC,       /* JR NZ,-4   */
+      0x76              /* HALT       */
+   };
+
+   printf ("Testing CPU loops...\n");
+
+   gb = GB_init ();
+   mmu = GB_getMMU (gb);
+   cpu = GB_getCPU (gb);
+
+   GB_loadRom (gb, "ROMS/test1.ROM");
+
+   for (i = 0; i < sizeof(program); i++) {
+      MMU_writeByte (mmu, 0xC000 + i, program[i]);
+   }
+   CPU_set16bitRegisterValue (cpu, PC, 0xC000);
+
+   cycles = CPU_run (cpu, 100000);
+   assert (cycles == 12 + 12 + 8 + 200*(8+4+8) + 4);
+   assert (CPU_get16bitRegisterValue (cpu, PC) == 0xC00D);
+   assert (CPU_get16bitRegisterValue (cpu, HL) == 1400);
+
+   /* Self modifying code: the loop now increments HL instead */
+   MMU_writeByte (mmu, 0xC008, 0x23);
+   CPU_set16bitRegisterValue (cpu, PC, 0xC000);
+
+   cycles = CPU_run (cpu, 100000);
+   assert (cycles == 12 + 12 + 8 + 200*(8+4+8) + 4);
+   assert (CPU_get16bitRegisterValue (cpu, HL) == 200);
+
+   printf ("CPU loop tests passed.\n");
+
+   GB_free (gb);
+}
+
+void testCPUFlags () {
+   GB gb;
+   CPU cpu;
+   MMU mmu;
+   int i;
+   int op, next;
+   int a, b, carry;
+   int second;
+   byte flags;
+   byte expected;
+
+   /* ADD, ADC, SUB, SBC, AND, XOR, OR, CP with B, INC B, DEC B
+      and ADD HL,HL */
+   byte opcodes[] = {
+      0x80, 0x88, 0x90, 0x98, 0xA0, 0xA8, 0xB0, 0xB8, 0x04, 0x05, 0x29
+   };
+
+   /* INC B and DEC B, which keep the carry, each run straight after
+      the instructions above */
+   byte keeping[] = { 0x04, 0x05 };
+
+   /* Runs the instruction at 0xC000 then looks at its flags through
+      a conditional jump on each of C and Z, and through PUSH AF */
+   byte program[] = {
+      0x00,             /* ALU instruction under test */
+      0x30, 0x02,       /* JR NC,+2   */
+      0x16, 0x01,       /* LD D,1     */
+      0x20, 0x02,       /* JR NZ,+2   */
+      0x1E, 0x01,       /* LD E,1     */
+      0xF5,             /* PUSH AF    */
+      0x76              /* HALT       */
+   };
+
+   printf ("Testing CPU flags...\n");
+
+   gb = GB_init ();
+   mmu = GB_getMMU (gb);
+   cpu = GB_getCPU (gb);
+
+   GB_loadRom (gb, "ROMS/test1.ROM");
+
+   for (op = 0; op < sizeof(opcodes); op++) {
+      program[0] = opcodes[op];
+      for (i = 0; i < sizeof(program); i++) {
+         MMU_writeByte (mmu, 0xC000 + i, program[i]);
+      }
+
+      for (a = 0; a < 0x100; a++) {
+         for (b = 0; b < 0x100; b++) {
+            for (carry = 0; carry < 2; carry++) {
+               /* Every flag set or none, so the ones an instruction
+                  leaves alone are checked too, and some of the unused
+                  low bits */
+               flags = carry ? 0xFA : 0x05;
+
+               CPU_set8bitRegisterValue (cpu, A, a);
+               CPU_set8bitRegisterValue (cpu, B, b);
+               CPU_set16bitRegisterValue (cpu, HL, (a << 8) | b);
+               CPU_set16bitRegisterValue (cpu, DE, 0);
+               CPU_set8bitRegisterValue (cpu, F, flags);
+               CPU_set16bitRegisterValue (cpu, SP, 0xDFF0);
+               CPU_set16bitRegisterValue (cpu, PC, 0xC000);
+
+               CPU_run (cpu, 1000);
+
+               expected = expectedFlags (opcodes[op], a, b, flags);
+               assert (CPU_get16bitRegisterValue (cpu, PC) == 0xC00B);
+               assert (CPU_get8bitRegisterValue (cpu, F) == expected);
+               assert (MMU_readByte (mmu, 0xDFEE) == expected);
+               assert ((CPU_get8bitRegisterValue (cpu, D) == 1) ==
+                       ((expected & 0x10) != 0));
+               assert ((CPU_get8bitRegisterValue (cpu, E) == 1) ==
+                       ((expected & 0x80) != 0));
+            }
+         }
+      }
+   }
+
+   /* Same again with the second instruction in front of the JRs */
+   for (op = 0; op < sizeof(opcodes); op++) {
+      for (next = 0; next < sizeof(keeping); next++) {
+         MMU_writeByte (mmu, 0xC000, opcodes[op]);
+         MMU_writeByte (mmu, 0xC001, keeping[next]);
+         for (i = 1; i < sizeof(program); i++) {
+            MMU_writeByte (mmu, 0xC001 + i, program[i]);
+         }
+
+         for (a = 0; a < 0x100; a++) {
+            for (b = 0; b < 0x100; b++) {
+               for (carry = 0; carry < 2; carry++) {
+                  flags = carry ? 0xFA : 0x05;
+
+                  CPU_set8bitRegisterValue (cpu, A, a);
+                  CPU_set8bitRegisterValue (cpu, B, b);
+                  CPU_set16bitRegisterValue (cpu, HL, (a << 8) | b);
+                  CPU_set16bitRegisterValue (cpu, DE, 0);
+                  CPU_set8bitRegisterValue (cpu, F, flags);
+                  CPU_set16bitRegisterValue (cpu, SP, 0xDFF0);
+                  CPU_set16bitRegisterValue (cpu, PC, 0xC000);
+
+                  CPU_run (cpu, 1000);
+
+                  /* B has only been changed by the first instruction
+                     if it was INC B or DEC B */
+                  second = b;
+                  if (opcodes[op] == 0x04) second = (b + 1) & 0xFF;
+                  if (opcodes[op] == 0x05) second = (b - 1) & 0xFF;
+                  expected = expectedFlags (opcodes[op], a, b, flags);
+                  expected = expectedFlags (keeping[next], a, second,
+                                            expected);
+                  assert (CPU_get16bitRegisterValue (cpu, PC) == 0xC00C);
+                  assert (CPU_get8bitRegisterValue (cpu, F) == expected);
+                  assert (MMU_readByte (mmu, 0xDFEE) == expected);
+                  assert ((CPU_get8bitRegisterValue (cpu, D) == 1) ==
+                          ((expected & 0x10) != 0));
+                  assert ((CPU_get8bitRegisterValue (cpu, E) == 1) ==
+                          ((expected & 0x80) != 0));
+               }
+            }
+         }
+      }
+   }
+
+   printf ("CPU flag tests passed.\n");
+
+   GB_free (gb);
+}
+
+/* The flags the instructions in testCPUFlags should leave, following
+   the same rules as the helpers in CPU_instructions.c */
+byte expectedFlags (byte opcode, int a, int b, byte flags) {
+   int carry = (flags & 0x10) ? 1 : 0;
+   int result;
+   byte expected = 0;
+
+   switch (opcode) {
+      case 0x88:
+         b += carry;
+         /* Fall through */
+      case 0x80:
+         result = a + b;
+         if ((result & 0xFF) == 0) expected |= 0x80;
+         if ((result & 0xF) < (a & 0xF)) expected |= 0x20;
+         if (result > 0xFF) expected |= 0x10;
+         break;
+      case 0x98:
+         b += carry;
+         /* Fall through */
+      case 0x90:
+      case 0xB8:
+         result = a - b;
+         expected = 0x40;
+         if (result == 0) expected |= 0x80;
+         if ((result & 0xF) > (a & 0xF)) expected |= 0x20;
+         if (result < 0) expected |= 0x10;
+         break;
+      case 0xA0:
+         expected = 0x20;
+         if ((a & b) == 0) expected |= 0x80;
+         break;
+      case 0xA8:
+         if ((a ^ b) == 0) expected |= 0x80;
+         break;
+      case 0xB0:
+         if ((a | b) == 0) expected |= 0x80;
+         break;
+      case 0x04:
+         result = b + 1;
+         expected = flags & 0x1F;
+         if ((result & 0xFF) == 0) expected |= 0x80;
+         if ((result & 0xF) < (b & 0xF)) expected |= 0x20;
+         break;
+      case 0x05:
+         result = b - 1;
+         expected = (flags & 0x1F) | 0x40;
+         if (result == 0) expected |= 0x80;
+         if ((result & 0xF) > (b & 0xF)) expected |= 0x20;
+         break;
+      case 0x29:
+         /* HL is (a << 8) | b */
+         result = ((a << 8) | b) * 2;
+         expected = flags & 0x8F;
+         if ((result & 0xF00) < ((a << 8) & 0xF00)) expected |= 0x20;
+         if (result > 0xFFFF) expected |= 0x10;
+         break;
+   }
+
+   return expected;
+}
+
+void testCPUDAA () {
+   GB gb;
+   CPU cpu;
+   MMU mmu;
+   int i;
+   int x, y;
+   int sum, difference;
+
+   /* Adds then subtracts two BCD numbers, keeping the adjusted sum
+      in C and the adjusted difference in A */
+   byte program[] = {
+      0x80,             /* ADD A,B    */
+      0x27,             /* DAA        */
+      0x4F,             /* LD C,A     */
+      0x9F,             /* SBC A,A    */
+      0x57,             /* LD D,A     */
+      0x7B,             /* LD A,E     */
+      0x90,             /* SUB B      */
+      0x27,             /* DAA        */
+      0x76              /* HALT       */
+   };
+
+   printf ("Testing DAA...\n");
+
+   gb = GB_init ();
+   mmu = GB_getMMU (gb);
+   cpu = GB_getCPU (gb);
+
+   GB_loadRom (gb, "ROMS/test1.ROM");
+
+   for (i = 0; i < sizeof(program); i++) {
+      MMU_writeByte (mmu, 0xC000 + i, program[i]);
+   }
+
+   for (x = 0; x < 100; x++) {
+      for (y = 0; y < 100; y++) {
+         CPU_set8bitRegisterValue (cpu, A, ((x / 10) << 4) | (x % 10));
+         CPU_set8bitRegisterValue (cpu, E, ((x / 10) << 4) | (x % 10));
+         CPU_set8bitRegisterValue (cpu, B, ((y / 10) << 4) | (y % 10));
+         CPU_set16bitRegisterValue (cpu, PC, 0xC000);
+
+         CPU_run (cpu, 1000);
+
+         sum = (x + y) % 100;
+         difference = (x - y + 100) % 100;
+
+         /* D is 0xFF if the sum carried */
+         assert (CPU_get8bitRegisterValue (cpu, C) ==
+                 (((sum / 10) << 4) | (sum % 10)));
+         assert ((CPU_get8bitRegisterValue (cpu, D) == 0xFF) == (x + y >= 100));
+         assert (CPU_get8bitRegisterValue (cpu, A) ==
+                 (((difference / 10) << 4) | (difference % 10)));
+         assert ((CPU_isCarrySet (cpu) != 0) == (x < y));
+         assert ((CPU_isZeroSet (cpu) != 0) == (difference == 0));
+      }
+   }
+
+   printf ("DAA tests passed.\n");
+
+   GB_free (gb);
+}
+
+void testCPUIdioms () {
+   GB stepped, run;
+   MMU mmu;
+   CPU cpu;
+   Uint8 frames[2][WINDOW_WIDTH * NUM_VISIBLE_SCANLINES];
+   int test;
+   int budget;
+   int i;
+   int cycles;
+
+   /* Copy and fill loops (recognised by the CPU when built with
+      IDIOMS=1) loaded at 0xC100, each ending in HALT */
+   byte programs[][9] = {
+      /* Copy from ROM to VRAM counting with BC */
+      { 0x2A, 0x12, 0x13, 0x0B, 0x78, 0xB1, 0x20, 0xF8, 0x76 },
+      /* Copy from (DE) to (HL-) counting with C */
+      { 0x1A, 0x32, 0x13, 0x0D, 0x20, 0xFA, 0x76 },
+      /* Fill (HL+) 256 times counting with B */
+      { 0x22, 0x05, 0x20, 0xFC, 0x76 },
+      /* Copy HALTs over the top of the loop, which stops it */
+      { 0x2A, 0x12, 0x13, 0x0B, 0x79, 0xB0, 0x20, 0xF8, 0x76 }
+   };
+   int sizes[] = { 9, 7, 5, 9 };
+
+   /* AF, BC, DE and HL for each program */
+   word registers[][4] = {
+      { 0x0000, 0x0180, 0x8000, 0x0150 },
+      { 0x0010, 0x0040, 0xC800, 0xCA00 },
+      { 0x5AF0, 0x0000, 0x0000, 0xD000 },
+      { 0x0000, 0x0040, 0xC0F0, 0xD800 }
+   };
+
+   /* Budgets small enough to stop the loops part way through */
+   int budgets[] = { 1000000, 100, 37 };
+
+   /* Waits for LY 40 and fills the first 8 rows of the tile map with
+      tile 1 while the lines are drawn, then turns the LCD off in
+      V-Blank to keep the frame */
+   byte fillWhileDrawing[] = {
+      0xF0, 0x44,       /* LDH A,(0x44) */
+      0xFE, 0x28,       /* CP 40        */
+      0x20, 0xFA,       /* JR NZ,-6     */
+      0x21, 0x00, 0x98, /* LD HL,0x9800 */
+      0x3E, 0x01,       /* LD A,1       */
+      0x0E, 0x00,       /* LD C,0       */
+      0x22,             /* LD (HL+),A   */
+      0x0D,             /* DEC C        */
+      0x20, 0xFC,       /* JR NZ,-4     */
+      0xF0, 0x44,       /* LDH A,(0x44) */
+      0xFE, 0x90,       /* CP 144       */
+      0x20, 0xFA,       /* JR NZ,-6     */
+      0xAF,             /* XOR A        */
+      0xE0, 0x40,       /* LDH (0x40),A */
+      0x76              /* HALT         */
+   };
+
+   printf ("Testing CPU idioms...\n");
+
+   for (test = 0; test < 4; test++) {
+      /* One instruction at a time */
+      stepped = loadTestProgram (programs[test], sizes[test], registers[test]);
+      cycles = runUntilHalt (stepped, 0, 0);
+
+      for (budget = 0; budget < 3; budget++) {
+         run = loadTestProgram (programs[test], sizes[test], registers[test]);
+         assert (runUntilHalt (run, budgets[budget], cycles) == cycles);
+
+         for (i = 0; i < NUM_REGISTERS; i++) {
+            assert (CPU_get16bitRegisterValue (GB_getCPU (stepped), i) ==
+                    CPU_get16bitRegisterValue (GB_getCPU (run), i));
+         }
+         assert (memcmp (MMU_getMemory (GB_getMMU (stepped)) + 0x8000,
+                         MMU_getMemory (GB_getMMU (run)) + 0x8000,
+                         0x6000) == 0);
+
+         GB_free (run);
+      }
+
+      GB_free (stepped);
+   }
+
+   /* Filling the tile map while the GPU draws from it shows the same
+      lines filled in as running it one instruction at a time */
+   for (test = 0; test < 2; test++) {
+      run = loadTestProgram (fillWhileDrawing, sizeof(fillWhileDrawing),
+                             registers[0]);
+      mmu = GB_getMMU (run);
+      cpu = GB_getCPU (run);
+      for (i = 0x8010; i < 0x8020; i++) {
+         MMU_writeByte (mmu, i, 0xFF);
+      }
+      MMU_writeByte (mmu, 0xFF47, 0xE4);
+      MMU_writeByte (mmu, 0xFFFF, 0);
+      CPU_setIME (cpu, FALSE);
+      MMU_writeByte (mmu, 0xFF40, 0x91);
+
+      while (CPU_get16bitRegisterValue (cpu, PC) !=
+             0xC100 + sizeof(fillWhileDrawing)) {
+         if (test == 0) {
+            GB_step (run);
+         } else {
+            GB_runCycles (run, FRAME_CYCLES);
+         }
+      }
+      memcpy (frames[test], GUI_getFramebuffer (GB_getGUI (run)),
+              sizeof(frames[test]));
+
+      GB_free (run);
+   }
+   assert (memcmp (frames[0], frames[1], sizeof(frames[0])) == 0);
+
+   /* Drawn before and after the fill got to their rows */
+   assert (frames[0][45 * WINDOW_WIDTH] == COLOUR_WHITE);
+   assert (frames[0][60 * WINDOW_WIDTH] == COLOUR_BLACK);
+
+   printf ("CPU idiom tests passed.\n");
+}
+
+void testIdleLoops () {
+   GB gbs[2];
+   MMU mmu;
+   int test;
+   int frame;
+   int i, r;
+   long cycles[2];
+
+   /* DIV, TIMA, IF, STAT and LY */
+   word timing[] = { 0xFF04, 0xFF05, 0xFF0F, 0xFF41, 0xFF44 };
+
+   /* Polling loops loaded at 0xC100, each followed by reading TIMA
+      (to see when the loop was left) and HALT */
+   byte programs[][9] = {
+      /* Wait for LY to reach 144 */
+      { 0xF0, 0x44, 0xFE, 0x90, 0x20, 0xFA, 0xF0, 0x05, 0x76 },
+      /* Wait for the timer to request an interrupt */
+      { 0xF0, 0x0F, 0xE6, 0x04, 0x28, 0xFA, 0xF0, 0x05, 0x76 },
+      /* Same again, through (HL) and BIT */
+      { 0xCB, 0x56, 0x00, 0x28, 0xFB, 0xF0, 0x05, 0x76 }
+   };
+   int sizes[] = { 9, 9, 8 };
+   word registers[] = { 0x0000, 0x0000, 0x0000, 0xFF0F };
+
+   /* Read LY forever, then INC A forever in its place */
+   byte polling[] = { 0xF0, 0x44, 0x18, 0xFC };
+   byte counting[] = { 0x3C, 0x00, 0x18, 0xFC };
+
+   printf ("Testing idle loops...\n");
+
+   for (test = 0; test < 3; test++) {
+      /* Without skipping, then with */
+      for (i = 0; i < 2; i++) {
+         gbs[i] = loadTestProgram (programs[test], sizes[test], registers);
+         mmu = GB_getMMU (gbs[i]);
+
+         CPU_setIME (GB_getCPU (gbs[i]), FALSE);
+         MMU_writeByte (mmu, 0xFF0F, 0);
+         MMU_writeByte (mmu, 0xFFFF, 0);
+         MMU_writeByte (mmu, 0xFF04, 0);
+         MMU_writeByte (mmu, 0xFF44, 0);
+         MMU_writeByte (mmu, 0xFF07, 0x05);
+
+         GB_setIdleSkipping (gbs[i], i == 1);
+
+         /* Long enough to get out of the loop and halt for good */
+         cycles[i] = 0;
+         for (frame = 0; frame < 2; frame++) {
+            cycles[i] += GB_runCycles (gbs[i], FRAME_CYCLES);
+         }
+         assert (CPU_get16bitRegisterValue (GB_getCPU (gbs[i]), PC) ==
+                 0xC100 + sizes[test]);
+      }
+
+      assert (GB_getSkippedCycles (gbs[0]) == 0);
+      assert (GB_getSkippedCycles (gbs[1]) > 0);
+      assert (GB_getIdleLoopSkips (gbs[1]) > 0);
+
+      /* Leaves the loop at the same time (TIMA was read into A as it
+         did) with everything the same */
+      assert (cycles[0] == cycles[1]);
+      for (r = 0; r < NUM_REGISTERS; r++) {
+         assert (CPU_get16bitRegisterValue (GB_getCPU (gbs[0]), r) ==
+                 CPU_get16bitRegisterValue (GB_getCPU (gbs[1]), r));
+      }
+      for (r = 0; r < 5; r++) {
+         assert (MMU_readByte (GB_getMMU (gbs[0]), timing[r]) ==
+                 MMU_readByte (GB_getMMU (gbs[1]), timing[r]));
+      }
+
+      GB_free (gbs[0]);
+      GB_free (gbs[1]);
+   }
+
+   /* A polling loop in RAM rewritten into one that does work, which
+      must not be skipped as the old loop */
+   for (i = 0; i < 2; i++) {
+      gbs[i] = loadTestProgram (polling, sizeof(polling), registers);
+      mmu = GB_getMMU (gbs[i]);
+
+      CPU_setIME (GB_getCPU (gbs[i]), FALSE);
+      MMU_writeByte (mmu, 0xFFFF, 0);
+      GB_setIdleSkipping (gbs[i], i == 1);
+      GB_runCycles (gbs[i], 1000);
+
+      for (r = 0; r < (int) sizeof(counting); r++) {
+         MMU_writeByte (mmu, 0xC100 + r, counting[r]);
+      }
+      CPU_set8bitRegisterValue (GB_getCPU (gbs[i]), A, 0);
+      GB_runCycles (gbs[i], 1600);
+   }
+
+   assert (CPU_get8bitRegisterValue (GB_getCPU (gbs[0]), A) > 50);
+   assert (CPU_get8bitRegisterValue (GB_getCPU (gbs[0]), A) ==
+           CPU_get8bitRegisterValue (GB_getCPU (gbs[1]), A));
+
+   GB_free (gbs[0]);
+   GB_free (gbs[1]);
+
+   printf ("Idle loop tests passed.\n");
+}
+
+void testHalt () {
+   GB gbs[2];
+   MMU mmu;
+   int test;
+   int i, r;
+   int steps[2];
+
+   /* HALT until woken, read TIMA (to see when) and set B, then go
+      round in a loop */
+   byte program[] = { 0x76, 0xF0, 0x05, 0x06, 0x55, 0x18, 0xFE };
+   word registers[] = { 0x0000, 0x0000, 0x0000, 0x0000 };
+
+   /* Woken by V-Blank, then by the timer, with the IME clear */
+   byte enabled[] = { 0x01, 0x04 };
+
+   printf ("Testing HALT...\n");
+
+   for (test = 0; test < 2; test++) {
+      /* NOPs 4 cycles at a time, then a frame at a time, where slices
+         go straight to the next event */
+      for (i = 0; i < 2; i++) {
+         gbs[i] = loadTestProgram (program, sizeof(program), registers);
+         mmu = GB_getMMU (gbs[i]);
+
+         CPU_setIME (GB_getCPU (gbs[i]), FALSE);
+         MMU_writeByte (mmu, 0xFF0F, 0);
+         MMU_writeByte (mmu, 0xFFFF, enabled[test]);
+         MMU_writeByte (mmu, 0xFF04, 0);
+         MMU_writeByte (mmu, 0xFF44, 0);
+         MMU_writeByte (mmu, 0xFF07, 0x05);
+
+         steps[i] = 0;
+         while (CPU_get8bitRegisterValue (GB_getCPU (gbs[i]), B) != 0x55) {
+            if (i == 0) {
+               GB_step (gbs[i]);
+            } else {
+               GB_runCycles (gbs[i], FRAME_CYCLES);
+            }
+            steps[i]++;
+         }
+      }
+
+      /* Wakes at the same time, without going round for every NOP */
+      assert (steps[1] * 10 < steps[0]);
+      for (r = 0; r < NUM_REGISTERS; r++) {
+         assert (CPU_get16bitRegisterValue (GB_getCPU (gbs[0]), r) ==
+                 CPU_get16bitRegisterValue (GB_getCPU (gbs[1]), r));
+      }
+
+      GB_free (gbs[0]);
+      GB_free (gbs[1]);
+   }
+
+   printf ("HALT tests passed.\n");
+}
+
+void testRunCycles () {
+   GB gb;
+   MMU mmu;
+   int i;
+   int cycles;
+   word pc;
+
+   /* Wait for LY to reach 144, then HALT */
+   byte program[] = { 0xF0, 0x44, 0xFE, 0x90, 0x20, 0xFA, 0x76 };
+   word registers[] = { 0x0000, 0x0000, 0x0000, 0x0000 };
+
+   printf ("Testing GB_runCycles...\n");
+
+   gb = loadTestProgram (program, 7, registers);
+   mmu = GB_getMMU (gb);
+
+   CPU_setIME (GB_getCPU (gb), FALSE);
+   MMU_writeByte (mmu, 0xFF0F, 0);
+   MMU_writeByte (mmu, 0xFFFF, 0);
+   MMU_writeByte (mmu, 0xFF44, 0);
+
+   /* Still polling just before LY gets to 144, halted just after */
+   for (i = 0; i < 65; i++) {
+      cycles = GB_runCycles (gb, 1000);
+      assert (cycles >= 1000 - 64 && cycles < 1000 + 64);
+   }
+   pc = CPU_get16bitRegisterValue (GB_getCPU (gb), PC);
+   assert (pc >= 0xC100 && pc < 0xC106);
+   assert (MMU_readByte (mmu, 0xFF44) == 142);
+
+   GB_runCycles (gb, 1000);
+   assert (CPU_get16bitRegisterValue (GB_getCPU (gb), PC) == 0xC107);
+   assert (MMU_readByte (mmu, 0xFF44) == 144);
+
+   /* Going over is made up for on the next call */
+   assert (GB_getCycles (gb) >= 66000 && GB_getCycles (gb) < 66000 + 64);
+
+   /* Whole frames end on the same line each time */
+   GB_runFrame (gb);
+   assert (MMU_readByte (mmu, 0xFF44) == 144);
+   GB_runFrame (gb);
+   assert (MMU_readByte (mmu, 0xFF44) == 144);
+   assert (GB_getCycles (gb) >= 66000 + 2 * FRAME_CYCLES &&
+           GB_getCycles (gb) < 66000 + 2 * FRAME_CYCLES + 64);
+
+   GB_free (gb);
+
+   printf ("GB_runCycles tests passed.\n");
+}
+
+void testScheduler () {
+   Scheduler scheduler;
+   GB gb;
+   MMU mmu;
+   long long start;
+
+   /* Wait for the timer to request an interrupt, then HALT */
+   byte program[] = { 0xF0, 0x0F, 0xE6, 0x04, 0x28, 0xFA, 0x76 };
+   word registers[] = { 0x0000, 0x0000, 0x0000, 0x0000 };
+
+   printf ("Testing the scheduler...\n");
+
+   scheduler = Scheduler_init ();
+   assert (Scheduler_getNextTime (scheduler) == SCHEDULER_NEVER);
+   assert (Scheduler_nextDueEvent (scheduler, 0) == NO_EVENT);
+
+   /* Earliest first, only once due */
+   Scheduler_schedule (scheduler, EVENT_TIMER, 300);
+   Scheduler_schedule (scheduler, EVENT_GPU, 200);
+   assert (Scheduler_getNextTime (scheduler) == 200);
+   assert (Scheduler_nextDueEvent (scheduler, 199) == NO_EVENT);
+   assert (Scheduler_nextDueEvent (scheduler, 400) == EVENT_GPU);
+   assert (Scheduler_nextDueEvent (scheduler, 400) == EVENT_TIMER);
+   assert (Scheduler_nextDueEvent (scheduler, 400) == NO_EVENT);
+
+   /* Rescheduling moves an event either way rather than adding it */
+   Scheduler_schedule (scheduler, EVENT_GPU, 500);
+   Scheduler_schedule (scheduler, EVENT_TIMER, 600);
+   Scheduler_schedule (scheduler, EVENT_TIMER, 100);
+   assert (Scheduler_getNextTime (scheduler) == 100);
+   Scheduler_schedule (scheduler, EVENT_TIMER, 700);
+   assert (Scheduler_getNextTime (scheduler) == 500);
+
+   Scheduler_cancel (scheduler, EVENT_GPU);
+   assert (Scheduler_getNextTime (scheduler) == 700);
+   assert (Scheduler_nextDueEvent (scheduler, 1000) == EVENT_TIMER);
+   assert (Scheduler_getNextTime (scheduler) == SCHEDULER_NEVER);
+
+   Scheduler_free (scheduler);
+
+   /* A timer set up part way through a slice overflows on time */
+   gb = loadTestProgram (program, 7, registers);
+   mmu = GB_getMMU (gb);
+
+   CPU_setIME (GB_getCPU (gb), FALSE);
+   MMU_writeByte (mmu, 0xFF0F, 0);
+   MMU_writeByte (mmu, 0xFFFF, 0);
+   MMU_writeByte (mmu, 0xFF07, 0);
+   GB_runCycles (gb, 1000);
+
+   MMU_writeByte (mmu, 0xFF06, 0);
+   MMU_writeByte (mmu, 0xFF05, 0);
+   MMU_writeByte (mmu, 0xFF07, 0x04);
+   start = GB_getCycles (gb);
+
+   /* 1024 cycles a tick, the first one whenever the divider gets
+      there */
+   while (CPU_get16bitRegisterValue (GB_getCPU (gb), PC) != 0xC107) {
+      GB_runCycles (gb, 1000);
+   }
+   assert (GB_getCycles (gb) - start >= 0xFF * 1024 &&
+           GB_getCycles (gb) - start < 0x100 * 1024 + 1000 + 64);
+
+   GB_free (gb);
+
+   printf ("Scheduler tests passed.\n");
+}
+
+void testTimer () {
+   GB gb;
+   MMU mmu;
+   long long start;
+   long long elapsed;
+   byte timer;
+   int test;
+   int edges[2] = { 0, 0 };
+
+   /* Spin */
+   byte program[] = { 0x18, 0xFE };
+   word registers[] = { 0x0000, 0x0000, 0x0000, 0x0000 };
+
+   printf ("Testing the timer...\n");
+
+   gb = loadTestProgram (program, 2, registers);
+   mmu = GB_getMMU (gb);
+
+   CPU_setIME (GB_getCPU (gb), FALSE);
+   MMU_writeByte (mmu, 0xFFFF, 0);
+   GB_runCycles (gb, 1000);
+
+   /* DIV and TIMA count from when DIV was reset, every 256 and (with
+      TAC 5) every 16 cycles */
+   MMU_writeByte (mmu, 0xFF04, 0);
+   MMU_writeByte (mmu, 0xFF05, 0);
+   MMU_writeByte (mmu, 0xFF06, 0);
+   MMU_writeByte (mmu, 0xFF07, 0x05);
+   MMU_writeByte (mmu, 0xFF0F, 0);
+   start = GB_getCycles (gb);
+
+   GB_runCycles (gb, 3000);
+   elapsed = GB_getCycles (gb) - start;
+   assert (MMU_readByte (mmu, 0xFF04) == elapsed / 256);
+   assert (MMU_readByte (mmu, 0xFF05) == elapsed / 16);
+   assert (!(MMU_readByte (mmu, 0xFF0F) & 0x04));
+
+   /* Overflows reload from TMA and request an interrupt */
+   MMU_writeByte (mmu, 0xFF06, 0xF0);
+   GB_runCycles (gb, 16 * 0x100);
+   elapsed = GB_getCycles (gb) - start;
+   assert (MMU_readByte (mmu, 0xFF05) == 0xF0 + (elapsed / 16 - 0x100) % 0x10);
+   assert (MMU_readByte (mmu, 0xFF0F) & 0x04);
+
+   /* Resetting DIV or turning the timer off while the counter bit is
+      set is a falling edge, so TIMA goes up one */
+   for (test = 0; test < 64; test++) {
+      MMU_writeByte (mmu, 0xFF05, 0);
+      MMU_writeByte (mmu, 0xFF07, 0x05);
+      GB_runCycles (gb, 4 + test % 8);
+
+      elapsed = GB_getCycles (gb) - start;
+      timer = MMU_readByte (mmu, 0xFF05);
+
+      if (test % 2 == 0) {
+         MMU_writeByte (mmu, 0xFF04, 0);
+         start = GB_getCycles (gb);
+      } else {
+         MMU_writeByte (mmu, 0xFF07, 0x01);
+      }
+
+      if (elapsed & 8) {
+         assert (MMU_readByte (mmu, 0xFF05) == timer + 1);
+         edges[test % 2]++;
+      } else {
+         assert (MMU_readByte (mmu, 0xFF05) == timer);
+      }
+   }
+   assert (edges[0] > 0 && edges[1] > 0);
+
+   GB_free (gb);
+
+   printf ("Timer tests passed.\n");
+}
+
+void testGPUCatchUp () {
+   GB gb;
+   MMU mmu;
+   byte *memory;
+   int i;
+   int run;
+
+   /* Stores LY to (HL+) every 28 cycles */
+   byte program[] = {
+      0xF0, 0x44,       /* LDH A,(44) */
+      0x22,             /* LD (HL+),A */
+      0x18, 0xFB        /* JR -5      */
+   };
+   word registers[] = { 0x0000, 0x0000, 0x0000, 0xC800 };
+
+   printf ("Testing GPU catch up...\n");
+
+   gb = loadTestProgram (program, sizeof(program), registers);
+   mmu = GB_getMMU (gb);
+   memory = MMU_getMemory (mmu);
+
+   CPU_setIME (GB_getCPU (gb), FALSE);
+   MMU_writeByte (mmu, 0xFFFF, 0);
+   MMU_writeByte (mmu, 0xFF40, 0x91);
+   MMU_writeByte (mmu, 0xFF0F, 0);
+
+   /* LY read in the middle of a slice is up to date, so it goes up
+      one every 16 or 17 reads */
+   GB_runCycles (gb, 0x800 * 28);
+   run = -1;
+   for (i = 0xC801; i < 0xC800 + 0x800; i++) {
+      if (memory[i] == memory[i - 1]) {
+         if (run >= 0) {
+            run++;
+         }
+      } else {
+         assert (memory[i] == (memory[i - 1] + 1) % 154);
+         assert (run < 0 || run == 16 || run == 17);
+         run = 1;
+      }
+   }
+
+   /* And on into V-Blank, well short of the stores reaching the
+      program through echo RAM */
+   GB_runCycles (gb, 0x400 * 28);
+   assert (MMU_readByte (mmu, 0xFF0F) & 0x01);
+
+   GB_free (gb);
+
+   printf ("GPU catch up tests passed.\n");
+}
+
+void testInterrupts () {
+   GB gb;
+   CPU cpu;
+   MMU mmu;
+   int test;
+
+   /* EI then DI or INC B, then HALT */
+   byte programs[][4] = {
+      { 0xFB, 0x04, 0x04, 0x76 },
+      { 0xFB, 0xF3, 0x04, 0x76 }
+   };
+   word registers[] = { 0x0000, 0x0000, 0x0000, 0x0000 };
+
+   /* EI in front of a polling loop: LD A,(0xC1F0); AND A; JR Z,-6 */
+   byte polling[] = { 0xFB, 0xFA, 0xF0, 0xC1, 0xA7, 0x28, 0xFA };
+
+   /* Enables or requests the timer interrupt, then counts in B:
+      LD A,4; LDH (n),A; INC B; JR -3 */
+   byte enabling[][7] = {
+      { 0x3E, 0x04, 0xE0, 0xFF, 0x04, 0x18, 0xFD },
+      { 0x3E, 0x04, 0xE0, 0x0F, 0x04, 0x18, 0xFD }
+   };
+
+   printf ("Testing interrupts...\n");
+
+   for (test = 0; test < 2; test++) {
+      gb = loadTestProgram (programs[test], 4, registers);
+      mmu = GB_getMMU (gb);
+      cpu = GB_getCPU (gb);
+
+      CPU_setIME (cpu, FALSE);
+      MMU_writeByte (mmu, 0xFF0F, 0);
+      MMU_writeByte (mmu, 0xFFFF, 0x1F);
+      MMU_writeByte (mmu, 0xFF0F, 0x06);
+      assert (MMU_getPendingInterrupts (mmu) == 0x06);
+
+      /* The IME isn't set until the instruction after EI */
+      GB_step (gb);
+      assert (CPU_get16bitRegisterValue (cpu, PC) == 0xC101);
+      GB_step (gb);
+
+      if (test == 0) {
+         /* LCD STAT comes before the timer */
+         assert (CPU_get16bitRegisterValue (cpu, PC) == 0x48);
+         assert (CPU_get8bitRegisterValue (cpu, B) == 1);
+         assert (MMU_readWord (mmu, CPU_get16bitRegisterValue (cpu, SP)) == 0xC102);
+         assert ((MMU_readByte (mmu, 0xFF0F) & 0x1F) == 0x04);
+         assert (MMU_getPendingInterrupts (mmu) == 0x04);
+         assert (!CPU_getIME (cpu));
+      } else {
+         /* DI straight after EI means no interrupt */
+         assert (CPU_get16bitRegisterValue (cpu, PC) == 0xC102);
+         assert (MMU_getPendingInterrupts (mmu) == 0x06);
+      }
+
+      /* Disabling an interrupt takes it out of the pending ones */
+      MMU_writeByte (mmu, 0xFFFF, 0x01);
+      assert (MMU_getPendingInterrupts (mmu) == 0);
+      GB_requestInterrupt (gb, INT_VBLANK);
+      assert (MMU_getPendingInterrupts (mmu) == 0x01);
+
+      GB_free (gb);
+   }
+
+   /* Taken straight after the instruction that makes it pending, not
+      at the end of the slice */
+   for (test = 0; test < 2; test++) {
+      gb = loadTestProgram (enabling[test], 7, registers);
+      mmu = GB_getMMU (gb);
+      cpu = GB_getCPU (gb);
+
+      CPU_setIME (cpu, TRUE);
+      MMU_writeByte (mmu, 0xFF07, 0x00);
+      MMU_writeByte (mmu, 0xFFFF, (test == 0) ? 0x00 : 0x04);
+      MMU_writeByte (mmu, 0xFF0F, (test == 0) ? 0x04 : 0x00);
+      assert (MMU_getPendingInterrupts (mmu) == 0);
+
+      GB_runCycles (gb, 3000);
+      assert (CPU_get16bitRegisterValue (cpu, SP) == 0xFFFC);
+      assert (MMU_readWord (mmu, 0xFFFC) == 0xC104);
+      assert (CPU_get8bitRegisterValue (cpu, B) == 0);
+      assert ((MMU_readByte (mmu, 0xFF0F) & 0x04) == 0);
+
+      GB_free (gb);
+   }
+
+   /* Still the instruction after EI when it starts a polling loop,
+      which isn't skipped with the interrupt due */
+   gb = loadTestProgram (polling, sizeof(polling), registers);
+   mmu = GB_getMMU (gb);
+   cpu = GB_getCPU (gb);
+   CPU_setIME (cpu, FALSE);
+   MMU_writeByte (mmu, 0xFF07, 0x00);
+   MMU_writeByte (mmu, 0xFFFF, 0x04);
+   MMU_writeByte (mmu, 0xFF0F, 0x04);
+
+   GB_runCycles (gb, 3000);
+   assert (CPU_get16bitRegisterValue (cpu, SP) == 0xFFFC);
+   assert (MMU_readWord (mmu, 0xFFFC) == 0xC104);
+   assert (GB_getSkippedCycles (gb) == 0);
+
+   GB_free (gb);
+
+   printf ("Interrupt tests passed.\n");
+}
+
+void testPacer () {
+   Pacer pacer;
+   Timer timer;
+   long long frameTime;
+   int i;
+
+   printf ("Testing the pacer...\n");
+
+   pacer = Pacer_init (FRAME_CYCLES, CLOCK_SPEED);
+   timer = Timer_init ();
+   frameTime = (long long)FRAME_CYCLES * TIMER_SECOND / CLOCK_SPEED;
+
+   assert (Pacer_getLateness (pacer, 50) == -1);
+
+   /* Frames take as long as they would on a Game Boy, even when
+      there is nothing to do in them */
+   Pacer_start (pacer);
+   Timer_start (timer);
+   for (i = 0; i < 6; i++) {
+      Pacer_waitForFrame (pacer);
+   }
+   assert (Timer_getNanoseconds (timer) >= 6 * frameTime);
+   assert (Timer_getNanoseconds (timer) < 60 * frameTime);
+
+   assert (Pacer_getLateness (pacer, 0) >= 0);
+   assert (Pacer_getLateness (pacer, 0) <= Pacer_getLateness (pacer, 50));
+   assert (Pacer_getLateness (pacer, 50) <= Pacer_getLateness (pacer, 99));
+   assert (Pacer_getLateness (pacer, 99) <= Pacer_getLateness (pacer, 100));
+
+   Pacer_start (pacer);
+   assert (Pacer_getLateness (pacer, 100) == -1);
+
+   Timer_free (timer);
+   Pacer_free (pacer);
+
+   printf ("Pacer tests passed.\n");
+}
+
+void testSpeedModes () {
+   GB gb;
+   Timer timer;
+   long long frameTime;
+   int test;
+
+   /* Four times as fast, then uncapped */
+   int speeds[] = { 4, GB_SPEED_UNCAPPED };
+
+   /* Spin */
+   byte program[] = { 0x18, 0xFE };
+   word registers[] = { 0x0000, 0x0000, 0x0000, 0x0000 };
+
+   printf ("Testing speed modes...\n");
+
+   frameTime = (long long)FRAME_CYCLES * TIMER_SECOND / CLOCK_SPEED;
+   timer = Timer_init ();
+
+   for (test = 0; test < 2; test++) {
+      gb = loadTestProgram (program, 2, registers);
+      CPU_setIME (GB_getCPU (gb), FALSE);
+
+      GB_setSpeed (gb, speeds[test]);
+      GB_setFrameSkip (gb, 3);
+      GB_setFrameLimit (gb, 8);
+
+      Timer_reset (timer);
+      Timer_start (timer);
+      GB_run (gb);
+      Timer_stop (timer);
+
+      /* Stops after the frame limit whatever the speed */
+      assert (GB_getCycles (gb) >= 8 * FRAME_CYCLES);
+      assert (GB_getCycles (gb) < 9 * FRAME_CYCLES);
+      if (speeds[test] != GB_SPEED_UNCAPPED) {
+         assert (Timer_getNanoseconds (timer) >= 8 * frameTime / speeds[test]);
+      }
+
+      GB_free (gb);
+   }
+
+   Timer_free (timer);
+
+   printf ("Speed mode tests passed.\n");
+}
+
+void testAccessTiming () {
+   GB gb;
+   MMU mmu;
+   CPU cpu;
+   int test;
+
+   /* NOP then LD A,(FF05), which reads TIMA in its fourth M-cycle,
+      16 cycles in */
+   byte program[] = { 0x00, 0xFA, 0x05, 0xFF, 0x76 };
+   word registers[] = { 0x0000, 0x0000, 0x0000, 0x0000 };
+
+   printf ("Testing memory access timing...\n");
+
+   /* With GB_step, then GB_runCycles */
+   for (test = 0; test < 2; test++) {
+      gb = loadTestProgram (program, sizeof(program), registers);
+      mmu = GB_getMMU (gb);
+      cpu = GB_getCPU (gb);
+
+      CPU_setIME (cpu, FALSE);
+      MMU_writeByte (mmu, 0xFFFF, 0);
+
+      /* TIMA goes up every 16 cycles from now */
+      MMU_writeByte (mmu, 0xFF04, 0);
+      MMU_writeByte (mmu, 0xFF05, 0);
+      MMU_writeByte (mmu, 0xFF07, 0x05);
+
+      if (test == 0) {
+         GB_step (gb);
+         GB_step (gb);
+      } else {
+         GB_runCycles (gb, 20);
+      }
+      assert (CPU_get16bitRegisterValue (cpu, PC) >= 0xC104);
+
+#ifdef CPU_ACCURATE
+      /* The read happens when the LD gets to it */
+      assert (CPU_get8bitRegisterValue (cpu, A) == 1);
+#else
+      /* The whole LD happens when it starts */
+      assert (CPU_get8bitRegisterValue (cpu, A) == 0);
+#endif
+
+      GB_free (gb);
+   }
+
+   printf ("Memory access timing tests passed.\n");
+}
+
+void testProfiler () {
+   GB gb;
+   Profiler profiler;
+   Timer timer;
+   int s;
+
+   /* Stores LY to (HL+) */
+   byte program[] = { 0xF0, 0x44, 0x22, 0x18, 0xFB };
+   word registers[] = { 0x0000, 0x0000, 0x0000, 0xC800 };
+
+   printf ("Testing the profiler...\n");
+
+   /* Time is charged to whatever was switched to */
+   profiler = Profiler_init ();
+   timer = Timer_init ();
+
+   Profiler_switch (profiler, SUBSYSTEM_GPU);
+   Timer_start (timer);
+   while (Timer_getNanoseconds (timer) < 1000000) {
+   }
+   assert (Profiler_switch (profiler, SUBSYSTEM_CPU) == SUBSYSTEM_GPU);
+   assert (Profiler_getTime (profiler, SUBSYSTEM_GPU) == 0);
+
+   Profiler_setEnabled (profiler, TRUE);
+   Profiler_switch (profiler, SUBSYSTEM_GPU);
+   Timer_reset (timer);
+   while (Timer_getNanoseconds (timer) < 1000000) {
+   }
+   Profiler_switch (profiler, SUBSYSTEM_CPU);
+   assert (Profiler_getTime (profiler, SUBSYSTEM_GPU) >= 1000000);
+   assert (Profiler_getTime (profiler, SUBSYSTEM_TIMER) == 0);
+
+   Profiler_reset (profiler);
+   for (s = 0; s < NUM_SUBSYSTEMS; s++) {
+      assert (Profiler_getTime (profiler, s) == 0);
+   }
+
+   Timer_free (timer);
+   Profiler_free (profiler);
+
+   /* The GB charges the CPU and GPU for running a program that polls
+      LY, and ends up back on the CPU */
+   gb = loadTestProgram (program, sizeof(program), registers);
+   CPU_setIME (GB_getCPU (gb), FALSE);
+   MMU_writeByte (GB_getMMU (gb), 0xFF40, 0x91);
+
+   profiler = GB_getProfiler (gb);
+   GB_setProfiling (gb, TRUE);
+   GB_runCycles (gb, 0x400 * 28);
+
+   assert (Profiler_getTime (profiler, SUBSYSTEM_CPU) > 0);
+   assert (Profiler_getTime (profiler, SUBSYSTEM_GPU) > 0);
+   assert (Profiler_getTime (profiler, SUBSYSTEM_IDLE) == 0);
+   assert (Profiler_switch (profiler, SUBSYSTEM_CPU) == SUBSYSTEM_CPU);
+
+   GB_free (gb);
+
+   printf ("Profiler tests passed.\n");
+}
+
+void testCoroutines () {
+   GB gb;
+   MMU mmu;
+   byte expected[0x800];
+   int window;
+   int i;
+
+   struct counter counter;
+
+   /* Stores LY to (HL+) every 28 cycles */
+   byte program[] = {
+      0xF0, 0x44,       /* LDH A,(44) */
+      0x22,             /* LD (HL+),A */
+      0x18, 0xFB        /* JR -5      */
+   };
+   word registers[] = { 0x0000, 0x0000, 0x0000, 0xC800 };
+
+   printf ("Testing coroutines...\n");
+
+   /* Each switch carries on from where the other stopped, with its
+      own locals intact */
+   counter.caller = Coroutine_initThread ();
+   counter.self = Coroutine_init (countInCoroutine, &counter,
+                                  COROUTINE_STACK_SIZE);
+   for (i = 1; i <= 1000; i++) {
+      counter.value = 0;
+      Coroutine_switch (counter.caller, counter.self);
+      assert (counter.value == i);
+   }
+   Coroutine_free (counter.self);
+   Coroutine_free (counter.caller);
+
+   /* However far the GPU is left behind, LY is up to date when read */
+   for (window = 0; window <= 456; window += 57) {
+      gb = loadTestProgram (program, sizeof(program), registers);
+      mmu = GB_getMMU (gb);
+
+      GB_setSyncWindow (gb, window);
+      CPU_setIME (GB_getCPU (gb), FALSE);
+      MMU_writeByte (mmu, 0xFFFF, 0);
+      MMU_writeByte (mmu, 0xFF40, 0x91);
+
+      /* The same LY to start from each time */
+      MMU_writeByte (mmu, 0xFF44, 0);
+
+      GB_runCycles (gb, 0x800 * 28);
+      if (window == 0) {
+         memcpy (expected, &MMU_getMemory (mmu)[0xC800], 0x800);
+      } else {
+         assert (memcmp (expected, &MMU_getMemory (mmu)[0xC800],
+                         0x800) == 0);
+      }
+
+      GB_free (gb);
+   }
+
+   printf ("Coroutine tests passed.\n");
+}
+
+void countInCoroutine (void *argument) {
+   struct counter *counter = (struct counter *)argument;
+   int count = 0;
+
+   for (;;) {
+      count++;
+      counter->value = count;
+      Coroutine_switch (counter->self, counter->caller);
+   }
+}
+
+void testMemoryMap () {
+   GB gb;
+   MMU mmu;
+   Cartridge cartridge;
+   byte *memory;
+   int i;
+
+   printf ("Testing the memory map...\n");
+
+   gb = GB_init ();
+   mmu = GB_getMMU (gb);
+   memory = MMU_getMemory (mmu);
+   cartridge = GB_getCartridge (gb);
+
+   GB_loadRom (gb, "ROMS/test1.ROM");
+
+   /* The ROM banks, which writing to doesn't change */
+   MMU_writeByte (mmu, 0x0001, 0x0A);
+   MMU_writeByte (mmu, 0x4000, 0x00);
+   for (i = 0; i < ROM_BANK_SIZE; i += 0x3F) {
+      assert (MMU_readByte (mmu, i) == Cartridge_getData (cartridge, 0)[i]);
+      assert (MMU_readByte (mmu, 0x4000 + i) ==
+              Cartridge_getData (cartridge, 1)[i]);
+   }
+
+   /* Video RAM, work RAM and OAM read straight from memory, and echo
+      RAM from work RAM */
+   for (i = 0x8000; i < 0xFF00; i += 0x3F) {
+      if (i < 0xA000 || (i >= 0xC000 && i < 0xE000) || i >= 0xFE00) {
+         memory[i] = i * 7;
+         assert (MMU_readByte (mmu, i) == (byte)(i * 7));
+      } else if (i >= 0xE000) {
+         assert (MMU_readByte (mmu, i) == memory[i - 0x2000]);
+      }
+   }
+
+   /* Echo RAM is work RAM up to 0xDDFF, written either way round,
+      and stops short of OAM */
+   MMU_writeByte (mmu, 0xC000, 0x11);
+   assert (MMU_readByte (mmu, 0xE000) == 0x11);
+   MMU_writeByte (mmu, 0xE001, 0x22);
+   assert (MMU_readByte (mmu, 0xC001) == 0x22);
+   MMU_writeByte (mmu, 0xDDFF, 0x33);
+   assert (MMU_readByte (mmu, 0xFDFF) == 0x33);
+   MMU_writeByte (mmu, 0xFDFE, 0x44);
+   assert (MMU_readByte (mmu, 0xDDFE) == 0x44);
+   MMU_writeByte (mmu, 0xFE00, 0x55);
+   MMU_writeByte (mmu, 0xDE00, 0x66);
+   assert (MMU_readByte (mmu, 0xFE00) == 0x55);
+   assert (MMU_readByte (mmu, 0xDE00) == 0x66);
+   MMU_writeByte (mmu, 0xDFFF, 0x77);
+   assert (MMU_readByte (mmu, 0xDFFF) == 0x77);
+
+   /* There's no external RAM to write to */
+   MMU_writeByte (mmu, 0xA000, 0x12);
+   assert (MMU_readByte (mmu, 0xA000) == 0xFF);
+
+   /* The I/O page still goes through the registers' side effects */
+   MMU_writeByte (mmu, 0xFF44, 0x55);
+   assert (MMU_readByte (mmu, 0xFF44) == 0);
+
+   GB_free (gb);
+
+   printf ("Memory map tests passed.\n");
+}
+
+void testMappers () {
+   GB gb;
+   MMU mmu;
+   CPU cpu;
+   int i;
+
+   printf ("Testing mappers...\n");
+
+   /* MBC1 with 2 MB of ROM and 32 kB of RAM. None of these have a
+      battery, so they don't leave save files behind */
+   gb = loadBankedROM (0x02, 128, 0x03);
+   mmu = GB_getMMU (gb);
+
+   assert (readBankNumber (mmu, 0x4000) == 1);
+   MMU_writeByte (mmu, 0x2000, 0x00);
+   assert (readBankNumber (mmu, 0x4000) == 1);
+   MMU_writeByte (mmu, 0x2000, 0x25);
+   MMU_writeByte (mmu, 0x4000, 0x02);
+   assert (readBankNumber (mmu, 0x4000) == 0x45);
+   assert (readBankNumber (mmu, 0x0000) == 0);
+
+   /* Run enough times for the code in bank 0 to be cached */
+   cpu = GB_getCPU (gb);
+   for (i = 0; i < 32; i++) {
+      CPU_set16bitRegisterValue (cpu, PC, 0x0000);
+      runUntilHalt (gb, 0, 0);
+   }
+   assert (CPU_get8bitRegisterValue (cpu, A) == 0);
+
+   /* Mode 1 switches bank 0 and the RAM bank with the top bits too,
+      and the code there with them */
+   MMU_writeByte (mmu, 0x6000, 0x01);
+   assert (readBankNumber (mmu, 0x0000) == 0x40);
+   assert (readBankNumber (mmu, 0x4000) == 0x45);
+   CPU_set16bitRegisterValue (cpu, PC, 0x0000);
+   runUntilHalt (gb, 0, 0);
+   assert (CPU_get8bitRegisterValue (cpu, A) == 0x40);
+
+   /* RAM reads as 0xFF until it's enabled, then each bank is separate */
+   assert (MMU_readByte (mmu, 0xA000) == 0xFF);
+   MMU_writeByte (mmu, 0x0000, 0x0A);
+   for (i = 0; i < 4; i++) {
+      MMU_writeByte (mmu, 0x4000, i);
+      MMU_writeByte (mmu, 0xA000, 0x10 + i);
+      MMU_writeWord (mmu, 0xBFFE, 0x2000 + i);
+   }
+   for (i = 0; i < 4; i++) {
+      MMU_writeByte (mmu, 0x4000, i);
+      assert (MMU_readByte (mmu, 0xA000) == 0x10 + i);
+      assert (MMU_readWord (mmu, 0xBFFE) == 0x2000 + i);
+   }
+   MMU_writeByte (mmu, 0x0000, 0x00);
+   assert (MMU_readByte (mmu, 0xA000) == 0xFF);
+
+   GB_free (gb);
+
+   /* Bank numbers past the end of a small ROM wrap round */
+   gb = loadBankedROM (0x01, 4, 0x00);
+   mmu = GB_getMMU (gb);
+   MMU_writeByte (mmu, 0x2000, 0x1E);
+   assert (readBankNumber (mmu, 0x4000) == 2);
+   GB_free (gb);
+
+   /* MBC2, with its own 512 half bytes of RAM */
+   gb = loadBankedROM (0x05, 16, 0x00);
+   mmu = GB_getMMU (gb);
+
+   MMU_writeByte (mmu, 0x2100, 0x0B);
+   assert (readBankNumber (mmu, 0x4000) == 0x0B);
+   MMU_writeByte (mmu, 0x2000, 0x0A);
+   assert (readBankNumber (mmu, 0x4000) == 0x0B);
+   MMU_writeByte (mmu, 0x0000, 0x0A);
+   MMU_writeByte (mmu, 0xA001, 0x3C);
+   assert (MMU_readByte (mmu, 0xA001) == 0xFC);
+   assert (MMU_readByte (mmu, 0xA201) == 0xFC);
+   assert (MMU_readByte (mmu, 0xBE01) == 0xFC);
+
+   GB_free (gb);
+
+   /* MBC3 with 2 MB of ROM and 32 kB of RAM */
+   gb = loadBankedROM (0x12, 128, 0x03);
+   mmu = GB_getMMU (gb);
+
+   MMU_writeByte (mmu, 0x2000, 0x7F);
+   assert (readBankNumber (mmu, 0x4000) == 0x7F);
+   MMU_writeByte (mmu, 0x2000, 0x00);
+   assert (readBankNumber (mmu, 0x4000) == 1);
+   MMU_writeByte (mmu, 0x0000, 0x0A);
+   MMU_writeByte (mmu, 0x4000, 0x02);
+   MMU_writeByte (mmu, 0xA123, 0x42);
+   MMU_writeByte (mmu, 0x4000, 0x01);
+   assert (MMU_readByte (mmu, 0xA123) == 0x00);
+   MMU_writeByte (mmu, 0x4000, 0x02);
+   assert (MMU_readByte (mmu, 0xA123) == 0x42);
+
+   GB_free (gb);
+
+   /* MBC5 with 8 MB of ROM and 128 kB of RAM, where bank 0 can be
+      mapped at 0x4000 */
+   gb = loadBankedROM (0x1A, 512, 0x04);
+   mmu = GB_getMMU (gb);
+
+   MMU_writeByte (mmu, 0x2000, 0x00);
+   assert (readBankNumber (mmu, 0x4000) == 0);
+   MMU_writeByte (mmu, 0x2000, 0xCD);
+   MMU_writeByte (mmu, 0x3000, 0x01);
+   assert (readBankNumber (mmu, 0x4000) == 0x1CD);
+   MMU_writeByte (mmu, 0x0000, 0x0A);
+   MMU_writeByte (mmu, 0x4000, 0x0F);
+   MMU_writeByte (mmu, 0xBFFF, 0x99);
+   MMU_writeByte (mmu, 0x4000, 0x00);
+   MMU_writeByte (mmu, 0xBFFF, 0x11);
+   MMU_writeByte (mmu, 0x4000, 0x0F);
+   assert (MMU_readByte (mmu, 0xBFFF) == 0x99);
+
+   GB_free (gb);
+
+   printf ("Mapper tests passed.\n");
+}
+
+int readBankNumber (MMU mmu, int location) {
+   return MMU_readWord (mmu, location);
+}
+
+GB loadBankedROM (byte type, int numBanks, byte ramSize) {
+   GB gb;
+   char path[] = "/tmp/gbtestXXXXXX";
+
+   writeBankedROM (path, type, numBanks, ramSize);
+
+   gb = GB_init ();
+   GB_loadRom (gb, path);
+   remove (path);
+
+   return gb;
+}
+
+void writeBankedROM (char *path, byte type, int numBanks, byte ramSize) {
+   FILE *file;
+   byte bank[ROM_BANK_SIZE];
+   int fd;
+   int i;
+
+   /* Each bank starts with its number, then LD A,n; HALT */
+   memset (bank, 0, sizeof(bank));
+   bank[2] = 0x3E;
+   bank[4] = 0x76;
+
+   fd = mkstemp (path);
+   assert (fd >= 0);
+   file = fdopen (fd, "wb");
+   assert (file != NULL);
+   for (i = 0; i < numBanks; i++) {
+      bank[0] = i & 0xFF;
+      bank[1] = i >> 8;
+      bank[3] = i & 0xFF;
+      if (i == 0) {
+         bank[0x0147] = type;
+         bank[0x0149] = ramSize;
+      }
+      fwrite (bank, 1, sizeof(bank), file);
+      bank[0x0147] = 0;
+      bank[0x0149] = 0;
+   }
+   fclose (file);
+}
+
+void testClock () {
+   GB gb;
+   MMU mmu;
+   CPU cpu;
+   FILE *file;
+   char path[] = "/tmp/gbtestXXXXXX";
+   char savePath[sizeof(path) + 4];
+   byte registers[5];
+   byte saved[48];
+   long long now;
+   int i;
+
+   printf ("Testing the cartridge clock...\n");
+
+   /* MBC3 with a clock */
+   writeBankedROM (path, 0x10, 4, 0x03);
+   sprintf (savePath, "%s.sav", path);
+
+   gb = GB_init ();
+   GB_loadRom (gb, path);
+   mmu = GB_getMMU (gb);
+   cpu = GB_getCPU (gb);
+
+   /* Halted with nothing to wake it, so cycles go by quickly */
+   MMU_writeByte (mmu, 0xC000, 0x76);
+   CPU_set16bitRegisterValue (cpu, PC, 0xC000);
+   CPU_setIME (cpu, FALSE);
+   MMU_writeByte (mmu, 0xFFFF, 0);
+
+   MMU_writeByte (mmu, 0x0000, 0x0A);
+   readClock (mmu, registers);
+   for (i = 0; i < 5; i++) {
+      assert (registers[i] == 0);
+   }
+
+   /* Two seconds before day 511 runs out */
+   writeClock (mmu, 4, 0x01);
+   writeClock (mmu, 3, 0xFF);
+   writeClock (mmu, 2, 23);
+   writeClock (mmu, 1, 59);
+   writeClock (mmu, 0, 58);
+   readClock (mmu, registers);
+   assert (registers[0] == 58 && registers[1] == 59 && registers[2] == 23);
+   assert (registers[3] == 0xFF && registers[4] == 0x01);
+
+   /* The registers only change when they are latched again, and then
+      it has gone round to day 0 and set the carry */
+   GB_runCycles (gb, 3 * CLOCK_SPEED);
+   MMU_writeByte (mmu, 0x4000, 0x08);
+   assert (MMU_readByte (mmu, 0xA000) == 58);
+   readClock (mmu, registers);
+   assert (registers[0] == 1 && registers[1] == 0 && registers[2] == 0);
+   assert (registers[3] == 0 && registers[4] == 0x80);
+
+   /* Stopped, it doesn't count */
+   writeClock (mmu, 4, 0x40);
+   GB_runCycles (gb, 2 * CLOCK_SPEED);
+   readClock (mmu, registers);
+   assert (registers[0] == 1 && registers[4] == 0x40);
+   writeClock (mmu, 4, 0x00);
+   GB_runCycles (gb, CLOCK_SPEED);
+   readClock (mmu, registers);
+   assert (registers[0] == 2 && registers[4] == 0x00);
+
+   GB_free (gb);
+
+   /* Saved and loaded again it is where it was */
+   gb = GB_init ();
+   GB_loadRom (gb, path);
+   mmu = GB_getMMU (gb);
+   MMU_writeByte (mmu, 0x0000, 0x0A);
+   readClock (mmu, registers);
+   assert (registers[0] == 2 && registers[1] == 0 && registers[2] == 0);
+   GB_free (gb);
+
+   /* On the end of the save file, after the 32 kB of RAM */
+   file = fopen (savePath, "r+b");
+   assert (file != NULL);
+   assert (fseek (file, 0x8000, SEEK_SET) == 0);
+   assert (fread (saved, 1, sizeof(saved), file) == sizeof(saved));
+   assert (fgetc (file) == EOF);
+   assert (saved[0] == 2 && saved[4] == 0 && saved[8] == 0);
+
+   /* With the offline time counted, the hour it was saved for too */
+   now = (long long)time (NULL) - 60 * 60;
+   for (i = 0; i < 8; i++) {
+      saved[40 + i] = (now >> (i * 8)) & 0xFF;
+   }
+   assert (fseek (file, 0x8000, SEEK_SET) == 0);
+   fwrite (saved, 1, sizeof(saved), file);
+   fclose (file);
+
+   gb = GB_init ();
+   GB_setOfflineTime (gb, TRUE);
+   GB_loadRom (gb, path);
+   mmu = GB_getMMU (gb);
+   MMU_writeByte (mmu, 0x0000, 0x0A);
+   readClock (mmu, registers);
+   assert (registers[2] == 1 && registers[1] == 0);
+   GB_free (gb);
+
+   remove (path);
+   remove (savePath);
+
+   printf ("Cartridge clock tests passed.\n");
+}
+
+void testSaveRAM () {
+   GB gb;
+   MMU mmu;
+   FILE *file;
+   char path[] = "/tmp/gbtestXXXXXX";
+   char savePath[sizeof(path) + 4];
+   byte *saved;
+   long size;
+
+   printf ("Testing save files...\n");
+
+   /* MBC5 with a battery and 128 kB of RAM */
+   writeBankedROM (path, 0x1B, 4, 0x04);
+   sprintf (savePath, "%s.sav", path);
+
+   gb = GB_init ();
+   GB_loadRom (gb, path);
+   mmu = GB_getMMU (gb);
+
+   MMU_writeByte (mmu, 0x0000, 0x0A);
+   MMU_writeByte (mmu, 0xA000, 0x12);
+   MMU_writeByte (mmu, 0x4000, 0x0F);
+   MMU_writeByte (mmu, 0xBFFF, 0x34);
+   MMU_writeByte (mmu, 0x0000, 0x00);
+   Cartridge_flushRAM (GB_getCartridge (gb));
+
+   /* The RAM is the file, so it's already there */
+   saved = (byte*)malloc(0x20000);
+   assert (saved != NULL);
+   file = fopen (savePath, "rb");
+   assert (file != NULL);
+   fseek (file, 0, SEEK_END);
+   size = ftell (file);
+   fseek (file, 0, SEEK_SET);
+   assert (size == 0x20000);
+   assert (fread (saved, 1, size, file) == size);
+   fclose (file);
+   assert (saved[0] == 0x12 && saved[0x1FFFF] == 0x34);
+   assert (saved[1] == 0x00 && saved[0x1FFFE] == 0x00);
+   free (saved);
+
+   GB_free (gb);
+
+   /* And is loaded with the ROM again */
+   gb = GB_init ();
+   GB_loadRom (gb, path);
+   mmu = GB_getMMU (gb);
+   MMU_writeByte (mmu, 0x0000, 0x0A);
+   assert (MMU_readByte (mmu, 0xA000) == 0x12);
+   MMU_writeByte (mmu, 0x4000, 0x0F);
+   assert (MMU_readByte (mmu, 0xBFFF) == 0x34);
+   GB_free (gb);
+
+   remove (path);
+   remove (savePath);
+
+   /* Without a battery nothing is saved */
+   strcpy (path, "/tmp/gbtestXXXXXX");
+   writeBankedROM (path, 0x1A, 4, 0x04);
+   sprintf (savePath, "%s.sav", path);
+   gb = GB_init ();
+   GB_loadRom (gb, path);
+   mmu = GB_getMMU (gb);
+   MMU_writeByte (mmu, 0x0000, 0x0A);
+   MMU_writeByte (mmu, 0xA000, 0x12);
+   GB_free (gb);
+   assert (fopen (savePath, "rb") == NULL);
+   remove (path);
+
+   printf ("Save file tests passed.\n");
+}
+
+void testDMA () {
+   GB gb;
+   MMU mmu;
+   CPU cpu;
+   Cartridge cartridge;
+   byte *memory;
+   Uint8 *pixels;
+   long long start;
+   int i;
+
+   printf ("Testing OAM DMA...\n");
+
+   /* MBC1 with 8 kB of RAM */
+   gb = loadBankedROM (0x02, 4, 0x02);
+   mmu = GB_getMMU (gb);
+   cpu = GB_getCPU (gb);
+   cartridge = GB_getCartridge (gb);
+   memory = MMU_getMemory (mmu);
+
+   /* Halted with nothing to wake it, as the CPU can't get at its
+      program while DMA runs */
+   MMU_writeByte (mmu, 0xC000, 0x76);
+   CPU_set16bitRegisterValue (cpu, PC, 0xC000);
+   CPU_setIME (cpu, FALSE);
+   MMU_writeByte (mmu, 0xFFFF, 0);
+   GB_runCycles (gb, 4);
+
+   /* From the ROM bank that is switched in */
+   MMU_writeByte (mmu, 0x2000, 0x02);
+   MMU_writeByte (mmu, 0xFF46, 0x40);
+   GB_runCycles (gb, MMU_DMA_CYCLES);
+   for (i = 0; i < MMU_DMA_LENGTH; i++) {
+      assert (MMU_readByte (mmu, 0xFE00 + i) ==
+              Cartridge_getData (cartridge, 2)[i]);
+   }
+   assert (readBankNumber (mmu, 0xFE00) == 2);
+
+   /* And from external RAM */
+   MMU_writeByte (mmu, 0x0000, 0x0A);
+   for (i = 0; i < MMU_DMA_LENGTH; i++) {
+      MMU_writeByte (mmu, 0xA000 + i, i ^ 0x5A);
+   }
+   MMU_writeByte (mmu, 0xFF46, 0xA0);
+   GB_runCycles (gb, MMU_DMA_CYCLES);
+   for (i = 0; i < MMU_DMA_LENGTH; i++) {
+      assert (MMU_readByte (mmu, 0xFE00 + i) == (i ^ 0x5A));
+   }
+
+   /* Echo RAM is work RAM */
+   for (i = 0; i < MMU_DMA_LENGTH; i++) {
+      MMU_writeByte (mmu, 0xC100 + i, i);
+   }
+   MMU_writeByte (mmu, 0x8000, 0x42);
+   MMU_writeByte (mmu, 0xC150, 0x33);
+   MMU_writeByte (mmu, 0xFF46, 0xE1);
+   start = GB_getCycles (gb);
+
+   /* While it runs only HRAM can be used by the CPU, or built
+      accurately anything not on the source's bus */
+   GB_runCycles (gb, 12);
+   MMU_writeByte (mmu, 0xFF80, 0x99);
+   assert (MMU_readByte (mmu, 0xFF80) == 0x99);
+   assert (MMU_readByte (mmu, 0xFE00) == 0xFF);
+   MMU_writeByte (mmu, 0xC150, 0x77);
+   MMU_writeByte (mmu, 0xFE10, 0x77);
+#ifdef CPU_ACCURATE
+   assert (MMU_readByte (mmu, 0xD000) ==
+           (GB_getCycles (gb) - start - 4) / 4);
+   assert (MMU_readByte (mmu, 0x8000) == 0x42);
+#else
+   assert (MMU_readByte (mmu, 0xD000) == 0xFF);
+   assert (MMU_readByte (mmu, 0x8000) == 0xFF);
+#endif
+
+   /* Until it is done */
+   GB_runCycles (gb, MMU_DMA_CYCLES);
+   assert (GB_getCycles (gb) - start >= MMU_DMA_CYCLES);
+   assert (MMU_readByte (mmu, 0x8000) == 0x42);
+   assert (MMU_readByte (mmu, 0xC150) == 0x33);
+   for (i = 0; i < MMU_DMA_LENGTH; i++) {
+      assert (memory[0xFE00 + i] == ((i == 0x50) ? 0x33 : i));
+   }
+
+   /* The GPU still draws from video RAM while it runs. Every tile is
+      colour 2, which DMA's 0xFF can't pass for */
+   for (i = 0; i < 0x10; i += 2) {
+      MMU_writeByte (mmu, 0x8000 + i, 0x00);
+      MMU_writeByte (mmu, 0x8001 + i, 0xFF);
+   }
+   for (i = 0x9800; i < 0x9C00; i++) {
+      MMU_writeByte (mmu, i, 0x00);
+   }
+   MMU_writeByte (mmu, 0xFF47, 0xE4);
+   MMU_writeByte (mmu, 0xFF40, 0x91);
+   GB_runCycles (gb, FRAME_CYCLES);
+   while (MMU_readByte (mmu, 0xFF44) != 40) {
+      GB_runCycles (gb, 4);
+   }
+   MMU_writeByte (mmu, 0xFF46, 0xC1);
+   while (MMU_readByte (mmu, 0xFF44) != NUM_VISIBLE_SCANLINES) {
+      GB_runCycles (gb, 4);
+   }
+   pixels = GUI_getFramebuffer (GB_getGUI (gb));
+   for (i = 0; i < WINDOW_WIDTH * NUM_VISIBLE_SCANLINES; i++) {
+      assert (pixels[i] == COLOUR_DARKGRAY);
+   }
+
+   GB_free (gb);
+
+   printf ("OAM DMA tests passed.\n");
+}
+
+void readClock (MMU mmu, byte *registers) {
+   int i;
+
+   MMU_writeByte (mmu, 0x6000, 0x00);
+   MMU_writeByte (mmu, 0x6000, 0x01);
+   for (i = 0; i < 5; i++) {
+      MMU_writeByte (mmu, 0x4000, 0x08 + i);
+      registers[i] = MMU_readByte (mmu, 0xA000);
+   }
+}
+
+void writeClock (MMU mmu, int reg, byte value) {
+   MMU_writeByte (mmu, 0x4000, 0x08 + reg);
+   MMU_writeByte (mmu, 0xA000, value);
+}
+
+GB loadTestProgram (const byte *program, int size, const word *registers) {
+   GB gb;
+   CPU cpu;
+   MMU mmu;
+   int i;
+
+   gb = GB_init ();
+   mmu = GB_getMMU (gb);
+   cpu = GB_getCPU (gb);
+
+   GB_loadRom (gb, "ROMS/test1.ROM");
+
+   /* Something to copy, with HALTs to land on */
+   for (i = 0xC800; i < 0xDC00; i++) {
+      MMU_writeByte (mmu, i, (i >= 0xD800) ? 0x76 : i * 7);
+   }
+   for (i = 0; i < size; i++) {
+      MMU_writeByte (mmu, 0xC100 + i, program[i]);
+   }
+
+   CPU_set16bitRegisterValue (cpu, AF, registers[0]);
+   CPU_set16bitRegisterValue (cpu, BC, registers[1]);
+   CPU_set16bitRegisterValue (cpu, DE, registers[2]);
+   CPU_set16bitRegisterValue (cpu, HL, registers[3]);
+   CPU_set16bitRegisterValue (cpu, SP, 0xFFFE);
+   CPU_set16bitRegisterValue (cpu, PC, 0xC100);
+
+   return gb;
+}
+
+/* Runs until HALT with CPU_step if budget is 0, otherwise with
+   CPU_run in budget cycle slices until cycles have been used.
+   Returns the number of cycles used */
+int runUntilHalt (GB gb, int budget, int until) {
+   CPU cpu = GB_getCPU (gb);
+   MMU mmu = GB_getMMU (gb);
+   int cycles = 0;
+   byte opcode;
+
+   if (budget == 0) {
+      do {
+         opcode = MMU_readByte (mmu, CPU_get16bitRegisterValue (cpu, PC));
+         cycles += CPU_step (cpu);
+      } while (opcode != 0x76);
+   } else {
+      while (cycles < until) {
+         cycles += CPU_run (cpu, budget);
+      }
+   }
+
+   return cycles;
+}
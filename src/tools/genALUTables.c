@@ -0,0 +1,215 @@
+#include <stdio.h>
+
+#include "ALUTables.h"
+#include "types.h"
+
+/*
+Generates ALUTables.c, the lookup tables declared in ALUTables.h,
+on stdout. Run as part of the build, the tables are never edited by
+hand.
+*/
+
+#define FLAG_Z 0x80
+#define FLAG_N 0x40
+#define FLAG_H 0x20
+#define FLAG_C 0x10
+
+/* Entries per line of output */
+#define ENTRIES_PER_LINE 8
+
+word add (int a, int b, int carry);
+word sub (int a, int b, int carry);
+byte inc (int value);
+byte dec (int value);
+word daa (int a, int flags);
+word shift (aluShiftOperation operation, int value, int carry);
+
+void printRow (const int *values, int length, int isWord, int indent);
+
+int main (int argc, char *argv[]) {
+   int row[0x100];
+   int a, b, carry, op;
+
+   printf ("/* Generated by tools/genALUTables.c, do not edit */\n\n");
+   printf ("#include \"ALUTables.h\"\n\n");
+
+   printf ("const word aluADD[2][0x100][0x100] = {\n");
+   for (carry = 0; carry < 2; carry++) {
+      printf ("   {\n");
+      for (a = 0; a < 0x100; a++) {
+         for (b = 0; b < 0x100; b++) row[b] = add (a, b, carry);
+         printRow (row, 0x100, TRUE, 6);
+      }
+      printf ("   },\n");
+   }
+   printf ("};\n\n");
+
+   printf ("const word aluSUB[2][0x100][0x100] = {\n");
+   for (carry = 0; carry < 2; carry++) {
+      printf ("   {\n");
+      for (a = 0; a < 0x100; a++) {
+         for (b = 0; b < 0x100; b++) row[b] = sub (a, b, carry);
+         printRow (row, 0x100, TRUE, 6);
+      }
+      printf ("   },\n");
+   }
+   printf ("};\n\n");
+
+   printf ("const byte aluINC[0x100] = ");
+   for (a = 0; a < 0x100; a++) row[a] = inc (a);
+   printRow (row, 0x100, FALSE, 0);
+   printf ("\n");
+
+   printf ("const byte aluDEC[0x100] = ");
+   for (a = 0; a < 0x100; a++) row[a] = dec (a);
+   printRow (row, 0x100, FALSE, 0);
+   printf ("\n");
+
+   printf ("const word aluDAA[8][0x100] = {\n");
+   for (op = 0; op < 8; op++) {
+      for (a = 0; a < 0x100; a++) row[a] = daa (a, op << 4);
+      printRow (row, 0x100, TRUE, 3);
+   }
+   printf ("};\n\n");
+
+   printf ("const word aluShift[8][2][0x100] = {\n");
+   for (op = 0; op < 8; op++) {
+      printf ("   {\n");
+      for (carry = 0; carry < 2; carry++) {
+         for (a = 0; a < 0x100; a++) row[a] = shift (op, a, carry);
+         printRow (row, 0x100, TRUE, 6);
+      }
+      printf ("   },\n");
+   }
+   printf ("};\n");
+
+   return 0;
+}
+
+word add (int a, int b, int carry) {
+   int result = a + b + carry;
+   byte flags = 0;
+
+   if ((result & 0xFF) == 0) flags |= FLAG_Z;
+   if ((result & 0xF) < (a & 0xF)) flags |= FLAG_H;
+   if (result > 0xFF) flags |= FLAG_C;
+
+   return ((result & 0xFF) << 8) | flags;
+}
+
+word sub (int a, int b, int carry) {
+   int result = a - b - carry;
+   byte flags = FLAG_N;
+
+   /* 0 - 0xFF - 1 is -256, which doesn't count as zero */
+   if (result == 0) flags |= FLAG_Z;
+   if ((result & 0xF) > (a & 0xF)) flags |= FLAG_H;
+   if (result < 0) flags |= FLAG_C;
+
+   return ((result & 0xFF) << 8) | flags;
+}
+
+byte inc (int value) {
+   int result = value + 1;
+   byte flags = 0;
+
+   if ((result & 0xFF) == 0) flags |= FLAG_Z;
+   if ((result & 0xF) < (value & 0xF)) flags |= FLAG_H;
+
+   return flags;
+}
+
+byte dec (int value) {
+   int result = value - 1;
+   byte flags = FLAG_N;
+
+   if (result == 0) flags |= FLAG_Z;
+   if ((result & 0xF) > (value & 0xF)) flags |= FLAG_H;
+
+   return flags;
+}
+
+word daa (int a, int flags) {
+   byte newFlags = flags & (FLAG_N | FLAG_C);
+
+   if (flags & FLAG_N) {
+      /* Adjusting after a subtraction */
+      if (flags & FLAG_C) a -= 0x60;
+      if (flags & FLAG_H) a -= 0x06;
+   } else {
+      if ((flags & FLAG_C) || a > 0x99) {
+         a += 0x60;
+         newFlags |= FLAG_C;
+      }
+      if ((flags & FLAG_H) || (a & 0x0F) > 0x09) a += 0x06;
+   }
+
+   a &= 0xFF;
+   if (a == 0) newFlags |= FLAG_Z;
+
+   return (a << 8) | newFlags;
+}
+
+word shift (aluShiftOperation operation, int value, int carry) {
+   int result = 0;
+   byte flags = 0;
+
+   switch (operation) {
+      case ALU_RLC:
+         result = (value << 1) | (value >> 7);
+         if (value & 0x80) flags |= FLAG_C;
+         break;
+      case ALU_RRC:
+         result = (value >> 1) | (value << 7);
+         if (value & 0x01) flags |= FLAG_C;
+         break;
+      case ALU_RL:
+         result = (value << 1) | carry;
+         if (value & 0x80) flags |= FLAG_C;
+         break;
+      case ALU_RR:
+         result = (value >> 1) | (carry << 7);
+         if (value & 0x01) flags |= FLAG_C;
+         break;
+      case ALU_SLA:
+         result = value << 1;
+         if (value & 0x80) flags |= FLAG_C;
+         break;
+      case ALU_SRA:
+         result = (value >> 1) | (value & 0x80);
+         if (value & 0x01) flags |= FLAG_C;
+         break;
+      case ALU_SRL:
+         result = value >> 1;
+         if (value & 0x01) flags |= FLAG_C;
+         break;
+      case ALU_SWAP:
+         result = (value << 4) | (value >> 4);
+         break;
+   }
+
+   result &= 0xFF;
+   if (result == 0) flags |= FLAG_Z;
+
+   return (result << 8) | flags;
+}
+
+/* Prints a brace enclosed row of values, the closing brace followed
+   by a comma unless it ends a top level initialiser */
+void printRow (const int *values, int length, int isWord, int indent) {
+   int i;
+
+   printf ("%*s{\n", indent, "");
+   for (i = 0; i < length; i++) {
+      if (i % ENTRIES_PER_LINE == 0) {
+         printf ("%*s  ", indent, "");
+      }
+
+      printf (isWord ? " 0x%04X," : " 0x%02X,", values[i]);
+
+      if (i % ENTRIES_PER_LINE == ENTRIES_PER_LINE - 1 || i == length - 1) {
+         printf ("\n");
+      }
+   }
+   printf ("%*s}%s\n", indent, "", indent > 0 ? "," : ";");
+}